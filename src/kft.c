@@ -1,16 +1,31 @@
 #include "kft.h"
+#include "kft_builtin.h"
+#include "kft_cache.h"
+#include "kft_emit.h"
+#include "kft_error.h"
 #include "kft_io.h"
 #include "kft_io_input.h"
 #include "kft_io_itags.h"
 #include "kft_io_output.h"
+#include "kft_malloc.h"
+#include "kft_misc.h"
+#include "kft_pool.h"
+#include "kft_prog_eval.h"
+#include "kft_prog_parse.h"
+#include "kft_rt.h"
+#include "kft_shell.h"
+#include "kft_vars.h"
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <kwordexp.h>
 #include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <search.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +45,7 @@ typedef struct kft_context {
 } kft_context_t;
 
 static inline int kft_run(kft_input_t *pi, kft_output_t *po, int flags);
+static int kft_jobs_join_all(void);
 
 /**
  * set "INPUT" variable
@@ -59,8 +75,9 @@ static int kft_var_set_input(const char *value, kft_ispec_t ispec,
 static int kft_var_set_output(const char *value, kft_input_t *pi, int flags) {
   kft_output_t *po = kft_output_new_open(value);
   int ret = kft_run(pi, po, flags);
+  int ret2 = kft_jobs_join_all();
   kft_output_delete(po);
-  return ret;
+  return ret != KFT_SUCCESS ? ret : ret2;
 }
 
 /**
@@ -68,12 +85,13 @@ static int kft_var_set_output(const char *value, kft_input_t *pi, int flags) {
  *
  * @param name name of variable
  * @param value value of variable
+ * @param len length of value
  * @param pi input
  * @param po output
  * @param flags flags
  */
-static int kft_var_set(const char *name, const char *value, kft_input_t *pi,
-                       kft_output_t *po, int flags) {
+static int kft_var_set(const char *name, const char *value, size_t len,
+                       kft_input_t *pi, kft_output_t *po, int flags) {
   // SPECIAL NAME
   if (strcmp(KFT_VARNAME_INPUT, name) == 0) {
     kft_ispec_t ispec = kft_input_get_spec(pi);
@@ -99,8 +117,8 @@ static int kft_var_set(const char *name, const char *value, kft_input_t *pi,
     }
     return ret;
   }
-  int ret = setenv(name, value, 1);
-  if (ret != 0) {
+  if (kft_vars_set(name, value, len) != KFT_SUCCESS) {
+    errno = EINVAL;
     return KFT_FAILURE;
   }
   return KFT_SUCCESS;
@@ -116,19 +134,22 @@ static int kft_var_set(const char *name, const char *value, kft_input_t *pi,
  */
 static int kft_var_get(const char *name, kft_input_t *pi, kft_output_t *po) {
   const char *value = NULL;
+  size_t len = 0;
   // SPECIAL NAME
   if (strcmp(KFT_VARNAME_INPUT, name) == 0) {
     value = kft_input_get_filename(pi);
   } else if (strcmp(KFT_VARNAME_OUTPUT, name) == 0) {
     value = kft_output_get_filename(po);
   }
-  if (value == NULL) {
-    value = getenv(name);
+  if (value != NULL) {
+    len = strlen(value);
+  } else {
+    value = kft_vars_get(name, &len);
   }
 
   if (value != NULL) {
-    size_t ret = kft_write(value, 1, strlen(value), po);
-    if (ret < strlen(value)) {
+    size_t ret = kft_write(value, 1, len, po);
+    if (ret < len) {
       return KFT_FAILURE;
     }
   }
@@ -145,10 +166,18 @@ static int ktf_run_var(kft_input_t *pi, kft_output_t *po, int flags) {
     }
     kft_output_flush(po_name);
     const char *name = kft_output_get_data(po_name);
+    size_t namelen = kft_output_get_size(po_name);
     char *value = strchr(name, '=');
     if (value != NULL) {
       *(value++) = '\0';
-      int ret2 = kft_var_set(name, value, pi, po, flags);
+      size_t len = namelen - (value - name);
+      // BLOCKS RUNNING IN BACKGROUND ARE ORDERED BEFORE THE ASSIGNMENT
+      int ret3 = kft_jobs_join_all();
+      if (ret3 != KFT_SUCCESS) {
+        ret = ret3;
+        break;
+      }
+      int ret2 = kft_var_set(name, value, len, pi, po, flags);
       if (ret2 == KFT_FAILURE) {
         const char *filename = kft_input_get_filename(pi);
         size_t row = kft_input_get_row(pi);
@@ -187,12 +216,19 @@ static inline int ktf_run_write(kft_input_t *pi, int flags) {
     return KFT_FAILURE;
   }
   kft_output_close(po_filename);
+  // BLOCKS RUNNING IN BACKGROUND ARE ORDERED BEFORE THE OUTPUT CHANGE
+  int ret3 = kft_jobs_join_all();
+  if (ret3 != KFT_SUCCESS) {
+    kft_output_delete(po_filename);
+    return ret3;
+  }
   const char *filename = kft_output_get_data(po_filename);
   kft_output_t *po_write = kft_output_new_open(filename);
   int ret2 = kft_run(pi, po_write, flags);
+  ret3 = kft_jobs_join_all();
   kft_output_delete(po_filename);
   kft_output_delete(po_write);
-  return ret2;
+  return ret2 != KFT_SUCCESS ? ret2 : ret3;
 }
 
 static inline int ktf_run_read(kft_input_t *pi, kft_output_t *po, int flags) {
@@ -212,6 +248,35 @@ static inline int ktf_run_read(kft_input_t *pi, kft_output_t *po, int flags) {
   return ret2;
 }
 
+static inline int kft_run_eval(kft_input_t *pi, kft_output_t *po, int flags) {
+  kft_output_t *po_expr = kft_output_new_mem();
+  int ret = kft_run(pi, po_expr, flags);
+  if (ret != KFT_SUCCESS) {
+    kft_output_delete(po_expr);
+    return KFT_FAILURE;
+  }
+  kft_output_flush(po_expr);
+  const char *expr = kft_output_get_data(po_expr);
+  size_t len = kft_output_get_size(po_expr);
+  kft_expr_t *pexpr;
+  const kft_expr_t *pval;
+  const char *errmsg = "syntax error";
+  if (kft_prog_parse(expr, len, &pexpr) != KFT_PARSE_OK ||
+      kft_expr_eval(pexpr, &pval, &errmsg) != KFT_SUCCESS) {
+    const char *filename = kft_input_get_filename(pi);
+    size_t row = kft_input_get_row(pi);
+    size_t col = kft_input_get_col(pi);
+    fprintf(stderr, "%s:%zu:%zu: =%s: %s\n", filename, row + 1, col + 1, expr,
+            errmsg);
+    kft_output_delete(po_expr);
+    return KFT_FAILURE;
+  }
+  kft_string_t str = kft_expr_to_string(pval);
+  size_t sz = kft_write(str.value, 1, str.len, po);
+  kft_output_delete(po_expr);
+  return sz < str.len ? KFT_FAILURE : KFT_SUCCESS;
+}
+
 static inline void *kft_pump_run(void *data) {
   kft_context_t *ctx = data;
   int ret = kft_run(ctx->pi, ctx->po, ctx->flags);
@@ -225,80 +290,493 @@ static inline void *kft_pump_run(void *data) {
 #define KFT_EFL_PIPEIN_STDIN 1
 #define KFT_EFL_PIPEIN_ARG 2
 
-static inline int kft_exec(kft_input_t *pi, kft_output_t *po, int flags,
-                           const char *file, char *argv[], int eflags) {
-  // DEFAULT STREAM
-  int pipefds[4];
-  // pipefds[0] : read  of (  child  -> parent *)
-  // pipefds[1] : write of (* child  -> parent  )
-  // --- use follows only when eflags != KFT_EFL_PIPEIN_NONE ---
-  // pipefds[2] : read  of (  parent -> child  *)
-  // pipefds[3] : write of (* parent -> child   )
-  if (pipe(pipefds) == -1) {
-    return KFT_FAILURE;
+/**
+ * The running block (child process and its pump thread).
+ */
+typedef struct kft_job {
+  /** process id of the child (-1 when it could not be spawned) */
+  pid_t pid;
+  /** exit status of the child (-1 until it is reaped) */
+  int retcode;
+  /** pump thread (from the worker pool) */
+  kft_worker_t *pworker;
+  /** pump context */
+  kft_context_t ctx;
+  /** output of the block */
+  kft_output_t *po;
+  /** slot of output filled by the pump (NULL when run in foreground) */
+  kft_output_t *po_slot;
+} kft_job_t;
+
+/** maximum number of blocks running at once (-j) */
+static size_t kft_jobs_max = 1;
+
+/** blocks running in background (ring buffer, oldest first) */
+static kft_job_t **kft_jobs = NULL;
+
+/** index of the oldest block in kft_jobs */
+static size_t kft_jobs_head = 0;
+
+/** number of blocks running in background */
+static size_t kft_njobs = 0;
+
+/** depth of block bodies written to children (blocks run in foreground) */
+static int kft_jobs_depth = 0;
+
+/**
+ * Test whether a block can run in background
+ *
+ * @param po output of the block
+ * @return true if the output can keep a slot for it
+ */
+static bool kft_jobs_enabled(const kft_output_t *po) {
+  return kft_jobs_max > 1 && kft_jobs_depth == 0 && !kft_output_is_mem(po);
+}
+
+/**
+ * Wait for a block and write its output
+ *
+ * @param pjob block
+ * @return exit status of the block, or KFT_FAILURE
+ */
+static int kft_job_wait(kft_job_t *pjob) {
+  int ret = KFT_SUCCESS;
+  int retcode = pjob->pid == -1 ? EXIT_FAILURE : pjob->retcode;
+  while (pjob->pid != -1 && retcode == -1) {
+    int status;
+    pid_t pid_child = waitpid(pjob->pid, &status, 0);
+    if (pid_child == -1) {
+      if (errno == ECHILD) {
+        break;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      ret = KFT_FAILURE;
+      break;
+    }
+    if (pid_child == pjob->pid) {
+      if (WIFEXITED(status)) {
+        retcode = WEXITSTATUS(status);
+      } else if (WIFSIGNALED(status)) {
+        retcode = 128 + WTERMSIG(status);
+      }
+    }
   }
-  if (eflags != KFT_EFL_PIPEIN_NONE) {
-    if (pipe(pipefds + 2) == -1) {
-      return KFT_FAILURE;
+#ifdef DEBUG
+  fprintf(stderr, "retcode: %d\n", retcode);
+#endif
+
+  __attribute__((unused)) intptr_t ret_fromchild =
+      (intptr_t)kft_pool_join(pjob->pworker);
+  kft_input_delete(pjob->ctx.pi);
+#ifdef DEBUG
+  fprintf(stderr, "ret_fromchild: %d\n", (int)ret_fromchild);
+#endif
+  if (pjob->po_slot != NULL) {
+    if (kft_output_slot_done(pjob->po, pjob->po_slot) != KFT_SUCCESS) {
+      ret = KFT_FAILURE;
     }
+  } else {
+    kft_output_unshare(pjob->po);
   }
-  pid_t pid = fork();
-  if (pid == -1) {
+
+  if (ret != KFT_SUCCESS) {
     return KFT_FAILURE;
   }
+  if (retcode == -1) {
+    return 127;
+  }
+  return retcode;
+}
 
-  /////////////////////////////////
-  // CHILD PROCESS
-  /////////////////////////////////
-  if (pid == 0) {
-    // pipefds[0] : read  of (  child  -> parent *) -> close
-    // pipefds[1] : write of (* child  -> parent  ) -> STDOUT_FILENO
-    // --- use follows only when eflags == KFT_EFL_PIPEIN_STDIN ---
-    // pipefds[2] : read  of (  parent -> child  *) -> STDIN_FILENO
-    // pipefds[3] : write of (* parent -> child   ) -> close
-    // --- use follows only when eflags == KFT_EFL_PIPEIN_ARG ---
-    // pipefds[2] : read  of (  parent -> child  *) -> last argument
-    // pipefds[3] : write of (* parent -> child   ) -> close
-
-    char path_fd[strlen("/dev/fd/2147483647") + 1];
+/**
+ * Test whether a block running in background has failed (without waiting)
+ *
+ * @return true if a block could not be spawned or exited with non-zero status
+ */
+static bool kft_jobs_failed(void) {
+  for (size_t i = 0; i < kft_njobs; i++) {
+    kft_job_t *pjob = kft_jobs[(kft_jobs_head + i) % kft_jobs_max];
+    if (pjob->pid == -1) {
+      return true;
+    }
+    int status;
+    if (pjob->retcode == -1 &&
+        waitpid(pjob->pid, &status, WNOHANG) == pjob->pid) {
+      if (WIFEXITED(status)) {
+        pjob->retcode = WEXITSTATUS(status);
+      } else if (WIFSIGNALED(status)) {
+        pjob->retcode = 128 + WTERMSIG(status);
+      }
+    }
+    if (pjob->retcode > 0) {
+      return true;
+    }
+  }
+  return false;
+}
 
-    close(pipefds[0]);
-    if (pipefds[1] != STDOUT_FILENO) {
-      dup2(pipefds[1], STDOUT_FILENO);
-      close(pipefds[1]);
+/**
+ * Wait for the oldest block running in background
+ *
+ * @return exit status of the block, or KFT_FAILURE
+ */
+static int kft_jobs_wait_oldest(void) {
+  assert(kft_njobs > 0);
+  int ret = kft_job_wait(kft_jobs[kft_jobs_head]);
+  kft_jobs_head = (kft_jobs_head + 1) % kft_jobs_max;
+  kft_njobs--;
+  return ret;
+}
+
+/**
+ * Wait for all blocks running in background
+ *
+ * @return KFT_SUCCESS, or the status of the first block which failed
+ */
+static int kft_jobs_join_all(void) {
+  int ret = KFT_SUCCESS;
+  while (kft_njobs > 0) {
+    int ret2 = kft_jobs_wait_oldest();
+    if (ret == KFT_SUCCESS) {
+      ret = ret2;
     }
+  }
+  return ret;
+}
 
-    switch (eflags) {
+/**
+ * Make room for one more block running in background
+ *
+ * @return KFT_SUCCESS, or the status of the first block which failed
+ */
+static int kft_jobs_reserve(void) {
+  int ret = KFT_SUCCESS;
+  while (kft_njobs >= kft_jobs_max) {
+    int ret2 = kft_jobs_wait_oldest();
+    if (ret == KFT_SUCCESS) {
+      ret = ret2;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Add a block running in background
+ *
+ * @param pjob block (started)
+ * @return KFT_SUCCESS, or the status of the first block which failed
+ */
+static int kft_jobs_push(kft_job_t *pjob) {
+  int ret = kft_jobs_reserve();
+  kft_jobs[(kft_jobs_head + kft_njobs) % kft_jobs_max] = pjob;
+  kft_njobs++;
+  return ret;
+}
+
+/**
+ * Spawn a child connected to pipes
+ *
+ * @param file command
+ * @param argv arguments
+ * @param eflags how the body is passed to the child (KFT_EFL_*)
+ * @param pipefds pipes (pipefds[2] and pipefds[3] unless KFT_EFL_PIPEIN_NONE)
+ * @return process id of the child, or -1 (reported)
+ */
+static pid_t kft_spawn(const char *file, char *argv[], int eflags,
+                       const int pipefds[4]) {
+  // pipefds[0] : read  of (  child  -> parent *) -> close
+  // pipefds[1] : write of (* child  -> parent  ) -> STDOUT_FILENO
+  // --- use follows only when eflags == KFT_EFL_PIPEIN_STDIN ---
+  // pipefds[2] : read  of (  parent -> child  *) -> STDIN_FILENO
+  // pipefds[3] : write of (* parent -> child   ) -> close
+  // --- use follows only when eflags == KFT_EFL_PIPEIN_ARG ---
+  // pipefds[2] : read  of (  parent -> child  *) -> last argument
+  // pipefds[3] : write of (* parent -> child   ) -> close
+
+  // THE PIPES ARE CLOSE ON EXEC (NOT INHERITED BY OTHER CHILDREN), SO THE
+  // CHILD KEEPS ONLY THE ENDS DUPLICATED HERE (dup2 TO ITSELF CLEARS
+  // FD_CLOEXEC)
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, pipefds[1], STDOUT_FILENO);
+
+  char path_fd[strlen("/dev/fd/2147483647") + 1];
+  switch (eflags) {
+
+  case KFT_EFL_PIPEIN_STDIN:
+    posix_spawn_file_actions_adddup2(&fa, pipefds[2], STDIN_FILENO);
+    break;
+
+  case KFT_EFL_PIPEIN_ARG: {
+    snprintf(path_fd, sizeof(path_fd), "/dev/fd/%d", pipefds[2]);
+    posix_spawn_file_actions_adddup2(&fa, pipefds[2], pipefds[2]);
+    int argc = 0;
+    while (argv[argc] != NULL)
+      argc++;
+    char **argv_ = alloca((argc + 2) * sizeof(char *));
+    for (int i = 0; i < argc; i++) {
+      argv_[i] = (char *)argv[i];
+    }
+    argv_[argc] = path_fd;
+    argv_[argc + 1] = 0;
+    argv = argv_;
+  } break;
+  }
+
+  // NO PAGE TABLE COPY (glibc SPAWNS WITH CLONE_VM | CLONE_VFORK)
+  // PATH IS SEARCHED IN environ
+  kft_vars_sync();
+  pid_t pid;
+  int err = posix_spawnp(&pid, file, &fa, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&fa);
+  if (err != 0) {
+    // REPORT AS THE CHILD DID WHEN EXEC FAILED
+    fprintf(stderr, "%s: %s\n", file, strerror(err));
+    return -1;
+  }
+  return pid;
+}
+
+/**
+ * Run the output of a command (as the output of a child)
+ *
+ * @param out output of the command
+ * @param outlen length of output
+ * @param ispec input spec
+ * @param po output
+ * @param flags flags
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_run_output(const char *out, size_t outlen, kft_ispec_t ispec,
+                          kft_output_t *po, int flags) {
+  kft_input_t *pi_out = kft_input_new_mem(out, outlen, ispec);
+  int ret = kft_run(pi_out, po, flags | KFT_PFL_RAW);
+  kft_input_delete(pi_out);
+  return ret;
+}
+
+/**
+ * Run a command and capture its output (no pump thread)
+ *
+ * @param file command
+ * @param argv arguments
+ * @param eflags how the body is passed to the command (KFT_EFL_*)
+ * @param body block body (written to the command)
+ * @param bodylen length of block body
+ * @param po_out output of the command
+ * @param pcacheable set true if the command exited normally
+ * @return exit status of the command, or KFT_FAILURE
+ */
+static int kft_exec_capture(const char *file, char *argv[], int eflags,
+                            const char *body, size_t bodylen,
+                            kft_output_t *po_out, bool *pcacheable) {
+  *pcacheable = false;
+  int pipefds[4];
+  if (pipe2(pipefds, O_CLOEXEC) == -1) {
+    return KFT_FAILURE;
+  }
+  if (eflags != KFT_EFL_PIPEIN_NONE && pipe2(pipefds + 2, O_CLOEXEC) == -1) {
+    close(pipefds[0]);
+    close(pipefds[1]);
+    return KFT_FAILURE;
+  }
+  pid_t pid = kft_spawn(file, argv, eflags, pipefds);
+  close(pipefds[1]);
+  int fd_out = pipefds[0];
+  int fd_body = -1;
+  if (eflags != KFT_EFL_PIPEIN_NONE) {
+    close(pipefds[2]);
+    fd_body = pipefds[3];
+    if (pid == -1 || bodylen == 0) {
+      close(fd_body);
+      fd_body = -1;
+    } else {
+      fcntl(fd_body, F_SETFL, fcntl(fd_body, F_GETFL) | O_NONBLOCK);
+    }
+  }
 
-    case KFT_EFL_PIPEIN_STDIN:
-      if (pipefds[2] != STDIN_FILENO) {
-        dup2(pipefds[2], STDIN_FILENO);
-        close(pipefds[2]);
+  // WRITE BODY AND READ OUTPUT AT ONCE (EITHER PIPE MAY FILL UP)
+  // A CHILD WHICH DOES NOT READ ITS BODY IS FOUND BY EPIPE (NOT BY SIGPIPE)
+  sigset_t sigpipe, sigsaved;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &sigsaved);
+  int ret = KFT_SUCCESS;
+  bool broken = false;
+  char buf[BUFSIZ];
+  while (fd_out != -1 || fd_body != -1) {
+    // NEGATIVE FDS ARE IGNORED BY poll
+    struct pollfd pfds[2] = {{.fd = fd_out, .events = POLLIN},
+                             {.fd = fd_body, .events = POLLOUT}};
+    if (poll(pfds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
       }
-      close(pipefds[3]);
+      ret = KFT_FAILURE;
       break;
+    }
+    if (pfds[1].revents != 0) {
+      ssize_t nwritten = write(fd_body, body, bodylen);
+      if (nwritten > 0) {
+        body += nwritten;
+        bodylen -= nwritten;
+      } else if (errno == EPIPE) {
+        broken = true;
+      }
+      if (bodylen == 0 || (nwritten == -1 && errno != EAGAIN &&
+                           errno != EINTR)) {
+        close(fd_body);
+        fd_body = -1;
+      }
+    }
+    if (pfds[0].revents != 0) {
+      ssize_t nread = read(fd_out, buf, sizeof(buf));
+      if (nread == -1) {
+        if (errno == EINTR || errno == EAGAIN) {
+          continue;
+        }
+        ret = KFT_FAILURE;
+        break;
+      }
+      if (nread == 0) {
+        close(fd_out);
+        fd_out = -1;
+        continue;
+      }
+      kft_write(buf, 1, nread, po_out);
+    }
+  }
+  if (fd_out != -1) {
+    close(fd_out);
+  }
+  if (fd_body != -1) {
+    close(fd_body);
+  }
+  if (broken) {
+    struct timespec ts = {0, 0};
+    sigtimedwait(&sigpipe, NULL, &ts);
+  }
+  pthread_sigmask(SIG_SETMASK, &sigsaved, NULL);
 
-    case KFT_EFL_PIPEIN_ARG: {
-      snprintf(path_fd, sizeof(path_fd), "/dev/fd/%d", pipefds[2]);
-      close(pipefds[3]);
-      int argc = 0;
-      while (argv[argc] != NULL)
-        argc++;
-      char **argv_ = alloca((argc + 2) * sizeof(char *));
-      for (int i = 0; i < argc; i++) {
-        argv_[i] = (char *)argv[i];
+  int retcode = EXIT_FAILURE;
+  while (pid != -1) {
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+      if (errno == EINTR) {
+        continue;
       }
-      argv_[argc] = path_fd;
-      argv_[argc + 1] = 0;
-      argv = argv_;
-    } break;
+      ret = KFT_FAILURE;
+      break;
     }
+    if (WIFEXITED(status)) {
+      retcode = WEXITSTATUS(status);
+      *pcacheable = ret == KFT_SUCCESS;
+    } else if (WIFSIGNALED(status)) {
+      retcode = 128 + WTERMSIG(status);
+    }
+    break;
+  }
+  return ret != KFT_SUCCESS ? KFT_FAILURE : retcode;
+}
+
+/**
+ * Run a command through the command output cache
+ *
+ * The body is rendered before the command runs (it is a part of the key).
+ * On a hit, the stored output and exit status are replayed without spawning.
+ *
+ * @param pi input (at the body)
+ * @param po output
+ * @param flags flags
+ * @param file command
+ * @param argv arguments
+ * @param eflags how the body is passed to the command (KFT_EFL_*)
+ * @return exit status of the command, or KFT_FAILURE
+ */
+static int kft_exec_cached(kft_input_t *pi, kft_output_t *po, int flags,
+                           const char *file, char *argv[], int eflags) {
+  kft_output_t *po_body = NULL;
+  const char *body = NULL;
+  size_t bodylen = 0;
+  if (eflags != KFT_EFL_PIPEIN_NONE) {
+    po_body = kft_output_new_mem();
+    int ret = kft_run(pi, po_body, flags);
+    if (ret != KFT_SUCCESS) {
+      kft_output_delete(po_body);
+      return ret;
+    }
+    body = kft_output_get_data(po_body);
+    bodylen = kft_output_get_size(po_body);
+  }
+  char key[KFT_HASH_HEXLEN + 1];
+  kft_cache_exec_key(file, argv, eflags, body, bodylen, key);
+
+  int retcode;
+  int ret;
+  kft_cache_entry_t ent;
+  if (kft_cache_exec_load(key, &ent) == KFT_SUCCESS) {
+    retcode = ent.status;
+    ret = kft_run_output(ent.data, ent.len, kft_input_get_spec(pi), po, flags);
+    kft_cache_entry_release(&ent);
+  } else {
+    kft_output_t *po_out = kft_output_new_mem();
+    bool cacheable;
+    retcode = kft_exec_capture(file, argv, eflags, body, bodylen, po_out,
+                               &cacheable);
+    const char *out = kft_output_get_data(po_out);
+    size_t outlen = kft_output_get_size(po_out);
+    if (cacheable) {
+      kft_cache_exec_store(key, out, outlen, retcode);
+    }
+    ret = kft_run_output(out, outlen, kft_input_get_spec(pi), po, flags);
+    kft_output_delete(po_out);
+  }
+  if (po_body != NULL) {
+    kft_output_delete(po_body);
+  }
+  return ret != KFT_SUCCESS ? KFT_FAILURE : retcode;
+}
 
-    execvp(file, argv);
-    perror(file);
-    exit(EXIT_FAILURE);
+static inline int kft_exec(kft_input_t *pi, kft_output_t *po, int flags,
+                           const char *file, char *argv[], int eflags) {
+  if (kft_cache_enabled()) {
+    return kft_exec_cached(pi, po, flags, file, argv, eflags);
   }
 
+  bool async = kft_jobs_enabled(po);
+  if (async) {
+    // NO MORE BLOCKS AFTER A FAILED ONE (AS WITHOUT -j)
+    if (kft_jobs_failed()) {
+      return kft_jobs_join_all();
+    }
+    int ret = kft_jobs_reserve();
+    if (ret != KFT_SUCCESS) {
+      return ret;
+    }
+  }
+
+  // DEFAULT STREAM
+  int pipefds[4];
+  // pipefds[0] : read  of (  child  -> parent *)
+  // pipefds[1] : write of (* child  -> parent  )
+  // --- use follows only when eflags != KFT_EFL_PIPEIN_NONE ---
+  // pipefds[2] : read  of (  parent -> child  *)
+  // pipefds[3] : write of (* parent -> child   )
+  if (pipe2(pipefds, O_CLOEXEC) == -1) {
+    return KFT_FAILURE;
+  }
+  if (eflags != KFT_EFL_PIPEIN_NONE) {
+    if (pipe2(pipefds + 2, O_CLOEXEC) == -1) {
+      return KFT_FAILURE;
+    }
+  }
+  /////////////////////////////////
+  // CHILD PROCESS (SPAWN)
+  /////////////////////////////////
+  pid_t pid = kft_spawn(file, argv, eflags, pipefds);
+
   /////////////////////////////////
   // PARENT PROCESS
   /////////////////////////////////
@@ -312,93 +790,118 @@ static inline int kft_exec(kft_input_t *pi, kft_output_t *po, int flags,
   // ------------------------------
   // CHILD -> PARENT
   // ------------------------------
-  FILE *ifp_fromchild = fdopen(pipefds[0], "r");
-  if (ifp_fromchild == NULL) {
-    return KFT_FAILURE;
-  }
-
-  kft_input_t *pi_fromchild =
-      kft_input_new(ifp_fromchild, NULL, kft_input_get_spec(pi));
-
-  pthread_t tid_fromchild;
-  {
-    kft_context_t ctx_fromchild;
-    ctx_fromchild.pi = pi_fromchild;
-    ctx_fromchild.po = po;
-    ctx_fromchild.flags = flags | KFT_PFL_RAW;
-
-    int ret = pthread_create(&tid_fromchild, NULL, kft_pump_run,
-                             (void *)&ctx_fromchild);
-    if (ret != 0) {
-      return KFT_FAILURE;
-    }
+  // THE JOB (WITH THE PUMP CONTEXT) MUST LIVE UNTIL THE PUMP THREAD IS JOINED
+  kft_job_t job_sync;
+  kft_job_t *pjob =
+      async ? (kft_job_t *)kft_malloc(sizeof(kft_job_t)) : &job_sync;
+  pjob->pid = pid;
+  pjob->retcode = -1;
+  pjob->po = po;
+  pjob->po_slot = async ? kft_output_slot_new(po) : NULL;
+  // THE COMMAND NAME MAY BE FREED BEFORE AN ASYNC JOB IS WAITED
+  pjob->ctx.pi = kft_input_new_fd(pipefds[0], kft_strdup(file),
+                                  kft_input_get_spec(pi));
+  pjob->ctx.po = async ? pjob->po_slot : po;
+  pjob->ctx.flags = flags | KFT_PFL_RAW;
+  if (!async) {
+    kft_output_share(po);
   }
+  pjob->pworker = kft_pool_start(kft_pump_run, (void *)&pjob->ctx);
   close(pipefds[1]);
   // ------------------------------
   // PARENT -> CHILD
   // ------------------------------
+  int ret_tochild = KFT_SUCCESS;
   if (eflags != KFT_EFL_PIPEIN_NONE) {
     close(pipefds[2]);
-    FILE *ofp_tochild = fdopen(pipefds[3], "w");
-    if (ofp_tochild == NULL) {
-      return KFT_FAILURE;
+    if (pid == -1) {
+      // NO CHILD: CONSUME THE INPUT ANYWAY
+      int fd_null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+      if (fd_null != -1) {
+        dup3(fd_null, pipefds[3], O_CLOEXEC);
+        close(fd_null);
+      }
     }
+    kft_output_t *po_tochild = kft_output_new_fd(pipefds[3], file);
+    kft_jobs_depth++;
+    ret_tochild = kft_run(pi, po_tochild, flags);
+    kft_jobs_depth--;
+    kft_output_delete(po_tochild);
+  }
 
-    kft_output_t *po = kft_output_new(ofp_tochild, NULL);
-    int ret = kft_run(pi, po, flags);
-    kft_output_delete(po);
-    fclose(ofp_tochild);
-    if (ret != KFT_SUCCESS) {
-      return KFT_FAILURE;
-    }
+  if (async && ret_tochild == KFT_SUCCESS) {
+    // WAITED LATER (BY kft_jobs_reserve OR kft_jobs_join_all)
+    return kft_jobs_push(pjob);
   }
 
-  int retcode = -1;
-  while (1) {
-    int status;
-    pid_t pid_child = waitpid(pid, &status, 0);
-    if (pid_child == -1) {
-      if (errno == ECHILD) {
-        break;
-      }
-      if (errno == EINTR) {
-        continue;
-      }
-      return KFT_FAILURE;
-    }
-    if (pid_child == pid) {
-      if (WIFEXITED(status)) {
-        retcode = WEXITSTATUS(status);
-      } else if (WIFSIGNALED(status)) {
-        retcode = 128 + WTERMSIG(status);
-      }
-    }
+  int retcode = kft_job_wait(pjob);
+  if (ret_tochild != KFT_SUCCESS) {
+    return ret_tochild;
   }
-#ifdef DEBUG
-  fprintf(stderr, "retcode: %d\n", retcode);
-#endif
+  return retcode;
+}
 
-  intptr_t ret_fromchild;
-  pthread_join(tid_fromchild, (void **)&ret_fromchild);
-  kft_input_delete(pi_fromchild);
-  fclose(ifp_fromchild);
-#ifdef DEBUG
-  fprintf(stderr, "ret_fromchild: %d\n", (int)ret_fromchild);
-#endif
+/** persistent shell (created at the first use) */
+static kft_shell_t *kft_shell_persistent = NULL;
 
-  if (retcode == -1) {
-    return 127;
+static void kft_shell_persistent_delete(void) {
+  kft_shell_delete(kft_shell_persistent);
+  kft_shell_persistent = NULL;
+}
+
+/**
+ * Test whether scripts run in the persistent shell
+ *
+ * @return true if $KFT_SHELL_PERSIST is set (and not empty or "0")
+ */
+static bool kft_shell_persist_enabled(void) {
+  const char *persist = kft_vars_get(KFT_ENVNAME_SHELL_PERSIST, NULL);
+  return persist != NULL && persist[0] != '\0' && strcmp(persist, "0") != 0;
+}
+
+/**
+ * Run a script in the persistent shell
+ *
+ * @param pi input (at the script)
+ * @param po output
+ * @param flags flags
+ * @param shell shell command
+ * @return exit status of the script, or KFT_FAILURE
+ */
+static int kft_run_shell_persistent(kft_input_t *pi, kft_output_t *po,
+                                    int flags, const char *shell) {
+  kft_output_t *po_script = kft_output_new_mem();
+  int ret = kft_run(pi, po_script, flags);
+  if (ret != KFT_SUCCESS) {
+    kft_output_delete(po_script);
+    return KFT_FAILURE;
   }
-  return retcode;
+  if (kft_shell_persistent == NULL) {
+    kft_shell_persistent = kft_shell_new();
+    atexit(kft_shell_persistent_delete);
+  }
+  const char *script = kft_output_get_data(po_script);
+  size_t len = kft_output_get_size(po_script);
+  const char *out;
+  size_t outlen;
+  int retcode =
+      kft_shell_run(kft_shell_persistent, shell, script, len, &out, &outlen);
+  kft_output_delete(po_script);
+
+  ret = kft_run_output(out, outlen, kft_input_get_spec(pi), po, flags);
+  return ret != KFT_SUCCESS ? KFT_FAILURE : retcode;
 }
 
 static inline int kft_run_shell(kft_input_t *pi, kft_output_t *po, int flags) {
-  char *shell = getenv(KFT_ENVNAME_SHELL);
-  if (shell == NULL) {
-    shell = getenv(KFT_ENVNAME_SHELL_RAW);
+  const char *shell_var = kft_vars_get(KFT_ENVNAME_SHELL, NULL);
+  if (shell_var == NULL) {
+    shell_var = kft_vars_get(KFT_ENVNAME_SHELL_RAW, NULL);
   }
-  if (shell == NULL) {
-    shell = KFT_OPTDEF_SHELL;
+  // COPIED: THE BODY MAY SET THE VARIABLE BEFORE THE SHELL IS STARTED
+  char *shell =
+      kft_strdup(shell_var != NULL ? shell_var : KFT_OPTDEF_SHELL);
+  if (kft_shell_persist_enabled()) {
+    return kft_run_shell_persistent(pi, po, flags, shell);
   }
   char *argv[] = {shell, NULL};
   return kft_exec(pi, po, flags, shell, argv, KFT_EFL_PIPEIN_ARG);
@@ -412,6 +915,46 @@ static inline int kft_exec_inline(kft_ispec_t ispec, kft_output_t *po,
   return ret;
 }
 
+/**
+ * Run a builtin command (as the output of a child)
+ *
+ * @param pi input (at the body)
+ * @param po output
+ * @param flags flags
+ * @param pb builtin
+ * @param argv arguments
+ * @param eflags how the body is passed to the command (KFT_EFL_*)
+ * @return exit status of the command, or KFT_FAILURE
+ */
+static int kft_run_builtin(kft_input_t *pi, kft_output_t *po, int flags,
+                           const kft_builtin_t *pb, char *argv[],
+                           int eflags) {
+  kft_output_t *po_body = NULL;
+  const char *body = NULL;
+  size_t bodylen = 0;
+  if (eflags != KFT_EFL_PIPEIN_NONE) {
+    po_body = kft_output_new_mem();
+    int ret = kft_run(pi, po_body, flags);
+    if (ret != KFT_SUCCESS) {
+      kft_output_delete(po_body);
+      return ret;
+    }
+    body = kft_output_get_data(po_body);
+    bodylen = kft_output_get_size(po_body);
+  }
+  kft_output_t *po_out = kft_output_new_mem();
+  int retcode = kft_builtin_run(pb, argv, body, bodylen,
+                                eflags == KFT_EFL_PIPEIN_ARG, po_out);
+  int ret = kft_run_output(kft_output_get_data(po_out),
+                           kft_output_get_size(po_out), kft_input_get_spec(pi),
+                           po, flags);
+  kft_output_delete(po_out);
+  if (po_body != NULL) {
+    kft_output_delete(po_body);
+  }
+  return ret != KFT_SUCCESS ? KFT_FAILURE : retcode;
+}
+
 static inline int kft_run_hash(kft_input_t *pi, kft_output_t *po, int flags) {
   kft_output_t *po_linebuf = kft_output_new_mem();
   int ret = kft_run(pi, po_linebuf, flags | KFT_PFL_RETURN_ON_EOL);
@@ -427,19 +970,33 @@ static inline int kft_run_hash(kft_input_t *pi, kft_output_t *po, int flags) {
   kwordexp_t p;
   char *argv[] = {NULL};
   kwordexp_init(&p, argv, 0);
+  // WORDS EXPAND VARIABLES IN environ
+  kft_vars_sync();
   int ret2 = kwordexp(words, &p, 0);
-  free(linebuf);
+  kft_output_delete(po_linebuf);
   if (ret2 != KFT_SUCCESS) {
     return KFT_FAILURE;
   }
+  int eflags = KFT_EFL_PIPEIN_NONE;
+  if (ret == KFT_EOL) {
+    eflags = like_shebang ? KFT_EFL_PIPEIN_ARG : KFT_EFL_PIPEIN_STDIN;
+  }
+  const kft_builtin_t *pb =
+      kft_builtin_enabled()
+          ? kft_builtin_find(p.kwe_wordv, eflags == KFT_EFL_PIPEIN_ARG)
+          : NULL;
+  if (pb != NULL) {
+    int ret = kft_run_builtin(pi, po, flags, pb, p.kwe_wordv, eflags);
+    kwordfree(&p);
+    return ret;
+  }
   if (ret != KFT_EOL) {
     kft_ispec_t ispec = kft_input_get_spec(pi);
     int ret = kft_exec_inline(ispec, po, flags, p.kwe_wordv[0], p.kwe_wordv);
     kwordfree(&p);
     return ret;
   }
-  int ret3 = kft_exec(pi, po, flags, p.kwe_wordv[0], p.kwe_wordv,
-                      like_shebang ? KFT_EFL_PIPEIN_ARG : KFT_EFL_PIPEIN_STDIN);
+  int ret3 = kft_exec(pi, po, flags, p.kwe_wordv[0], p.kwe_wordv, eflags);
   kwordfree(&p);
   return ret3;
 }
@@ -452,9 +1009,14 @@ static int kft_run_tags_set(kft_input_t *pi, int flags) {
     return KFT_FAILURE;
   }
   kft_output_close(po_tag);
-  const char *tag = kft_output_get_data(po_tag);
+  // TAG OR TAG=COUNT
+  char *tag = (char *)kft_output_get_data(po_tag);
+  int max_count;
+  tag[kft_itags_parse_key(tag, kft_output_get_size(po_tag), &max_count)] =
+      '\0';
   kft_itags_t *pitags = kft_input_get_tags(pi);
-  int ret2 = kft_itags_set(pitags, tag, pi, 1);
+  int ret2 = kft_itags_set(pitags, tag, pi, max_count);
+  kft_input_retain_tags(pi);
   kft_output_delete(po_tag);
   return ret2 == 0 ? KFT_SUCCESS : KFT_FAILURE;
 }
@@ -469,6 +1031,20 @@ static int kft_run_tags_goto(kft_input_t *pi, int flags) { // GOTO TAG
   kft_output_close(po_tag);
   const char *tag = kft_output_get_data(po_tag);
   kft_input_tagent_t *ptagent = kft_itags_get(kft_input_get_tags(pi), tag);
+  kft_ioffset_t tioff;
+  if (ptagent == NULL && kft_input_find_tag(pi, tag, &tioff) == KFT_SUCCESS) {
+    // JUMP TO THE TAG BLOCK NOT RUN YET (THE TAG IS SET BY RUNNING IT)
+    int ret2 = kft_fseek(pi, tioff);
+    if (ret2 != KFT_SUCCESS) {
+      const char *filename = kft_input_get_filename(pi);
+      size_t row = kft_input_get_row(pi);
+      size_t col = kft_input_get_col(pi);
+      fprintf(stderr, "%s:%zu:%zu: %s: seek failed\n", filename, row + 1,
+              col + 1, tag);
+    }
+    kft_output_delete(po_tag);
+    return ret2;
+  }
   if (ptagent == NULL) {
     const char *filename = kft_input_get_filename(pi);
     size_t row = kft_input_get_row(pi);
@@ -485,7 +1061,9 @@ static int kft_run_tags_goto(kft_input_t *pi, int flags) { // GOTO TAG
     return KFT_SUCCESS;
   }
   kft_input_tagent_incr_count(ptagent);
-  kft_ioffset_t tioff = kft_input_tagent_get_ioffset(ptagent);
+  // THE LAST JUMP TO THE TAG RELEASES THE DATA KEPT FOR IT
+  kft_input_retain_tags(pi);
+  tioff = kft_input_tagent_get_ioffset(ptagent);
 
   int ret2 = kft_fseek(pi, tioff);
   if (ret2 != KFT_SUCCESS) {
@@ -504,42 +1082,35 @@ static int kft_run_start(kft_input_t *pi, kft_output_t *po, int flags) {
     return kft_run(pi, po, flags);
   }
 
-  int ch = kft_fetch_raw(pi);
-  switch (ch) {
+  switch (kft_input_directive(pi)) {
   case '$':
-    kft_input_commit(pi, 1);
     return ktf_run_var(pi, po, flags);
 
   case '!':
-    kft_input_commit(pi, 1);
     return kft_run_shell(pi, po, flags);
 
   case '#':
-    kft_input_commit(pi, 1);
     return kft_run_hash(pi, po, flags);
 
   case ':':
-    kft_input_commit(pi, 1);
     return kft_run_tags_set(pi, flags);
 
   case '@':
-    kft_input_commit(pi, 1);
     return kft_run_tags_goto(pi, flags);
 
   case '-':
-    kft_input_commit(pi, 1);
     return kft_run(pi, po, flags | KFT_PFL_COMMENT);
 
   case '>':
-    kft_input_commit(pi, 1);
     return ktf_run_write(pi, flags);
 
   case '<':
-    kft_input_commit(pi, 1);
     return ktf_run_read(pi, po, flags);
 
+  case '=':
+    return kft_run_eval(pi, po, flags);
+
   default:
-    kft_input_rollback(pi, 1);
     return kft_run(pi, po, flags);
   }
 }
@@ -551,12 +1122,24 @@ static inline int kft_run(kft_input_t *pi, kft_output_t *po, int flags) {
 
   kft_ispec_t ispec = kft_input_get_spec(pi);
   const char *delim_st = kft_ispec_get_delim_st(ispec);
-  size_t delim_st_len = strlen(delim_st);
+  size_t delim_st_len = kft_ispec_get_match_st(&ispec)->len;
   const char *delim_en = kft_ispec_get_delim_en(ispec);
-  size_t delim_en_len = strlen(delim_en);
+  size_t delim_en_len = kft_ispec_get_match_en(&ispec)->len;
 
   while (1) {
 
+    // PLAIN TEXT RUN
+    const char *span;
+    size_t len = kft_fspan(pi, &span, return_on_eol);
+    if (len > 0 && !is_comment) {
+      off_t offset = 0;
+      int fd_span = kft_input_get_span_fd(pi, span, &offset);
+      size_t sz = kft_write_file(span, len, fd_span, offset, po);
+      if (sz < len) {
+        return KFT_FAILURE;
+      }
+    }
+
     int ch = kft_fgetc(pi);
 
     switch (ch) {
@@ -612,13 +1195,126 @@ static inline int kft_run(kft_input_t *pi, kft_output_t *po, int flags) {
   }
 }
 
-int main(int argc, char *argv[]) {
+/**
+ * Run a top level input (blocks running in background end with it)
+ *
+ * @param pi input
+ * @param po output
+ * @return KFT_SUCCESS, KFT_FAILURE or the status of a block
+ */
+static int kft_run_top(kft_input_t *pi, kft_output_t *po) {
+  int ret = kft_run(pi, po, 0);
+  int ret2 = kft_jobs_join_all();
+  return ret != KFT_SUCCESS ? ret : ret2;
+}
+
+struct kft_rt {
+  /** input (the compiled template) */
+  kft_input_t *pi;
+  /** output */
+  kft_output_t *po;
+  /** source offset to continue at (after KFT_RT_JUMP) */
+  size_t srcoff;
+};
+
+int kft_rt_text(kft_rt_t *prt, const char *str, size_t len) {
+  size_t sz = kft_write(str, 1, len, prt->po);
+  return sz < len ? KFT_FAILURE : KFT_SUCCESS;
+}
+
+int kft_rt_block(kft_rt_t *prt, size_t srcoff, size_t endoff) {
+  if (kft_input_seek_srcoff(prt->pi, srcoff) != KFT_SUCCESS ||
+      kft_fgetc(prt->pi) != KFT_CH_BEGIN) {
+    fprintf(stderr, "%s: %zu: not a block\n",
+            kft_input_get_filename(prt->pi), srcoff);
+    return KFT_FAILURE;
+  }
+  int ret = kft_run_start(prt->pi, prt->po, 0);
+  if (ret != KFT_SUCCESS) {
+    return ret;
+  }
+  prt->srcoff = (size_t)kft_ftell(prt->pi).offset;
+  return prt->srcoff == endoff ? KFT_SUCCESS : KFT_RT_JUMP;
+}
+
+int kft_rt_rest(kft_rt_t *prt, size_t srcoff) {
+  if (kft_input_seek_srcoff(prt->pi, srcoff) != KFT_SUCCESS) {
+    fprintf(stderr, "%s: %zu: seek failed\n", kft_input_get_filename(prt->pi),
+            srcoff);
+    return KFT_FAILURE;
+  }
+  return kft_run(prt->pi, prt->po, 0);
+}
+
+/**
+ * Render a template translated to C (blocks running in background end with
+ * it)
+ *
+ * @param ptmpl template
+ * @param bufsize_max maximum input lookahead buffer
+ * @param po output
+ * @return KFT_SUCCESS, KFT_FAILURE or the status of a block
+ */
+static int kft_rt_run_top(const kft_rt_template_t *ptmpl, size_t bufsize_max,
+                          kft_output_t *po) {
+  kft_ispec_t ispec =
+      kft_ispec_init(ptmpl->ch_esc, ptmpl->delim_st, ptmpl->delim_en);
+  ispec = kft_ispec_with_bufsize_max(ispec, bufsize_max);
+  kft_ops_t *pops = kft_ops_new(ptmpl->ops, ptmpl->nops, ptmpl->src,
+                                ptmpl->srclen, ptmpl->pool, ptmpl->poollen);
+  if (pops == NULL || ptmpl->nparts == 0) {
+    fprintf(stderr, "%s: broken translation\n", ptmpl->filename);
+    return KFT_FAILURE;
+  }
+  kft_rt_t rt = {
+      .pi = kft_input_new_ops(pops, ptmpl->filename, ispec),
+      .po = po,
+      .srcoff = 0,
+  };
+  size_t k = 0;
+  int ret = ptmpl->parts[k].render(&rt, 0);
+  while (ret == KFT_RT_NEXT || ret == KFT_RT_JUMP) {
+    if (ret == KFT_RT_NEXT) {
+      k++;
+      rt.srcoff = ptmpl->parts[k].srcoff;
+    } else {
+      // THE LAST PART STARTING AT OR BEFORE THE OFFSET
+      size_t lo = 0;
+      size_t hi = ptmpl->nparts;
+      while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ptmpl->parts[mid].srcoff <= rt.srcoff) {
+          lo = mid;
+        } else {
+          hi = mid;
+        }
+      }
+      k = lo;
+    }
+    ret = ptmpl->parts[k].render(&rt, rt.srcoff);
+  }
+  int ret2 = kft_jobs_join_all();
+  kft_input_delete(rt.pi);
+  return ret != KFT_SUCCESS ? ret : ret2;
+}
+
+int kft_main(int argc, char *argv[], const kft_rt_template_t *ptmpl) {
+  kft_vars_import(environ);
+
   struct option long_options[] = {
       {"eval", required_argument, NULL, 'e'},
       {"output", required_argument, NULL, 'o'},
       {"escape", required_argument, NULL, 'E'},
       {"start", required_argument, NULL, 'S'},
       {"end", required_argument, NULL, 'R'},
+      {"buffer-max", required_argument, NULL, 'B'},
+      {"write-buffer", required_argument, NULL, 'W'},
+      {"shell-persist", no_argument, NULL, 'P'},
+      {"jobs", required_argument, NULL, 'j'},
+      {"cache-dir", required_argument, NULL, 'C'},
+      {"template-cache", required_argument, NULL, 'T'},
+      {"emit-c", no_argument, NULL, 'c'},
+      {"no-builtins", no_argument, NULL, 'N'},
       {"help", no_argument, NULL, 'h'},
       {"version", no_argument, NULL, 'v'},
       {NULL, 0, NULL, 0},
@@ -630,10 +1326,14 @@ int main(int argc, char *argv[]) {
   int opt_escape = -1;
   const char *opt_begin = NULL;
   const char *opt_end = NULL;
+  const char *opt_buffer_max = NULL;
+  const char *opt_write_buffer = NULL;
+  const char *opt_jobs = NULL;
+  bool opt_emit_c = false;
   FILE *ofp = stdout;
   int opt;
-  while ((opt = getopt_long(argc, argv, "e:o:E:S:R:hv", long_options, NULL)) !=
-         -1) {
+  while ((opt = getopt_long(argc, argv, "e:o:E:S:R:B:W:Pj:C:T:cNhv",
+                            long_options, NULL)) != -1) {
     switch (opt) {
     case 'e':
       opt_eval = realloc(opt_eval, (nevals + 1) * sizeof(char *));
@@ -684,8 +1384,53 @@ int main(int argc, char *argv[]) {
       opt_end = optarg;
       break;
 
+    case 'B':
+      if (opt_buffer_max != NULL) {
+        fprintf(stderr, "error: multiple buffer sizes\n");
+        return EXIT_FAILURE;
+      }
+      opt_buffer_max = optarg;
+      break;
+
+    case 'W':
+      if (opt_write_buffer != NULL) {
+        fprintf(stderr, "error: multiple write buffer sizes\n");
+        return EXIT_FAILURE;
+      }
+      opt_write_buffer = optarg;
+      break;
+
+    case 'P':
+      kft_vars_set(KFT_ENVNAME_SHELL_PERSIST, "1", 1);
+      break;
+
+    case 'j':
+      if (opt_jobs != NULL) {
+        fprintf(stderr, "error: multiple jobs options\n");
+        return EXIT_FAILURE;
+      }
+      opt_jobs = optarg;
+      break;
+
+    case 'C':
+      kft_vars_set(KFT_ENVNAME_CACHE_DIR, optarg, strlen(optarg));
+      break;
+
+    case 'T':
+      kft_vars_set(KFT_ENVNAME_TEMPLATE_CACHE, optarg, strlen(optarg));
+      break;
+
+    case 'c':
+      opt_emit_c = true;
+      break;
+
+    case 'N':
+      kft_vars_set(KFT_ENVNAME_NO_BUILTINS, "1", 1);
+      break;
+
     case 'h': {
-      setenv("PROG", program_invocation_short_name, 1);
+      kft_vars_set("PROG", program_invocation_short_name,
+                   strlen(program_invocation_short_name));
       kft_ispec_t ispec =
           kft_ispec_init(KFT_OPTDEF_ESCAPE, KFT_OPTDEF_BEGIN, KFT_OPTDEF_END);
       kft_input_t *pi = kft_input_new_open(DATADIR "/kft_help.kft", ispec);
@@ -731,13 +1476,10 @@ int main(int argc, char *argv[]) {
     name[eq_idx] = '\0';
 
     if (value[0] == '\0') {
-      int err = unsetenv(name);
-      if (err != 0) {
-        return EXIT_FAILURE;
-      }
+      kft_vars_unset(name);
     } else {
-      int err = setenv(name, value, 1);
-      if (err != 0) {
+      int err = kft_vars_set(name, value, strlen(value));
+      if (err != KFT_SUCCESS) {
         return EXIT_FAILURE;
       }
     }
@@ -745,12 +1487,12 @@ int main(int argc, char *argv[]) {
   }
 
   if (opt_escape == -1) {
-    const char *esc = getenv(KFT_ENVNAME_ESCAPE);
+    const char *esc = kft_vars_get(KFT_ENVNAME_ESCAPE, NULL);
     opt_escape = esc == NULL ? KFT_OPTDEF_ESCAPE : esc[0];
   }
 
   if (opt_begin == NULL) {
-    opt_begin = getenv(KFT_ENVNAME_BEGIN);
+    opt_begin = kft_vars_get(KFT_ENVNAME_BEGIN, NULL);
   }
 
   if (opt_begin == NULL) {
@@ -758,19 +1500,74 @@ int main(int argc, char *argv[]) {
   }
 
   if (opt_end == NULL) {
-    opt_end = getenv(KFT_ENVNAME_END);
+    opt_end = kft_vars_get(KFT_ENVNAME_END, NULL);
   }
 
   if (opt_end == NULL) {
     opt_end = KFT_OPTDEF_END;
   }
 
+  if (opt_buffer_max == NULL) {
+    opt_buffer_max = kft_vars_get(KFT_ENVNAME_BUFFER_MAX, NULL);
+  }
+
+  size_t buffer_max = KFT_OPTDEF_BUFFER_MAX;
+  if (opt_buffer_max != NULL &&
+      kft_parse_size(opt_buffer_max, &buffer_max) != KFT_SUCCESS) {
+    fprintf(stderr, "error: invalid buffer size: %s\n", opt_buffer_max);
+    return EXIT_FAILURE;
+  }
+
+  if (opt_write_buffer == NULL) {
+    opt_write_buffer = kft_vars_get(KFT_ENVNAME_WRITE_BUFFER, NULL);
+  }
+
+  size_t write_buffer = KFT_OPTDEF_WRITE_BUFFER;
+  if (opt_write_buffer != NULL &&
+      kft_parse_size(opt_write_buffer, &write_buffer) != KFT_SUCCESS) {
+    fprintf(stderr, "error: invalid write buffer size: %s\n",
+            opt_write_buffer);
+    return EXIT_FAILURE;
+  }
+  kft_output_set_bufsize(write_buffer);
+
+  if (opt_jobs == NULL) {
+    opt_jobs = kft_vars_get(KFT_ENVNAME_JOBS, NULL);
+  }
+
+  if (opt_jobs != NULL) {
+    char *end;
+    errno = 0;
+    long jobs = strtol(opt_jobs, &end, 10);
+    if (end == opt_jobs || *end != '\0' || errno != 0 || jobs < 1) {
+      fprintf(stderr, "error: invalid number of jobs: %s\n", opt_jobs);
+      return EXIT_FAILURE;
+    }
+    kft_jobs_max = (size_t)jobs;
+  }
+  kft_jobs = (kft_job_t **)kft_malloc(kft_jobs_max * sizeof(kft_job_t *));
+
   kft_ispec_t is = kft_ispec_init(opt_escape, opt_begin, opt_end);
+  is = kft_ispec_with_bufsize_max(is, buffer_max);
+
+  if (opt_emit_c) {
+    if (ptmpl != NULL || optind + 1 != argc) {
+      fprintf(stderr, "error: --emit-c needs one template file\n");
+      return EXIT_FAILURE;
+    }
+    int ret = kft_emit_c(argv[optind], is, ofp);
+    if (fflush(ofp) == EOF) {
+      perror(opt_output != NULL ? opt_output : "stdout");
+      ret = KFT_FAILURE;
+    }
+    return ret == KFT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   kft_output_t *po = kft_output_new(ofp, NULL);
 
   for (size_t i = 0; i < nevals; i++) {
     kft_input_t *pi = kft_input_new_mem(opt_eval[i], strlen(opt_eval[i]), is);
-    int ret2 = kft_run(pi, po, 0);
+    int ret2 = kft_run_top(pi, po);
     kft_input_delete(pi);
     if (ret2 != KFT_SUCCESS) {
       kft_output_delete(po);
@@ -778,6 +1575,17 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (ptmpl != NULL) {
+    if (optind != argc) {
+      fprintf(stderr, "error: unexpected argument: %s\n", argv[optind]);
+      kft_output_delete(po);
+      return EXIT_FAILURE;
+    }
+    int ret = kft_rt_run_top(ptmpl, buffer_max, po);
+    kft_output_delete(po);
+    return ret == KFT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   if (optind == argc) {
 
     if (nevals > 0 && isatty(fileno(stdin))) {
@@ -786,7 +1594,7 @@ int main(int argc, char *argv[]) {
     }
     kft_input_t *pi = kft_input_new(stdin, NULL, is);
 
-    int ret = kft_run(pi, po, 0);
+    int ret = kft_run_top(pi, po);
     kft_input_delete(pi);
     kft_output_delete(po);
     return ret == KFT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
@@ -801,7 +1609,7 @@ int main(int argc, char *argv[]) {
       pi = kft_input_new_open(file, is);
     }
 
-    int ret = kft_run(pi, po, 0);
+    int ret = kft_run_top(pi, po);
     kft_input_delete(pi);
     if (ret != KFT_SUCCESS) {
       kft_output_delete(po);
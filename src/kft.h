@@ -14,14 +14,25 @@
 #define KFT_ENVNAME_PREFIX "KFT_"
 #define KFT_ENVNAME_SHELL KFT_ENVNAME_PREFIX "SHELL"
 #define KFT_ENVNAME_SHELL_RAW "SHELL"
+#define KFT_ENVNAME_SHELL_PERSIST KFT_ENVNAME_PREFIX "SHELL_PERSIST"
 #define KFT_ENVNAME_ESCAPE KFT_ENVNAME_PREFIX "ESCAPE"
 #define KFT_ENVNAME_BEGIN KFT_ENVNAME_PREFIX "BEGIN"
 #define KFT_ENVNAME_END KFT_ENVNAME_PREFIX "END"
+#define KFT_ENVNAME_BUFFER_MAX KFT_ENVNAME_PREFIX "BUFFER_MAX"
+#define KFT_ENVNAME_WRITE_BUFFER KFT_ENVNAME_PREFIX "WRITE_BUFFER"
+#define KFT_ENVNAME_JOBS KFT_ENVNAME_PREFIX "JOBS"
+#define KFT_ENVNAME_CACHE_DIR KFT_ENVNAME_PREFIX "CACHE_DIR"
+#define KFT_ENVNAME_CACHE_ENV KFT_ENVNAME_PREFIX "CACHE_ENV"
+#define KFT_ENVNAME_CACHE_FILES KFT_ENVNAME_PREFIX "CACHE_FILES"
+#define KFT_ENVNAME_NO_BUILTINS KFT_ENVNAME_PREFIX "NO_BUILTINS"
+#define KFT_ENVNAME_TEMPLATE_CACHE KFT_ENVNAME_PREFIX "TEMPLATE_CACHE"
 
 #define KFT_OPTDEF_SHELL "/bin/sh"
 #define KFT_OPTDEF_ESCAPE '\\'
 #define KFT_OPTDEF_BEGIN "{{"
 #define KFT_OPTDEF_END "}}"
+#define KFT_OPTDEF_BUFFER_MAX ((size_t)64 * 1024 * 1024)
+#define KFT_OPTDEF_WRITE_BUFFER ((size_t)64 * 1024)
 
 #define KFT_VARNAME_INPUT "INPUT"
 #define KFT_VARNAME_OUTPUT "OUTPUT"
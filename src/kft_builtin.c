@@ -0,0 +1,721 @@
+#include "kft_builtin.h"
+#include "kft_misc.h"
+#include "kft_vars.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** maximum digits of integer arguments (exact in every command) */
+#define KFT_BUILTIN_INT_DIGITS 15
+
+/** maximum digits of field widths and precisions */
+#define KFT_BUILTIN_WIDTH_DIGITS 4
+
+/**
+ * The builtin command (runs in-process instead of a child).
+ */
+struct kft_builtin {
+  /** command name */
+  const char *name;
+  /** test whether the output for the arguments is the same as the command */
+  bool (*accepts)(int argc, char *const argv[], bool body_is_arg);
+  /** run the command */
+  int (*run)(int argc, char *const argv[], const char *body, size_t bodylen,
+             bool body_is_arg, kft_output_t *po);
+};
+
+bool kft_builtin_enabled(void) {
+  const char *disabled = kft_vars_get(KFT_ENVNAME_NO_BUILTINS, NULL);
+  return disabled == NULL || disabled[0] == '\0' || strcmp(disabled, "0") == 0;
+}
+
+/* --------------------------------------------- *
+ * Helpers                                       *
+ * --------------------------------------------- */
+
+static void kft_builtin_write(const char *ptr, size_t len, kft_output_t *po) {
+  kft_write(ptr, 1, len, po);
+}
+
+static void kft_builtin_puts(const char *str, kft_output_t *po) {
+  kft_builtin_write(str, strlen(str), po);
+}
+
+/**
+ * Format to an output
+ *
+ * @param po output
+ * @param fmt format
+ */
+static void kft_builtin_printf(kft_output_t *po, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void kft_builtin_printf(kft_output_t *po, const char *fmt, ...) {
+  va_list ap, ap2;
+  va_start(ap, fmt);
+  va_copy(ap2, ap);
+  int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (len > 0) {
+    char buf[len + 1];
+    vsnprintf(buf, len + 1, fmt, ap2);
+    kft_builtin_write(buf, len, po);
+  }
+  va_end(ap2);
+}
+
+/**
+ * Parse a decimal integer written as the commands print it
+ *
+ * Leading zeros (octal in some commands) and "-0" are not accepted.
+ *
+ * @param str string
+ * @param allow_minus accept negative integers
+ * @param allow_plus accept a leading '+'
+ * @param pval parsed value
+ * @return true if the string is accepted
+ */
+static bool kft_builtin_parse_int(const char *str, bool allow_minus,
+                                  bool allow_plus, intmax_t *pval) {
+  bool minus = false;
+  if (*str == '-' && allow_minus) {
+    minus = true;
+    str++;
+  } else if (*str == '+' && allow_plus) {
+    str++;
+  }
+  size_t ndigits = strspn(str, "0123456789");
+  if (ndigits == 0 || ndigits > KFT_BUILTIN_INT_DIGITS ||
+      str[ndigits] != '\0' || (str[0] == '0' && (ndigits > 1 || minus))) {
+    return false;
+  }
+  intmax_t val = 0;
+  for (size_t i = 0; i < ndigits; i++) {
+    val = val * 10 + (str[i] - '0');
+  }
+  *pval = minus ? -val : val;
+  return true;
+}
+
+static bool kft_builtin_is_option(const char *arg) {
+  return arg[0] == '-' && arg[1] != '\0';
+}
+
+/* --------------------------------------------- *
+ * echo                                          *
+ * --------------------------------------------- */
+
+/**
+ * Parse options of echo
+ *
+ * @param argc number of arguments
+ * @param argv arguments
+ * @param pnewline set false by -n
+ * @param pescapes set by -e and -E
+ * @return index of the first operand
+ */
+static int kft_echo_options(int argc, char *const argv[], bool *pnewline,
+                            bool *pescapes) {
+  *pnewline = true;
+  *pescapes = false;
+  int i = 1;
+  for (; i < argc; i++) {
+    const char *p = argv[i];
+    if (p[0] != '-' || p[1] == '\0' || p[1 + strspn(p + 1, "eEn")] != '\0') {
+      break;
+    }
+    for (p++; *p != '\0'; p++) {
+      if (*p == 'n') {
+        *pnewline = false;
+      } else {
+        *pescapes = *p == 'e';
+      }
+    }
+  }
+  return i;
+}
+
+static bool kft_echo_accepts(int argc, char *const argv[], bool body_is_arg) {
+  if (body_is_arg || kft_vars_get("POSIXLY_CORRECT", NULL) != NULL) {
+    return false;
+  }
+  if (argc == 2 && (strcmp(argv[1], "--help") == 0 ||
+                    strcmp(argv[1], "--version") == 0)) {
+    return false;
+  }
+  bool newline, escapes;
+  int i = kft_echo_options(argc, argv, &newline, &escapes);
+  // ESCAPES ARE LEFT TO THE COMMAND
+  for (; escapes && i < argc; i++) {
+    if (strchr(argv[i], '\\') != NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int kft_echo_run(int argc, char *const argv[], const char *body,
+                        size_t bodylen, bool body_is_arg, kft_output_t *po) {
+  (void)body;
+  (void)bodylen;
+  (void)body_is_arg;
+  bool newline, escapes;
+  int i = kft_echo_options(argc, argv, &newline, &escapes);
+  for (int first = i; i < argc; i++) {
+    if (i > first) {
+      kft_builtin_write(" ", 1, po);
+    }
+    kft_builtin_puts(argv[i], po);
+  }
+  if (newline) {
+    kft_builtin_write("\n", 1, po);
+  }
+  return EXIT_SUCCESS;
+}
+
+/* --------------------------------------------- *
+ * printf                                        *
+ * --------------------------------------------- */
+
+/**
+ * Write an escape sequence of printf format
+ *
+ * @param pp pointer to the character after the backslash (advanced)
+ * @param po output (NULL to check only)
+ * @return false if the escape is left to the command
+ */
+static bool kft_printf_escape(const char **pp, kft_output_t *po) {
+  const char *p = *pp;
+  char c;
+  if (*p == 'x') {
+    int value = 0;
+    int len = 0;
+    for (p++; len < 2 && isxdigit((unsigned char)*p); len++, p++) {
+      value = value * 16 + (isdigit((unsigned char)*p)
+                                ? *p - '0'
+                                : tolower((unsigned char)*p) - 'a' + 10);
+    }
+    if (len == 0) {
+      return false;
+    }
+    c = (char)value;
+  } else if (isodigit(*p)) {
+    int value = 0;
+    for (int len = 0; len < 3 && isodigit(*p); len++, p++) {
+      value = value * 8 + (*p - '0');
+    }
+    c = (char)value;
+  } else if (*p != '\0' && strchr("\"\\abefnrtv", *p) != NULL) {
+    static const char from[] = "\"\\abefnrtv";
+    static const char to[] = "\"\\\a\b\033\f\n\r\t\v";
+    c = to[strchr(from, *p) - from];
+    p++;
+  } else if (*p == 'c' || *p == 'u' || *p == 'U') {
+    return false;
+  } else {
+    // NOT AN ESCAPE: KEPT AS IS
+    if (po != NULL) {
+      kft_builtin_write("\\", 1, po);
+      if (*p != '\0') {
+        kft_builtin_write(p, 1, po);
+      }
+    }
+    *pp = *p != '\0' ? p + 1 : p;
+    return true;
+  }
+  if (po != NULL) {
+    kft_builtin_write(&c, 1, po);
+  }
+  *pp = p;
+  return true;
+}
+
+/**
+ * Write a conversion of printf format
+ *
+ * @param pp pointer to the character after '%' (advanced)
+ * @param arg argument (NULL when arguments ran out)
+ * @param po output (NULL to check only)
+ * @return false if the conversion is left to the command
+ */
+static bool kft_printf_conversion(const char **pp, const char *arg,
+                                  kft_output_t *po) {
+  const char *p = *pp;
+  // SPEC: % FLAGS WIDTH [. PRECISION] j CONVERSION
+  char spec[4 + 5 + 2 * KFT_BUILTIN_WIDTH_DIGITS + 2];
+  size_t nflags = strspn(p, "-+ #0");
+  size_t nwidth = strspn(p + nflags, "0123456789");
+  const char *q = p + nflags + nwidth;
+  size_t nprec = 0;
+  bool has_prec = *q == '.';
+  if (has_prec) {
+    nprec = strspn(q + 1, "0123456789");
+    q += 1 + nprec;
+  }
+  char conv = *q;
+  if (nflags > 5 || nwidth > KFT_BUILTIN_WIDTH_DIGITS ||
+      nprec > KFT_BUILTIN_WIDTH_DIGITS || conv == '\0') {
+    return false;
+  }
+  const char *ok_flags;
+  switch (conv) {
+  case 'd':
+  case 'i':
+    ok_flags = "-+ 0";
+    break;
+  case 'o':
+  case 'u':
+  case 'x':
+  case 'X':
+    ok_flags = "-#0";
+    break;
+  case 's':
+    ok_flags = "-";
+    break;
+  case 'c':
+    ok_flags = "-";
+    if (has_prec) {
+      return false;
+    }
+    break;
+  default:
+    return false;
+  }
+  if (strspn(p, ok_flags) < nflags) {
+    return false;
+  }
+  intmax_t value = 0;
+  if ((conv == 'd' || conv == 'i') && arg != NULL &&
+      !kft_builtin_parse_int(arg, true, true, &value)) {
+    return false;
+  }
+  if (conv != 'd' && conv != 'i' && conv != 's' && conv != 'c' &&
+      arg != NULL && !kft_builtin_parse_int(arg, false, true, &value)) {
+    return false;
+  }
+  *pp = q + 1;
+  if (po == NULL) {
+    return true;
+  }
+
+  size_t speclen = 1 + (q - p);
+  spec[0] = '%';
+  memcpy(spec + 1, p, q - p);
+  switch (conv) {
+  case 's':
+    spec[speclen++] = 's';
+    spec[speclen] = '\0';
+    kft_builtin_printf(po, spec, arg == NULL ? "" : arg);
+    break;
+  case 'c': {
+    // A NUL CHARACTER IS WRITTEN TOO
+    spec[speclen++] = 'c';
+    spec[speclen] = '\0';
+    int width = snprintf(NULL, 0, spec, 'x');
+    char buf[width + 1];
+    snprintf(buf, width + 1, spec, arg == NULL ? '\0' : arg[0]);
+    kft_builtin_write(buf, width, po);
+  } break;
+  case 'd':
+  case 'i':
+    spec[speclen++] = 'j';
+    spec[speclen++] = conv;
+    spec[speclen] = '\0';
+    kft_builtin_printf(po, spec, value);
+    break;
+  default:
+    spec[speclen++] = 'j';
+    spec[speclen++] = conv;
+    spec[speclen] = '\0';
+    kft_builtin_printf(po, spec, (uintmax_t)value);
+    break;
+  }
+  return true;
+}
+
+/**
+ * Write printf format with arguments
+ *
+ * @param fmt format
+ * @param nargs number of arguments
+ * @param args arguments
+ * @param po output (NULL to check only)
+ * @return false if the format is left to the command
+ */
+static bool kft_printf_format(const char *fmt, int nargs, char *const args[],
+                              kft_output_t *po) {
+  int iarg = 0;
+  int iarg_prev;
+  do {
+    // THE FORMAT IS REUSED UNTIL ALL ARGUMENTS ARE CONSUMED
+    iarg_prev = iarg;
+    const char *p = fmt;
+    while (*p != '\0') {
+      size_t len = strcspn(p, "\\%");
+      if (len > 0 && po != NULL) {
+        kft_builtin_write(p, len, po);
+      }
+      p += len;
+      if (*p == '\\') {
+        p++;
+        if (!kft_printf_escape(&p, po)) {
+          return false;
+        }
+      } else if (*p == '%') {
+        p++;
+        if (*p == '%') {
+          if (po != NULL) {
+            kft_builtin_write("%", 1, po);
+          }
+          p++;
+          continue;
+        }
+        const char *arg = iarg < nargs ? args[iarg++] : NULL;
+        if (!kft_printf_conversion(&p, arg, po)) {
+          return false;
+        }
+      }
+    }
+  } while (iarg < nargs && iarg > iarg_prev);
+  // EXCESS ARGUMENTS ARE WARNED BY THE COMMAND
+  return iarg == nargs;
+}
+
+/**
+ * Get the index of the format of printf
+ *
+ * @param argc number of arguments
+ * @param argv arguments
+ * @return index of the format, or -1 if missing
+ */
+static int kft_printf_fmtidx(int argc, char *const argv[]) {
+  int i = argc > 1 && strcmp(argv[1], "--") == 0 ? 2 : 1;
+  return i < argc ? i : -1;
+}
+
+static bool kft_printf_accepts(int argc, char *const argv[],
+                               bool body_is_arg) {
+  if (body_is_arg) {
+    return false;
+  }
+  if (argc == 2 && (strcmp(argv[1], "--help") == 0 ||
+                    strcmp(argv[1], "--version") == 0)) {
+    return false;
+  }
+  int i = kft_printf_fmtidx(argc, argv);
+  if (i == -1) {
+    return false;
+  }
+  return kft_printf_format(argv[i], argc - i - 1, argv + i + 1, NULL);
+}
+
+static int kft_printf_run(int argc, char *const argv[], const char *body,
+                          size_t bodylen, bool body_is_arg, kft_output_t *po) {
+  (void)body;
+  (void)bodylen;
+  (void)body_is_arg;
+  int i = kft_printf_fmtidx(argc, argv);
+  kft_printf_format(argv[i], argc - i - 1, argv + i + 1, po);
+  return EXIT_SUCCESS;
+}
+
+/* --------------------------------------------- *
+ * cat                                           *
+ * --------------------------------------------- */
+
+static bool kft_cat_accepts(int argc, char *const argv[], bool body_is_arg) {
+  (void)body_is_arg;
+  for (int i = 1; i < argc; i++) {
+    if (kft_builtin_is_option(argv[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Copy a file descriptor to an output
+ *
+ * @param fd file descriptor
+ * @param name name of the file (in messages)
+ * @param po output
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int kft_cat_fd(int fd, const char *name, kft_output_t *po) {
+  char buf[65536];
+  while (1) {
+    ssize_t nread = read(fd, buf, sizeof(buf));
+    if (nread == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+      return EXIT_FAILURE;
+    }
+    if (nread == 0) {
+      return EXIT_SUCCESS;
+    }
+    kft_builtin_write(buf, nread, po);
+  }
+}
+
+static int kft_cat_run(int argc, char *const argv[], const char *body,
+                       size_t bodylen, bool body_is_arg, kft_output_t *po) {
+  int status = EXIT_SUCCESS;
+  bool body_read = false;
+  int nfiles = argc - 1 + (body_is_arg ? 1 : 0);
+  for (int i = 1; i <= (nfiles == 0 ? 1 : nfiles); i++) {
+    const char *name = i < argc ? argv[i] : "-";
+    if (i >= argc && body_is_arg) {
+      // THE BODY IS THE LAST FILE
+      kft_builtin_write(body, bodylen, po);
+      continue;
+    }
+    if (strcmp(name, "-") == 0) {
+      if (body != NULL && !body_is_arg) {
+        // THE BODY IS THE STANDARD INPUT (READ ONLY ONCE)
+        if (!body_read) {
+          kft_builtin_write(body, bodylen, po);
+          body_read = true;
+        }
+      } else if (kft_cat_fd(STDIN_FILENO, "-", po) != EXIT_SUCCESS) {
+        status = EXIT_FAILURE;
+      }
+      continue;
+    }
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+      status = EXIT_FAILURE;
+      continue;
+    }
+    if (kft_cat_fd(fd, name, po) != EXIT_SUCCESS) {
+      status = EXIT_FAILURE;
+    }
+    close(fd);
+  }
+  return status;
+}
+
+/* --------------------------------------------- *
+ * date                                          *
+ * --------------------------------------------- */
+
+/** default format of date (C locale) */
+#define KFT_DATE_FORMAT "%a %b %e %H:%M:%S %Z %Y"
+
+static bool kft_date_accepts(int argc, char *const argv[], bool body_is_arg) {
+  if (body_is_arg || argc > 2 || (argc == 2 && argv[1][0] != '+')) {
+    return false;
+  }
+  // ONLY THE C LOCALE (kft DOES NOT LOAD LOCALES)
+  const char *names[] = {"LC_ALL", "LC_TIME", "LANG"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    const char *locale = kft_vars_get(names[i], NULL);
+    if (locale != NULL && locale[0] != '\0') {
+      if (strcmp(locale, "C") != 0 && strcmp(locale, "POSIX") != 0) {
+        return false;
+      }
+      break;
+    }
+  }
+  // ONLY CONVERSIONS OF strftime (NOT THE EXTENSIONS OF date)
+  for (const char *p = argc == 2 ? argv[1] + 1 : ""; *p != '\0'; p++) {
+    if (*p != '%') {
+      continue;
+    }
+    p++;
+    p += strspn(p, "-_0^");
+    if (*p == '\0' ||
+        strchr("aAbBcCdDeFgGhHIjklmMnpPrRsStTuUVwWxXyYzZ%", *p) == NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int kft_date_run(int argc, char *const argv[], const char *body,
+                        size_t bodylen, bool body_is_arg, kft_output_t *po) {
+  (void)body;
+  (void)bodylen;
+  (void)body_is_arg;
+  const char *fmt = argc == 2 ? argv[1] + 1 : KFT_DATE_FORMAT;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  struct tm tm;
+  // TZ MAY BE CHANGED BY THE TEMPLATE (tzset READS environ)
+  kft_vars_sync();
+  tzset();
+  localtime_r(&ts.tv_sec, &tm);
+
+  // A LEADING SPACE TELLS AN EMPTY RESULT FROM A SHORT BUFFER
+  size_t fmtlen = strlen(fmt);
+  char fmt_[fmtlen + 2];
+  fmt_[0] = ' ';
+  memcpy(fmt_ + 1, fmt, fmtlen + 1);
+  for (size_t bufsize = 256;; bufsize *= 2) {
+    char *buf = malloc(bufsize);
+    if (buf == NULL) {
+      return EXIT_FAILURE;
+    }
+    size_t len = strftime(buf, bufsize, fmt_, &tm);
+    if (len > 0) {
+      kft_builtin_write(buf + 1, len - 1, po);
+      kft_builtin_write("\n", 1, po);
+      free(buf);
+      return EXIT_SUCCESS;
+    }
+    free(buf);
+  }
+}
+
+/* --------------------------------------------- *
+ * basename                                      *
+ * --------------------------------------------- */
+
+static bool kft_basename_accepts(int argc, char *const argv[],
+                                 bool body_is_arg) {
+  if (body_is_arg || argc < 2 || argc > 3) {
+    return false;
+  }
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int kft_basename_run(int argc, char *const argv[], const char *body,
+                            size_t bodylen, bool body_is_arg,
+                            kft_output_t *po) {
+  (void)body;
+  (void)bodylen;
+  (void)body_is_arg;
+  const char *name = argv[1];
+  size_t len = strlen(name);
+  // STRIP TRAILING SLASHES ("/" WHEN ONLY SLASHES)
+  while (len > 1 && name[len - 1] == '/') {
+    len--;
+  }
+  const char *base = name;
+  if (!(len == 1 && name[0] == '/')) {
+    for (size_t i = 0; i < len; i++) {
+      if (name[i] == '/') {
+        base = name + i + 1;
+      }
+    }
+  }
+  size_t baselen = len - (base - name);
+  if (argc == 3) {
+    const char *suffix = argv[2];
+    size_t suffixlen = strlen(suffix);
+    if (suffixlen < baselen &&
+        memcmp(base + baselen - suffixlen, suffix, suffixlen) == 0) {
+      baselen -= suffixlen;
+    }
+  }
+  kft_builtin_write(base, baselen, po);
+  kft_builtin_write("\n", 1, po);
+  return EXIT_SUCCESS;
+}
+
+/* --------------------------------------------- *
+ * seq                                           *
+ * --------------------------------------------- */
+
+/**
+ * Parse arguments of seq
+ *
+ * @param argc number of arguments
+ * @param argv arguments
+ * @param pfirst first number
+ * @param pincr increment
+ * @param plast last number
+ * @return true if all arguments are accepted
+ */
+static bool kft_seq_args(int argc, char *const argv[], intmax_t *pfirst,
+                         intmax_t *pincr, intmax_t *plast) {
+  *pfirst = 1;
+  *pincr = 1;
+  switch (argc) {
+  case 2:
+    return kft_builtin_parse_int(argv[1], true, false, plast);
+  case 3:
+    return kft_builtin_parse_int(argv[1], true, false, pfirst) &&
+           kft_builtin_parse_int(argv[2], true, false, plast);
+  case 4:
+    return kft_builtin_parse_int(argv[1], true, false, pfirst) &&
+           kft_builtin_parse_int(argv[2], true, false, pincr) &&
+           kft_builtin_parse_int(argv[3], true, false, plast) && *pincr != 0;
+  default:
+    return false;
+  }
+}
+
+static bool kft_seq_accepts(int argc, char *const argv[], bool body_is_arg) {
+  intmax_t first, incr, last;
+  return !body_is_arg && kft_seq_args(argc, argv, &first, &incr, &last);
+}
+
+static int kft_seq_run(int argc, char *const argv[], const char *body,
+                       size_t bodylen, bool body_is_arg, kft_output_t *po) {
+  (void)body;
+  (void)bodylen;
+  (void)body_is_arg;
+  intmax_t first, incr, last;
+  kft_seq_args(argc, argv, &first, &incr, &last);
+  for (intmax_t i = first; incr > 0 ? i <= last : i >= last; i += incr) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%jd\n", i);
+    kft_builtin_write(buf, len, po);
+  }
+  return EXIT_SUCCESS;
+}
+
+/* --------------------------------------------- *
+ * Table                                         *
+ * --------------------------------------------- */
+
+/** builtin commands */
+static const kft_builtin_t kft_builtins[] = {
+    {"basename", kft_basename_accepts, kft_basename_run},
+    {"cat", kft_cat_accepts, kft_cat_run},
+    {"date", kft_date_accepts, kft_date_run},
+    {"echo", kft_echo_accepts, kft_echo_run},
+    {"printf", kft_printf_accepts, kft_printf_run},
+    {"seq", kft_seq_accepts, kft_seq_run},
+};
+
+const kft_builtin_t *kft_builtin_find(char *const argv[], bool body_is_arg) {
+  if (argv[0] == NULL || strchr(argv[0], '/') != NULL) {
+    return NULL;
+  }
+  int argc = 0;
+  while (argv[argc] != NULL) {
+    argc++;
+  }
+  for (size_t i = 0; i < sizeof(kft_builtins) / sizeof(kft_builtins[0]); i++) {
+    if (strcmp(argv[0], kft_builtins[i].name) == 0) {
+      const kft_builtin_t *pb = &kft_builtins[i];
+      return pb->accepts(argc, argv, body_is_arg) ? pb : NULL;
+    }
+  }
+  return NULL;
+}
+
+int kft_builtin_run(const kft_builtin_t *pb, char *const argv[],
+                    const char *body, size_t bodylen, bool body_is_arg,
+                    kft_output_t *po) {
+  int argc = 0;
+  while (argv[argc] != NULL) {
+    argc++;
+  }
+  return pb->run(argc, argv, body, bodylen, body_is_arg, po);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "kft.h"
+#include "kft_io_output.h"
+#include <stddef.h>
+
+/**
+ * The builtin command (runs in-process instead of a child).
+ */
+typedef struct kft_builtin kft_builtin_t;
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Test whether builtin commands are enabled
+ *
+ * @return false if $KFT_NO_BUILTINS is set (and not empty or "0")
+ */
+bool kft_builtin_enabled(void) __attribute__((warn_unused_result));
+
+/**
+ * Find the builtin which can run a command
+ *
+ * Only commands named without '/' are run as builtins, and only with
+ * arguments whose output is known to be the same as the external command.
+ * Arguments are checked here, so the command can still be run as a child
+ * when no builtin is found.
+ *
+ * @param argv arguments (argv[0] is the command)
+ * @param body_is_arg the body is added as the last argument (a file)
+ * @return builtin, or NULL to run the command as a child
+ */
+const kft_builtin_t *kft_builtin_find(char *const argv[], bool body_is_arg)
+    __attribute__((nonnull(1), warn_unused_result));
+
+/**
+ * Run a builtin command
+ *
+ * @param pb builtin (found by kft_builtin_find for argv)
+ * @param argv arguments (argv[0] is the command)
+ * @param body block body (NULL when the command reads the standard input of
+ * kft)
+ * @param bodylen length of block body
+ * @param body_is_arg the body is added as the last argument (a file)
+ * @param po output (standard output of the command)
+ * @return exit status of the command
+ */
+int kft_builtin_run(const kft_builtin_t *pb, char *const argv[],
+                    const char *body, size_t bodylen, bool body_is_arg,
+                    kft_output_t *po) __attribute__((nonnull(1, 2, 6)));
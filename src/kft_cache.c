@@ -0,0 +1,440 @@
+#include "kft_cache.h"
+#include "kft_vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** subdirectory of $KFT_CACHE_DIR for command outputs */
+#define KFT_CACHE_EXEC_SUBDIR "exec"
+
+/** magic of command output files (bumped when the format or key changes) */
+#define KFT_CACHE_EXEC_MAGIC "KFT-EXEC-1"
+
+/** subdirectory of $KFT_TEMPLATE_CACHE for compiled templates */
+#define KFT_CACHE_OPS_SUBDIR "ops"
+
+/** magic of compiled template files (bumped when the format or key changes) */
+#define KFT_CACHE_OPS_MAGIC "KFT-OPS-2"
+
+/** magic of template reference files */
+#define KFT_CACHE_OPSREF_MAGIC "KFT-OPSREF-1"
+
+/** byte order mark of compiled template files */
+#define KFT_CACHE_OPS_ORDER 0x01020304
+
+/**
+ * The header of a compiled template file (followed by the operations and the
+ * pool of unescaped text; the file is mapped as is).
+ */
+typedef struct kft_cache_ops_header {
+  /** magic (KFT_CACHE_OPS_MAGIC) */
+  char magic[16];
+  /** byte order mark (KFT_CACHE_OPS_ORDER) */
+  uint32_t order;
+  /** size of an operation */
+  uint32_t opsize;
+  /** number of operations */
+  uint64_t nops;
+  /** length of source */
+  uint64_t srclen;
+  /** length of pool */
+  uint64_t poollen;
+} kft_cache_ops_header_t;
+
+bool kft_cache_enabled(void) {
+  const char *dir = kft_vars_get(KFT_ENVNAME_CACHE_DIR, NULL);
+  return dir != NULL && dir[0] != '\0';
+}
+
+/**
+ * Add the items of a list to a hash
+ *
+ * @param ph hash
+ * @param list colon separated list (NULL if none)
+ * @param add function to add an item
+ */
+static void kft_cache_key_list(kft_hash_t *ph, const char *list,
+                               void (*add)(kft_hash_t *ph, const char *item)) {
+  if (list == NULL) {
+    return;
+  }
+  while (*list != '\0') {
+    size_t len = strcspn(list, ":");
+    if (len > 0) {
+      char item[len + 1];
+      memcpy(item, list, len);
+      item[len] = '\0';
+      add(ph, item);
+    }
+    list += len;
+    if (*list == ':') {
+      list++;
+    }
+  }
+}
+
+static void kft_cache_key_env(kft_hash_t *ph, const char *name) {
+  const char *value = kft_vars_get(name, NULL);
+  kft_hash_field(ph, name, strlen(name));
+  kft_hash_field(ph, value, value == NULL ? 0 : strlen(value));
+}
+
+static void kft_cache_key_file(kft_hash_t *ph, const char *path) {
+  struct stat st;
+  kft_hash_field(ph, path, strlen(path));
+  if (stat(path, &st) == -1) {
+    kft_hash_field(ph, NULL, 0);
+    return;
+  }
+  int64_t stamp[3] = {(int64_t)st.st_mtim.tv_sec, (int64_t)st.st_mtim.tv_nsec,
+                      (int64_t)st.st_size};
+  kft_hash_field(ph, stamp, sizeof(stamp));
+}
+
+void kft_cache_exec_key(const char *file, char *const argv[], int eflags,
+                        const char *body, size_t bodylen, char *key) {
+  kft_hash_t h = kft_hash_init();
+  kft_hash_field(&h, KFT_CACHE_EXEC_MAGIC, strlen(KFT_CACHE_EXEC_MAGIC));
+  kft_hash_field(&h, &eflags, sizeof(eflags));
+  kft_hash_field(&h, file, strlen(file));
+  for (size_t i = 0; argv[i] != NULL; i++) {
+    kft_hash_field(&h, argv[i], strlen(argv[i]));
+  }
+  kft_hash_field(&h, NULL, 0);
+  kft_hash_field(&h, body, bodylen);
+  kft_cache_key_list(&h, kft_vars_get(KFT_ENVNAME_CACHE_ENV, NULL),
+                     kft_cache_key_env);
+  kft_hash_field(&h, NULL, 0);
+  kft_cache_key_list(&h, kft_vars_get(KFT_ENVNAME_CACHE_FILES, NULL),
+                     kft_cache_key_file);
+  kft_hash_hex(&h, key);
+}
+
+/**
+ * Get the path of a cache file
+ *
+ * @param envname name of the variable of the cache directory
+ * @param subdir subdirectory
+ * @param key cache key (NULL for the directory)
+ * @return path (free with free)
+ */
+static char *kft_cache_path(const char *envname, const char *subdir,
+                            const char *key) {
+  const char *dir = kft_vars_get(envname, NULL);
+  char *path;
+  int ret = key == NULL ? asprintf(&path, "%s/%s", dir, subdir)
+                        : asprintf(&path, "%s/%s/%s", dir, subdir, key);
+  return ret == -1 ? NULL : path;
+}
+
+/**
+ * Map a cache file
+ *
+ * @param path path
+ * @param pmapsize size of mapped file
+ * @return mapped file, or NULL if not found (or empty)
+ */
+static void *kft_cache_map(const char *path, size_t *pmapsize) {
+  if (path == NULL) {
+    return NULL;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  size_t mapsize = (size_t)st.st_size;
+  void *map = mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  *pmapsize = mapsize;
+  return map;
+}
+
+int kft_cache_exec_load(const char *key, kft_cache_entry_t *pent) {
+  char *path =
+      kft_cache_path(KFT_ENVNAME_CACHE_DIR, KFT_CACHE_EXEC_SUBDIR, key);
+  size_t mapsize;
+  void *map = kft_cache_map(path, &mapsize);
+  free(path);
+  if (map == NULL) {
+    return KFT_FAILURE;
+  }
+
+  // HEADER: MAGIC STATUS LENGTH
+  const char *header = map;
+  const char *eol = memchr(header, '\n', mapsize);
+  int status;
+  size_t len;
+  int nconv = -1;
+  if (eol != NULL) {
+    char line[eol - header + 1];
+    memcpy(line, header, eol - header);
+    line[eol - header] = '\0';
+    nconv = sscanf(line, KFT_CACHE_EXEC_MAGIC " %d %zu", &status, &len);
+  }
+  if (nconv != 2 || len != mapsize - (size_t)(eol + 1 - header)) {
+    // NOT A CACHE FILE OF THIS VERSION (OR TRUNCATED)
+    munmap(map, mapsize);
+    return KFT_FAILURE;
+  }
+  pent->map = map;
+  pent->mapsize = mapsize;
+  pent->data = eol + 1;
+  pent->len = len;
+  pent->status = status;
+  return KFT_SUCCESS;
+}
+
+void kft_cache_entry_release(kft_cache_entry_t *pent) {
+  munmap(pent->map, pent->mapsize);
+  pent->map = NULL;
+  pent->mapsize = 0;
+  pent->data = NULL;
+  pent->len = 0;
+}
+
+/**
+ * Write all data to a file descriptor
+ *
+ * @param fd file descriptor
+ * @param ptr data
+ * @param len length of data
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_cache_write_all(int fd, const char *ptr, size_t len) {
+  while (len > 0) {
+    ssize_t ret = write(fd, ptr, len);
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return KFT_FAILURE;
+    }
+    ptr += ret;
+    len -= ret;
+  }
+  return KFT_SUCCESS;
+}
+
+/**
+ * Store a cache file (atomically; errors are ignored)
+ *
+ * @param envname name of the variable of the cache directory
+ * @param subdir subdirectory
+ * @param key cache key
+ * @param parts parts of the content
+ * @param lens lengths of the parts
+ * @param nparts number of parts
+ */
+static void kft_cache_store(const char *envname, const char *subdir,
+                            const char *key, const char *const parts[],
+                            const size_t lens[], size_t nparts) {
+  char *dir = kft_cache_path(envname, subdir, NULL);
+  char *path = kft_cache_path(envname, subdir, key);
+  char *tmppath = NULL;
+  if (dir == NULL || path == NULL ||
+      asprintf(&tmppath, "%s/.%s.%ld.tmp", dir, key, (long)getpid()) == -1) {
+    tmppath = NULL;
+    goto done;
+  }
+  mkdir(kft_vars_get(envname, NULL), 0777);
+  mkdir(dir, 0777);
+
+  // WRITE TO A TEMPORARY FILE AND RENAME (READERS NEVER SEE A PARTIAL FILE)
+  int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd == -1) {
+    goto done;
+  }
+  int ret = KFT_SUCCESS;
+  for (size_t i = 0; i < nparts && ret == KFT_SUCCESS; i++) {
+    ret = kft_cache_write_all(fd, parts[i], lens[i]);
+  }
+  if (close(fd) == -1) {
+    ret = KFT_FAILURE;
+  }
+  if (ret != KFT_SUCCESS || rename(tmppath, path) == -1) {
+    unlink(tmppath);
+  }
+
+done:
+  free(tmppath);
+  free(path);
+  free(dir);
+}
+
+void kft_cache_exec_store(const char *key, const char *data, size_t len,
+                          int status) {
+  char header[sizeof(KFT_CACHE_EXEC_MAGIC) + 48];
+  int hlen = snprintf(header, sizeof(header), KFT_CACHE_EXEC_MAGIC " %d %zu\n",
+                      status, len);
+  const char *parts[] = {header, data};
+  size_t lens[] = {(size_t)hlen, len};
+  kft_cache_store(KFT_ENVNAME_CACHE_DIR, KFT_CACHE_EXEC_SUBDIR, key, parts,
+                  lens, 2);
+}
+
+bool kft_cache_ops_enabled(void) {
+  const char *dir = kft_vars_get(KFT_ENVNAME_TEMPLATE_CACHE, NULL);
+  return dir != NULL && dir[0] != '\0';
+}
+
+/**
+ * Add an input specification to a hash
+ *
+ * @param ph hash
+ * @param ispec input specification
+ */
+static void kft_cache_key_ispec(kft_hash_t *ph, kft_ispec_t ispec) {
+  int ch_esc = kft_ispec_get_ch_esc(ispec);
+  const char *delim_st = kft_ispec_get_delim_st(ispec);
+  const char *delim_en = kft_ispec_get_delim_en(ispec);
+  kft_hash_field(ph, &ch_esc, sizeof(ch_esc));
+  kft_hash_field(ph, delim_st, strlen(delim_st));
+  kft_hash_field(ph, delim_en, strlen(delim_en));
+}
+
+/**
+ * Load a compiled template from the cache
+ *
+ * @param key cache key (content)
+ * @param src source
+ * @param srclen length of source
+ * @return compiled template, or NULL on miss
+ */
+static kft_ops_t *kft_cache_ops_load(const char *key, const char *src,
+                                     size_t srclen) {
+  char *path =
+      kft_cache_path(KFT_ENVNAME_TEMPLATE_CACHE, KFT_CACHE_OPS_SUBDIR, key);
+  size_t mapsize;
+  void *map = kft_cache_map(path, &mapsize);
+  free(path);
+  if (map == NULL) {
+    return NULL;
+  }
+  const kft_cache_ops_header_t *ph = map;
+  const size_t hsize = sizeof(kft_cache_ops_header_t);
+  if (mapsize < hsize ||
+      memcmp(ph->magic, KFT_CACHE_OPS_MAGIC, sizeof(KFT_CACHE_OPS_MAGIC)) !=
+          0 ||
+      ph->order != KFT_CACHE_OPS_ORDER || ph->opsize != sizeof(kft_op_t) ||
+      ph->srclen != srclen || ph->nops > (mapsize - hsize) / sizeof(kft_op_t) ||
+      ph->poollen != mapsize - hsize - ph->nops * sizeof(kft_op_t)) {
+    // NOT A CACHE FILE OF THIS VERSION (OR TRUNCATED)
+    munmap(map, mapsize);
+    return NULL;
+  }
+  const kft_op_t *ops = (const kft_op_t *)((const char *)map + hsize);
+  const char *pool = (const char *)(ops + ph->nops);
+  kft_ops_t *pops = kft_ops_new(ops, ph->nops, src, srclen, pool, ph->poollen);
+  if (pops == NULL) {
+    munmap(map, mapsize);
+  }
+  // THE MAPPING IS KEPT FOR THE WHOLE RUN (AS THE TEMPLATE)
+  return pops;
+}
+
+/**
+ * Store a compiled template to the cache (atomically; errors are ignored)
+ *
+ * @param key cache key (content)
+ * @param pops compiled template
+ */
+static void kft_cache_ops_store(const char *key, const kft_ops_t *pops) {
+  kft_cache_ops_header_t header = {
+      .magic = KFT_CACHE_OPS_MAGIC,
+      .order = KFT_CACHE_OPS_ORDER,
+      .opsize = sizeof(kft_op_t),
+      .nops = kft_ops_get_count(pops),
+      .srclen = kft_ops_get_srclen(pops),
+      .poollen = kft_ops_get_poollen(pops),
+  };
+  const char *parts[] = {(const char *)&header,
+                         (const char *)kft_ops_get_ops(pops),
+                         kft_ops_get_pool(pops)};
+  size_t lens[] = {sizeof(header), header.nops * sizeof(kft_op_t),
+                   header.poollen};
+  kft_cache_store(KFT_ENVNAME_TEMPLATE_CACHE, KFT_CACHE_OPS_SUBDIR, key, parts,
+                  lens, header.poollen > 0 ? 3 : 2);
+}
+
+kft_ops_t *kft_cache_ops_open(const struct stat *pst, kft_ispec_t ispec,
+                              const char *src) {
+  size_t srclen = (size_t)pst->st_size;
+
+  // REFERENCE: FILE IDENTITY -> CONTENT KEY (VALIDATED BY SIZE AND MTIME)
+  char refkey[KFT_HASH_HEXLEN + sizeof(".ref")];
+  kft_hash_t h = kft_hash_init();
+  kft_hash_field(&h, KFT_CACHE_OPSREF_MAGIC, strlen(KFT_CACHE_OPSREF_MAGIC));
+  int64_t ident[2] = {(int64_t)pst->st_dev, (int64_t)pst->st_ino};
+  kft_hash_field(&h, ident, sizeof(ident));
+  kft_cache_key_ispec(&h, ispec);
+  kft_hash_hex(&h, refkey);
+  strcat(refkey, ".ref");
+
+  char *path =
+      kft_cache_path(KFT_ENVNAME_TEMPLATE_CACHE, KFT_CACHE_OPS_SUBDIR, refkey);
+  size_t mapsize;
+  const char *ref = kft_cache_map(path, &mapsize);
+  free(path);
+  if (ref != NULL) {
+    char line[sizeof(KFT_CACHE_OPSREF_MAGIC) + KFT_HASH_HEXLEN + 80];
+    size_t len = mapsize < sizeof(line) - 1 ? mapsize : sizeof(line) - 1;
+    memcpy(line, ref, len);
+    line[len] = '\0';
+    munmap((void *)ref, mapsize);
+    long long size, sec, nsec;
+    char refval[KFT_HASH_HEXLEN + 1];
+    if (sscanf(line, KFT_CACHE_OPSREF_MAGIC " %lld %lld %lld %32[0-9a-f]",
+               &size, &sec, &nsec, refval) == 4 &&
+        size == (long long)pst->st_size &&
+        sec == (long long)pst->st_mtim.tv_sec &&
+        nsec == (long long)pst->st_mtim.tv_nsec &&
+        strlen(refval) == KFT_HASH_HEXLEN) {
+      kft_ops_t *pops = kft_cache_ops_load(refval, src, srclen);
+      if (pops != NULL) {
+        // HIT: NO SCANNING AT ALL
+        return pops;
+      }
+    }
+  }
+
+  // CONTENT KEY: THE SAME TEMPLATE IN ANOTHER FILE SHARES THE ENTRY
+  char key[KFT_HASH_HEXLEN + 1];
+  h = kft_hash_init();
+  kft_hash_field(&h, KFT_CACHE_OPS_MAGIC, strlen(KFT_CACHE_OPS_MAGIC));
+  kft_cache_key_ispec(&h, ispec);
+  kft_hash_field(&h, src, srclen);
+  kft_hash_hex(&h, key);
+  kft_ops_t *pops = kft_cache_ops_load(key, src, srclen);
+  if (pops == NULL) {
+    pops = kft_ops_compile(src, srclen, ispec);
+    if (pops == NULL) {
+      return NULL;
+    }
+    kft_cache_ops_store(key, pops);
+  }
+
+  char refline[sizeof(KFT_CACHE_OPSREF_MAGIC) + KFT_HASH_HEXLEN + 80];
+  int reflen = snprintf(refline, sizeof(refline),
+                        KFT_CACHE_OPSREF_MAGIC " %lld %lld %lld %s\n",
+                        (long long)pst->st_size,
+                        (long long)pst->st_mtim.tv_sec,
+                        (long long)pst->st_mtim.tv_nsec, key);
+  const char *parts[] = {refline};
+  size_t lens[] = {(size_t)reflen};
+  kft_cache_store(KFT_ENVNAME_TEMPLATE_CACHE, KFT_CACHE_OPS_SUBDIR, refkey,
+                  parts, lens, 1);
+  return pops;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "kft.h"
+#include "kft_hash.h"
+#include "kft_io_ispec.h"
+#include "kft_ops.h"
+#include <stddef.h>
+#include <sys/stat.h>
+
+/**
+ * The command output loaded from the cache.
+ */
+typedef struct kft_cache_entry kft_cache_entry_t;
+
+/**
+ * The command output loaded from the cache.
+ */
+struct kft_cache_entry {
+  /** mapped cache file */
+  void *map;
+  /** size of mapped cache file */
+  size_t mapsize;
+  /** standard output of the command */
+  const char *data;
+  /** length of standard output */
+  size_t len;
+  /** exit status of the command */
+  int status;
+};
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Test whether the command output cache is enabled
+ *
+ * @return true if $KFT_CACHE_DIR is set (and not empty)
+ */
+bool kft_cache_enabled(void) __attribute__((warn_unused_result));
+
+/**
+ * Compute the cache key of a command
+ *
+ * The key covers the command, its arguments, its standard input (the block
+ * body), the values of the variables listed in $KFT_CACHE_ENV and the mtimes
+ * of the files listed in $KFT_CACHE_FILES.
+ *
+ * @param file command
+ * @param argv arguments
+ * @param eflags how the body is passed to the command
+ * @param body block body (NULL if none)
+ * @param bodylen length of block body
+ * @param key buffer for the key (KFT_HASH_HEXLEN + 1 bytes)
+ */
+void kft_cache_exec_key(const char *file, char *const argv[], int eflags,
+                        const char *body, size_t bodylen, char *key)
+    __attribute__((nonnull(1, 2, 6)));
+
+/**
+ * Load a command output from the cache
+ *
+ * @param key cache key
+ * @param pent loaded output (release with kft_cache_entry_release)
+ * @return KFT_SUCCESS on hit, or KFT_FAILURE on miss
+ */
+int kft_cache_exec_load(const char *key, kft_cache_entry_t *pent)
+    __attribute__((nonnull(1, 2), warn_unused_result));
+
+/**
+ * Release a command output loaded from the cache
+ *
+ * @param pent loaded output
+ */
+void kft_cache_entry_release(kft_cache_entry_t *pent)
+    __attribute__((nonnull(1)));
+
+/**
+ * Store a command output to the cache (atomically; errors are ignored)
+ *
+ * @param key cache key
+ * @param data standard output of the command
+ * @param len length of standard output
+ * @param status exit status of the command
+ */
+void kft_cache_exec_store(const char *key, const char *data, size_t len,
+                          int status) __attribute__((nonnull(1)));
+
+/**
+ * Test whether the compiled template cache is enabled
+ *
+ * @return true if $KFT_TEMPLATE_CACHE is set (and not empty)
+ */
+bool kft_cache_ops_enabled(void) __attribute__((warn_unused_result));
+
+/**
+ * Get the compiled template of a file from the cache (compiled and stored on
+ * miss)
+ *
+ * A reference keyed by the file identity and the input specification gives
+ * the content key while the size and the mtime of the file are unchanged, so
+ * a hit maps the compiled template without reading the source. Otherwise the
+ * content key is computed from the source and the input specification.
+ *
+ * @param pst status of the file
+ * @param ispec input specification
+ * @param src source (mapped for the whole run)
+ * @return compiled template, or NULL if the template can not be compiled
+ */
+kft_ops_t *kft_cache_ops_open(const struct stat *pst, kft_ispec_t ispec,
+                              const char *src)
+    __attribute__((nonnull(1, 3), warn_unused_result));
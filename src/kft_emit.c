@@ -0,0 +1,411 @@
+#include "kft_emit.h"
+#include "kft_malloc.h"
+#include "kft_ops.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** maximum columns of a line of a string literal */
+#define KFT_EMIT_COLS 72
+
+/** initial number of labels */
+#define KFT_EMIT_NLABELS 64
+
+/** maximum number of blocks in a part of the renderer */
+#define KFT_EMIT_PART_BLOCKS 128
+
+/**
+ * The state of the translator.
+ */
+typedef struct kft_emit {
+  /** output */
+  FILE *fp;
+  /** compiled template */
+  const kft_ops_t *pops;
+  /** pending plain text */
+  char *text;
+  /** length of pending plain text */
+  size_t text_len;
+  /** labels of the current part (source offsets, ascending) */
+  size_t *labels;
+  /** number of labels */
+  size_t nlabels;
+  /** size of labels */
+  size_t nlabels_max;
+  /** parts (source offsets, ascending) */
+  size_t *parts;
+  /** number of parts */
+  size_t nparts;
+  /** size of parts */
+  size_t nparts_max;
+  /** number of blocks in the current part */
+  size_t nblocks;
+  /** the template has blocks run by the runtime (labels are used) */
+  bool has_blocks;
+} kft_emit_t;
+
+/**
+ * Write a string literal
+ *
+ * @param fp output
+ * @param str string
+ * @param len length of string
+ * @param indent indent of continued lines
+ */
+static void kft_emit_string(FILE *fp, const char *str, size_t len,
+                            int indent) {
+  fputc('"', fp);
+  int cols = 0;
+  for (size_t i = 0; i < len; i++) {
+    int ch = (unsigned char)str[i];
+    if (ch == '\n') {
+      cols += fputs("\\n", fp);
+    } else if (ch == '"' || ch == '\\' || ch == '?') {
+      // '?' NEVER STARTS A TRIGRAPH
+      cols += fprintf(fp, "\\%c", ch);
+    } else if (ch < ' ' || ch >= 0x7f) {
+      // ALWAYS 3 DIGITS (A DIGIT AFTER IT IS NOT PART OF THE ESCAPE)
+      cols += fprintf(fp, "\\%03o", ch);
+    } else {
+      fputc(ch, fp);
+      cols++;
+    }
+    if (i + 1 < len && (ch == '\n' || cols >= KFT_EMIT_COLS)) {
+      fprintf(fp, "\"\n%*s\"", indent, "");
+      cols = 0;
+    }
+  }
+  fputc('"', fp);
+}
+
+/**
+ * Emit the pending plain text
+ *
+ * @param pe translator
+ */
+static void kft_emit_flush(kft_emit_t *pe) {
+  if (pe->text_len == 0) {
+    return;
+  }
+  fputs("  if (kft_rt_text(prt, ", pe->fp);
+  kft_emit_string(pe->fp, pe->text, pe->text_len, 20);
+  fprintf(pe->fp, ", %zu) != KFT_SUCCESS) {\n", pe->text_len);
+  fputs("    return KFT_FAILURE;\n  }\n", pe->fp);
+  pe->text_len = 0;
+}
+
+/**
+ * Append a source offset
+ *
+ * @param pv offsets
+ * @param pn number of offsets
+ * @param pn_max size of offsets
+ * @param srcoff source offset
+ */
+static void kft_emit_append(size_t **pv, size_t *pn, size_t *pn_max,
+                            size_t srcoff) {
+  if (*pn == *pn_max) {
+    *pn_max *= 2;
+    *pv = (size_t *)kft_realloc(*pv, *pn_max * sizeof(size_t));
+  }
+  (*pv)[(*pn)++] = srcoff;
+}
+
+/**
+ * Emit a label (a source offset the interpreter may continue at: the start
+ * of a part, around a tag block or after an end delimiter at the top level;
+ * any other offset is left to the interpreter)
+ *
+ * @param pe translator
+ * @param srcoff source offset
+ */
+static void kft_emit_label(kft_emit_t *pe, size_t srcoff) {
+  kft_emit_flush(pe);
+  if (!pe->has_blocks ||
+      (pe->nlabels > 0 && pe->labels[pe->nlabels - 1] == srcoff)) {
+    return;
+  }
+  kft_emit_append(&pe->labels, &pe->nlabels, &pe->nlabels_max, srcoff);
+  fprintf(pe->fp, "L%zu:\n", srcoff);
+}
+
+/**
+ * Emit the data of the compiled template
+ *
+ * @param pe translator
+ */
+static void kft_emit_data(kft_emit_t *pe) {
+  FILE *fp = pe->fp;
+  const kft_ops_t *pops = pe->pops;
+  fputs("static const char kft_template_src[] =\n    ", fp);
+  kft_emit_string(fp, kft_ops_get_src(pops), kft_ops_get_srclen(pops), 4);
+  fputs(";\n\nstatic const char kft_template_pool[] =\n    ", fp);
+  kft_emit_string(fp, kft_ops_get_pool(pops), kft_ops_get_poollen(pops), 4);
+  fputs(";\n\nstatic const kft_op_t kft_template_ops[] = {\n", fp);
+  const kft_op_t *ops = kft_ops_get_ops(pops);
+  size_t nops = kft_ops_get_count(pops);
+  static const char *const kinds[] = {"KFT_OP_TEXT", "KFT_OP_EOL",
+                                      "KFT_OP_BEGIN", "KFT_OP_END"};
+  for (size_t i = 0; i < nops; i++) {
+    fprintf(fp, "    {%s, ", kinds[ops[i].kind]);
+    // DIRECTIVES ARE PLAIN CHARACTERS
+    fprintf(fp, ops[i].directive != 0 ? "'%c'" : "%d", ops[i].directive);
+    fprintf(fp, ", %zu, %zu, %zu, %zu, %zu},\n", ops[i].stroff, ops[i].len,
+            ops[i].srcoff, ops[i].row, ops[i].col);
+  }
+  if (nops == 0) {
+    // NO EMPTY INITIALIZER IN C
+    fputs("    {KFT_OP_TEXT, 0, 0, 0, 0, 0, 0},\n", fp);
+  }
+  fputs("};\n\n", fp);
+}
+
+/**
+ * Find the end delimiter of a block
+ *
+ * @param ops operations
+ * @param nops number of operations
+ * @param i index of the start delimiter
+ * @return index of the matching end delimiter (nops if not found)
+ */
+static size_t kft_emit_match(const kft_op_t *ops, size_t nops, size_t i) {
+  int depth = 0;
+  for (; i < nops; i++) {
+    depth += ops[i].kind == KFT_OP_BEGIN ? 1 : 0;
+    depth -= ops[i].kind == KFT_OP_END ? 1 : 0;
+    if (depth == 0) {
+      break;
+    }
+  }
+  return i;
+}
+
+/**
+ * Start a part of the renderer
+ *
+ * @param pe translator
+ * @param srcoff source offset the part starts at
+ * @param has_text the template has plain text
+ */
+static void kft_emit_part_begin(kft_emit_t *pe, size_t srcoff,
+                                bool has_text) {
+  FILE *fp = pe->fp;
+  fprintf(fp,
+          "static int kft_template_render%zu(kft_rt_t *prt, size_t srcoff) "
+          "{\n",
+          pe->nparts);
+  kft_emit_append(&pe->parts, &pe->nparts, &pe->nparts_max, srcoff);
+  pe->nlabels = 0;
+  pe->nblocks = 0;
+  if (pe->has_blocks) {
+    // ENTERED AT A LABEL
+    fputs("  int ret;\n  goto resume;\n", fp);
+    kft_emit_label(pe, srcoff);
+    return;
+  }
+  fputs("  (void)srcoff;\n", fp);
+  if (!has_text) {
+    fputs("  (void)prt;\n", fp);
+  }
+}
+
+/**
+ * End a part of the renderer
+ *
+ * @param pe translator
+ * @param ret return value at the end of the part
+ */
+static void kft_emit_part_end(kft_emit_t *pe, const char *ret) {
+  FILE *fp = pe->fp;
+  kft_emit_flush(pe);
+  fprintf(fp, "  return %s;\n", ret);
+  if (pe->has_blocks) {
+    // A TAG, A GOTO OR A REDIRECTION CONTINUES AT ANOTHER LABEL
+    fputs("\nresume:\n  switch (srcoff) {\n", fp);
+    for (size_t k = 0; k < pe->nlabels; k++) {
+      fprintf(fp, "  case %zu:\n    goto L%zu;\n", pe->labels[k],
+              pe->labels[k]);
+    }
+    fputs("  default:\n    return kft_rt_rest(prt, srcoff);\n  }\n", fp);
+  }
+  fputs("}\n\n", fp);
+}
+
+/**
+ * Emit the renderer
+ *
+ * @param pe translator
+ * @param ispec input specification
+ */
+static void kft_emit_render(kft_emit_t *pe, kft_ispec_t ispec) {
+  FILE *fp = pe->fp;
+  const kft_ops_t *pops = pe->pops;
+  const kft_op_t *ops = kft_ops_get_ops(pops);
+  size_t nops = kft_ops_get_count(pops);
+  size_t srclen = kft_ops_get_srclen(pops);
+  size_t delim_en_len = kft_ispec_get_match_en(&ispec)->len;
+
+  // COMMENTS ARE DROPPED
+  bool has_text = false;
+  for (size_t i = 0; i < nops && !pe->has_blocks; i++) {
+    if (ops[i].kind == KFT_OP_BEGIN) {
+      pe->has_blocks = ops[i].directive != '-';
+      i = kft_emit_match(ops, nops, i);
+    } else if (ops[i].kind != KFT_OP_END) {
+      has_text = true;
+    }
+  }
+
+  kft_emit_part_begin(pe, 0, has_text);
+  size_t i = 0;
+  while (i < nops) {
+    const kft_op_t *pop = &ops[i];
+    switch (pop->kind) {
+    case KFT_OP_TEXT:
+      memcpy(pe->text + pe->text_len, kft_ops_get_text(pops, pop), pop->len);
+      pe->text_len += pop->len;
+      i++;
+      continue;
+
+    case KFT_OP_EOL:
+      pe->text[pe->text_len++] = '\n';
+      i++;
+      continue;
+
+    case KFT_OP_END:
+      // THE END DELIMITER AT THE TOP LEVEL ENDS THE TEMPLATE
+      kft_emit_flush(pe);
+      fputs("  return KFT_SUCCESS;\n", fp);
+      kft_emit_label(pe, pop->srcoff + delim_en_len);
+      i++;
+      continue;
+    }
+
+    // BLOCK: UP TO THE MATCHING END DELIMITER
+    size_t j = kft_emit_match(ops, nops, i);
+    size_t end = j < nops ? ops[j].srcoff + delim_en_len : srclen;
+    if (pop->directive != '-' && pe->nblocks == KFT_EMIT_PART_BLOCKS) {
+      kft_emit_part_end(pe, "KFT_RT_NEXT");
+      kft_emit_part_begin(pe, pop->srcoff, has_text);
+    }
+    if (pop->directive == ':') {
+      kft_emit_label(pe, pop->srcoff);
+    } else if (pop->directive != '-') {
+      // TEXT AROUND A COMMENT IS WRITTEN AT ONCE
+      kft_emit_flush(pe);
+    }
+    if (pop->directive != '-') {
+      fprintf(fp, "  ret = kft_rt_block(prt, %zu, %zu);\n", pop->srcoff, end);
+      fputs("  if (ret != KFT_SUCCESS) {\n    return ret;\n  }\n", fp);
+      pe->nblocks++;
+    }
+    if (pop->directive == ':') {
+      kft_emit_label(pe, end);
+    }
+    i = j + 1;
+  }
+  kft_emit_label(pe, srclen);
+  kft_emit_part_end(pe, "KFT_SUCCESS");
+}
+
+/**
+ * Emit the template
+ *
+ * @param pe translator
+ * @param filename template filename
+ * @param ispec input specification
+ */
+static void kft_emit_template(kft_emit_t *pe, const char *filename,
+                              kft_ispec_t ispec) {
+  FILE *fp = pe->fp;
+  fputs("static const kft_rt_part_t kft_template_parts[] = {\n", fp);
+  for (size_t k = 0; k < pe->nparts; k++) {
+    fprintf(fp, "    {%zu, kft_template_render%zu},\n", pe->parts[k], k);
+  }
+  fputs("};\n\n", fp);
+
+  fputs("static const kft_rt_template_t kft_template = {\n", fp);
+  fputs("    .filename = ", fp);
+  kft_emit_string(fp, filename, strlen(filename), 4);
+  fprintf(fp, ",\n    .ch_esc = %d,\n", kft_ispec_get_ch_esc(ispec));
+  const char *delim_st = kft_ispec_get_delim_st(ispec);
+  const char *delim_en = kft_ispec_get_delim_en(ispec);
+  fputs("    .delim_st = ", fp);
+  kft_emit_string(fp, delim_st, strlen(delim_st), 4);
+  fputs(",\n    .delim_en = ", fp);
+  kft_emit_string(fp, delim_en, strlen(delim_en), 4);
+  fputs(",\n    .src = kft_template_src,\n"
+        "    .srclen = sizeof(kft_template_src) - 1,\n"
+        "    .pool = kft_template_pool,\n"
+        "    .poollen = sizeof(kft_template_pool) - 1,\n"
+        "    .ops = kft_template_ops,\n",
+        fp);
+  fprintf(fp, "    .nops = %zu,\n", kft_ops_get_count(pe->pops));
+  fprintf(fp, "    .parts = kft_template_parts,\n    .nparts = %zu,\n};\n\n",
+          pe->nparts);
+}
+
+int kft_emit_c(const char *filename, kft_ispec_t ispec, FILE *fp) {
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    perror(filename);
+    return KFT_FAILURE;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    perror(filename);
+    close(fd);
+    return KFT_FAILURE;
+  }
+  size_t len = (size_t)st.st_size;
+  void *map = len == 0 ? NULL : mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror(filename);
+    return KFT_FAILURE;
+  }
+  kft_ops_t *pops = kft_ops_compile(map == NULL ? "" : map, len, ispec);
+  if (pops == NULL) {
+    fprintf(stderr, "%s: a delimiter or the escape character is a directive "
+                    "character (not translated)\n",
+            filename);
+    if (map != NULL) {
+      munmap(map, len);
+    }
+    return KFT_FAILURE;
+  }
+
+  kft_emit_t e = {
+      .fp = fp,
+      .pops = pops,
+      // PLAIN TEXT IS NEVER LONGER THAN THE SOURCE
+      .text = (char *)kft_malloc_atomic(len + 1),
+      .text_len = 0,
+      .labels = (size_t *)kft_malloc(KFT_EMIT_NLABELS * sizeof(size_t)),
+      .nlabels = 0,
+      .nlabels_max = KFT_EMIT_NLABELS,
+      .parts = (size_t *)kft_malloc(KFT_EMIT_NLABELS * sizeof(size_t)),
+      .nparts = 0,
+      .nparts_max = KFT_EMIT_NLABELS,
+      .nblocks = 0,
+      .has_blocks = false,
+  };
+  fputs("/* Generated by kft --emit-c (do not edit) */\n\n"
+        "#include \"kft_rt.h\"\n\n",
+        fp);
+  kft_emit_data(&e);
+  kft_emit_render(&e, ispec);
+  kft_emit_template(&e, filename, ispec);
+  fputs("int main(int argc, char *argv[]) {\n"
+        "  return kft_main(argc, argv, &kft_template);\n}\n",
+        fp);
+  kft_free(e.text);
+  kft_free(e.labels);
+  kft_free(e.parts);
+  if (map != NULL) {
+    munmap(map, len);
+  }
+  return ferror(fp) ? KFT_FAILURE : KFT_SUCCESS;
+}
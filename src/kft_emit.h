@@ -0,0 +1,24 @@
+#pragma once
+
+#include "kft.h"
+#include "kft_io_ispec.h"
+#include <stdio.h>
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Translate a template into C
+ *
+ * The translation unit writes plain text directly and runs each block by the
+ * runtime (kft_rt.h); its main() takes the same options as kft. It is built
+ * with the headers of kft and linked with libkft.a.
+ *
+ * @param filename template filename
+ * @param ispec input specification
+ * @param fp output
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+int kft_emit_c(const char *filename, kft_ispec_t ispec, FILE *fp)
+    __attribute__((nonnull(1, 3), warn_unused_result));
@@ -0,0 +1,58 @@
+#include "kft_hash.h"
+#include <stdint.h>
+
+/** FNV-1a offset basis (128 bits) */
+#define KFT_HASH_OFFSET                                                        \
+  (((unsigned __int128)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL)
+
+/** FNV-1a prime (128 bits): 2^88 + 0x13b */
+#define KFT_HASH_PRIME (((unsigned __int128)1 << 88) | 0x13b)
+
+/** FNV-1a offset basis (64 bits) */
+#define KFT_HASH_KEY_OFFSET 0xcbf29ce484222325ULL
+
+/** FNV-1a prime (64 bits) */
+#define KFT_HASH_KEY_PRIME 0x100000001b3ULL
+
+kft_hash_t kft_hash_init(void) {
+  return (kft_hash_t){.value = KFT_HASH_OFFSET};
+}
+
+void kft_hash_update(kft_hash_t *ph, const void *ptr, size_t len) {
+  const unsigned char *p = ptr;
+  unsigned __int128 value = ph->value;
+  for (size_t i = 0; i < len; i++) {
+    value ^= p[i];
+    value *= KFT_HASH_PRIME;
+  }
+  ph->value = value;
+}
+
+void kft_hash_field(kft_hash_t *ph, const void *ptr, size_t len) {
+  // ABSENT FIELD IS NOT THE SAME AS EMPTY FIELD
+  uint64_t prefix = ptr == NULL ? UINT64_MAX : (uint64_t)len;
+  kft_hash_update(ph, &prefix, sizeof(prefix));
+  if (ptr != NULL) {
+    kft_hash_update(ph, ptr, len);
+  }
+}
+
+void kft_hash_hex(const kft_hash_t *ph, char *buf) {
+  static const char digits[] = "0123456789abcdef";
+  unsigned __int128 value = ph->value;
+  for (int i = KFT_HASH_HEXLEN - 1; i >= 0; i--) {
+    buf[i] = digits[(unsigned int)(value & 0xf)];
+    value >>= 4;
+  }
+  buf[KFT_HASH_HEXLEN] = '\0';
+}
+
+uint64_t kft_hash_key(const void *ptr, size_t len) {
+  const unsigned char *p = ptr;
+  uint64_t hash = KFT_HASH_KEY_OFFSET;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= KFT_HASH_KEY_PRIME;
+  }
+  return hash;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "kft.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/** length of a hash as hexadecimal digits */
+#define KFT_HASH_HEXLEN 32
+
+/**
+ * The state of a content hash (FNV-1a, 128 bits).
+ */
+typedef struct kft_hash kft_hash_t;
+
+/**
+ * The state of a content hash (FNV-1a, 128 bits).
+ */
+struct kft_hash {
+  /** hash value */
+  unsigned __int128 value;
+};
+
+/* --------------------------------------------- *
+ * Constructors and Destructors                  *
+ * --------------------------------------------- */
+
+/**
+ * Initialize a hash
+ *
+ * @return hash of empty data
+ */
+kft_hash_t kft_hash_init(void) __attribute__((warn_unused_result, const));
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Add data to a hash
+ *
+ * @param ph hash
+ * @param ptr data
+ * @param len length of data
+ */
+void kft_hash_update(kft_hash_t *ph, const void *ptr, size_t len)
+    __attribute__((nonnull(1)));
+
+/**
+ * Add a length-prefixed field to a hash (fields never run together)
+ *
+ * @param ph hash
+ * @param ptr data (NULL for an absent field)
+ * @param len length of data
+ */
+void kft_hash_field(kft_hash_t *ph, const void *ptr, size_t len)
+    __attribute__((nonnull(1)));
+
+/**
+ * Format a hash as hexadecimal digits
+ *
+ * @param ph hash
+ * @param buf buffer (KFT_HASH_HEXLEN + 1 bytes)
+ */
+void kft_hash_hex(const kft_hash_t *ph, char *buf) __attribute__((nonnull));
+
+/**
+ * Hash a key for a hash table (FNV-1a, 64 bits)
+ *
+ * @param ptr key
+ * @param len length of key
+ * @return hash
+ */
+uint64_t kft_hash_key(const void *ptr, size_t len)
+    __attribute__((warn_unused_result, pure));
@@ -3,13 +3,30 @@
 #include "kft_io.h"
 #include "kft_io_ispec.h"
 #include "kft_io_itags.h"
+#include "kft_io_scan.h"
 #include "kft_malloc.h"
+#include "kft_misc.h"
+#include "kft_ops.h"
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define KFT_INPUT_MODE_STREAM_OPENED 1
 #define KFT_INPUT_MODE_MALLOC_FILENAME 2
+#define KFT_INPUT_MODE_MMAPPED 4
+#define KFT_INPUT_MODE_MEMORY 8
+#define KFT_INPUT_MODE_FD_OPENED 16
+
+/** initial (and shrunk) size of the ring buffer */
+#define KFT_INPUT_BUFSIZE 65536
+
+/** smallest initial size of the ring buffer (with a smaller limit) */
+#define KFT_INPUT_BUFSIZE_MIN 16
 
 /**
  * The input information.
@@ -19,50 +36,152 @@ struct kft_input {
   int mode;
   /** input stream */
   FILE *fp;
+  /** input file descriptor (-1 when the stream has no descriptor) */
+  int fd;
+  /** end of stream reached */
+  bool eof;
   /** filename */
   const char *filename;
-  /** position */
+  /** position (at bufpos_ipos) */
   kft_ipos_t ipos;
-  /** buffer */
+  /** buffer position where ipos is up to date */
+  size_t bufpos_ipos;
+  /** buffer (ring buffer, or the whole content when mapped) */
   char *buf;
-  /** buffer size */
+  /** buffer size (power of 2 for ring buffer) */
   size_t bufsize;
-  /** buffer position (committed) */
+  /** mask to get a buffer index from a stream position */
+  size_t bufmask;
+  /** maximum buffer size */
+  size_t bufsize_max;
+  /** stream position (oldest still in buffer) */
+  size_t bufpos_retained;
+  /** stream position (committed) */
   size_t bufpos_committed;
-  /** buffer position (fetched) */
+  /** stream position (fetched) */
   size_t bufpos_fetched;
-  /** buffer position (prefetched) */
+  /** stream position (prefetched) */
   size_t bufpos_prefetched;
+  /** stream offset of position 0 (from the first read when not seekable) */
+  long bufoff;
+  /** the stream can be repositioned */
+  bool seekable;
+  /** stream position kept in buffer for a later seek (SIZE_MAX when none) */
+  size_t bufpos_pinned;
   /** chars count for extra escape */
   int esclen;
   /** input specification */
   kft_ispec_t ispec;
   /** tags */
   kft_itags_t *ptags;
+  /** compiled template (NULL while interpreted) */
+  const kft_ops_t *pops;
+  /** current operation of compiled template */
+  size_t op;
+  /** offset in current operation */
+  size_t opoff;
 };
 
+/**
+ * Get the current offset of the stream
+ *
+ * @param fd file descriptor (-1 when the stream has no descriptor)
+ * @param fp input stream
+ * @return current offset or -1 when the stream is not seekable
+ */
+static long kft_stream_tell(int fd, FILE *fp) {
+  if (fd >= 0) {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    return offset == (off_t)-1 ? -1 : (long)offset;
+  }
+  return ftell(fp);
+}
+
+/**
+ * Initialize the stream offset of position 0
+ *
+ * @param pi input (not yet read)
+ */
+static void kft_input_init_bufoff(kft_input_t *pi) {
+  long offset = kft_stream_tell(pi->fd, pi->fp);
+  pi->seekable = offset != -1;
+  pi->bufoff = offset != -1 ? offset : 0;
+  pi->bufpos_pinned = SIZE_MAX;
+}
+
 kft_input_t *kft_input_new_mem(const char *buf, size_t bufsize,
                                kft_ispec_t ispec) {
-  FILE *fp = fmemopen((void *)buf, bufsize, "r");
-  if (fp == NULL) {
-    kft_error("%s: %m\n", "fmemopen");
-  }
+  // THE CALLER'S BUFFER IS THE WHOLE PREFETCH BUFFER (NO COPY)
   kft_input_t *pi = (kft_input_t *)kft_malloc(sizeof(kft_input_t));
-  pi->mode = KFT_INPUT_MODE_STREAM_OPENED;
-  pi->fp = fp;
+  pi->mode = KFT_INPUT_MODE_MEMORY;
+  pi->fp = NULL;
   pi->filename = "<inline>";
-  pi->ipos = kft_ipos_init(fp, 0, 0);
-  pi->buf = NULL;
-  pi->bufsize = 0;
+  pi->ipos = kft_ipos_init(pi, 0, 0);
+  pi->bufpos_ipos = 0;
+  pi->fd = -1;
+  pi->eof = true;
+  pi->buf = (char *)buf;
+  pi->bufsize = bufsize;
+  pi->bufmask = SIZE_MAX;
+  pi->bufsize_max = kft_ispec_get_bufsize_max(ispec);
+  pi->bufpos_retained = 0;
   pi->bufpos_committed = 0;
   pi->bufpos_fetched = 0;
-  pi->bufpos_prefetched = 0;
+  pi->bufpos_prefetched = bufsize;
+  pi->bufoff = 0;
+  pi->seekable = false;
+  pi->bufpos_pinned = SIZE_MAX;
   pi->esclen = 0;
   pi->ispec = ispec;
-  pi->ptags = kft_itags_new(fp);
+  pi->ptags = kft_itags_new();
+  pi->pops = NULL;
+  pi->op = 0;
+  pi->opoff = 0;
+  return pi;
+}
+
+kft_input_t *kft_input_new_ops(const kft_ops_t *pops, const char *filename,
+                               kft_ispec_t ispec) {
+  kft_input_t *pi = kft_input_new_mem(kft_ops_get_src(pops),
+                                      kft_ops_get_srclen(pops), ispec);
+  pi->filename = filename;
+  pi->pops = pops;
   return pi;
 }
 
+/**
+ * Map a regular file as the whole prefetch buffer
+ *
+ * The input keeps the stream when the file can not be mapped.
+ *
+ * @param pi input (not yet read)
+ */
+static void kft_input_map(kft_input_t *pi) {
+  struct stat st;
+  if (pi->fd < 0 || fstat(pi->fd, &st) == -1) {
+    return;
+  }
+  if (!S_ISREG(st.st_mode) || st.st_size <= 0 ||
+      (off_t)(size_t)st.st_size != st.st_size) {
+    return;
+  }
+  size_t size = (size_t)st.st_size;
+  void *ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, pi->fd, 0);
+  if (ptr == MAP_FAILED) {
+    return;
+  }
+  madvise(ptr, size, MADV_SEQUENTIAL);
+  // THE FILE MAY BE TRUNCATED WHILE RENDERING (BY A BLOCK, ...)
+  kft_map_guard(ptr, size, pi->filename);
+  pi->mode |= KFT_INPUT_MODE_MMAPPED;
+  pi->eof = true;
+  pi->buf = (char *)ptr;
+  pi->bufsize = size;
+  pi->bufmask = SIZE_MAX;
+  pi->bufpos_prefetched = size;
+  pi->bufoff = 0;
+}
+
 kft_input_t *kft_input_new_open(const char *filename, kft_ispec_t ispec) {
   FILE *fp = fopen(filename, "r");
   if (fp == NULL) {
@@ -72,15 +191,30 @@ kft_input_t *kft_input_new_open(const char *filename, kft_ispec_t ispec) {
   pi->mode = KFT_INPUT_MODE_STREAM_OPENED;
   pi->fp = fp;
   pi->filename = filename;
-  pi->ipos = kft_ipos_init(fp, 0, 0);
+  pi->ipos = kft_ipos_init(pi, 0, 0);
+  pi->bufpos_ipos = 0;
+  pi->fd = fileno(fp);
+  pi->eof = false;
   pi->buf = NULL;
   pi->bufsize = 0;
+  pi->bufmask = 0;
+  pi->bufsize_max = kft_ispec_get_bufsize_max(ispec);
+  pi->bufpos_retained = 0;
   pi->bufpos_committed = 0;
   pi->bufpos_fetched = 0;
   pi->bufpos_prefetched = 0;
+  kft_input_init_bufoff(pi);
   pi->esclen = 0;
   pi->ispec = ispec;
-  pi->ptags = kft_itags_new(fp);
+  pi->ptags = kft_itags_new();
+  pi->pops = NULL;
+  pi->op = 0;
+  pi->opoff = 0;
+  kft_input_map(pi);
+  if (pi->mode & KFT_INPUT_MODE_MMAPPED) {
+    // A FILE OPENED AGAIN (INCLUDED IN A LOOP, ...) RUNS COMPILED
+    pi->pops = kft_ops_open(pi->fd, filename, ispec, false);
+  }
   return pi;
 }
 
@@ -102,15 +236,52 @@ kft_input_t *kft_input_new(FILE *fp, const char *filename, kft_ispec_t ispec) {
   pi->mode = mode;
   pi->fp = fp;
   pi->filename = filename;
-  pi->ipos = kft_ipos_init(fp, 0, 0);
+  pi->ipos = kft_ipos_init(pi, 0, 0);
+  pi->bufpos_ipos = 0;
+  pi->fd = fileno(fp);
+  pi->eof = false;
+  pi->buf = NULL;
+  pi->bufsize = 0;
+  pi->bufmask = 0;
+  pi->bufsize_max = kft_ispec_get_bufsize_max(ispec);
+  pi->bufpos_retained = 0;
+  pi->bufpos_committed = 0;
+  pi->bufpos_fetched = 0;
+  pi->bufpos_prefetched = 0;
+  kft_input_init_bufoff(pi);
+  pi->esclen = 0;
+  pi->ispec = ispec;
+  pi->ptags = kft_itags_new();
+  pi->pops = NULL;
+  pi->op = 0;
+  pi->opoff = 0;
+  return pi;
+}
+
+kft_input_t *kft_input_new_fd(int fd, const char *filename, kft_ispec_t ispec) {
+  kft_input_t *pi = (kft_input_t *)kft_malloc(sizeof(kft_input_t));
+  pi->mode = KFT_INPUT_MODE_FD_OPENED;
+  pi->fp = NULL;
+  pi->filename = filename;
+  pi->ipos = kft_ipos_init(pi, 0, 0);
+  pi->bufpos_ipos = 0;
+  pi->fd = fd;
+  pi->eof = false;
   pi->buf = NULL;
   pi->bufsize = 0;
+  pi->bufmask = 0;
+  pi->bufsize_max = kft_ispec_get_bufsize_max(ispec);
+  pi->bufpos_retained = 0;
   pi->bufpos_committed = 0;
   pi->bufpos_fetched = 0;
   pi->bufpos_prefetched = 0;
+  kft_input_init_bufoff(pi);
   pi->esclen = 0;
   pi->ispec = ispec;
-  pi->ptags = kft_itags_new(fp);
+  pi->ptags = kft_itags_new();
+  pi->pops = NULL;
+  pi->op = 0;
+  pi->opoff = 0;
   return pi;
 }
 
@@ -118,86 +289,396 @@ void kft_input_delete(kft_input_t *pi) {
   if (pi->mode & KFT_INPUT_MODE_STREAM_OPENED) {
     fclose(pi->fp);
   }
+  if (pi->mode & KFT_INPUT_MODE_FD_OPENED) {
+    close(pi->fd);
+  }
   if (pi->mode & KFT_INPUT_MODE_MALLOC_FILENAME) {
     kft_free((char *)pi->filename);
   }
-  kft_free(pi->buf);
+  if (pi->mode & KFT_INPUT_MODE_MMAPPED) {
+    kft_map_unguard(pi->buf);
+    munmap(pi->buf, pi->bufsize);
+  } else if (pi->buf != NULL && !(pi->mode & KFT_INPUT_MODE_MEMORY)) {
+    kft_free(pi->buf);
+  }
   kft_free(pi);
 }
 
-int kft_fetch_raw(kft_input_t *pi) {
-  if (pi->bufpos_fetched < pi->bufpos_prefetched) {
-    // FETCH FROM PREFETCH DATA
-    return pi->buf[pi->bufpos_fetched++];
+/**
+ * Get the buffer address of a stream position
+ *
+ * @param pi input
+ * @param pos stream position (retained in buffer)
+ * @return buffer address
+ */
+static inline char *kft_input_ptr(const kft_input_t *pi, size_t pos) {
+  return pi->buf + (pos & pi->bufmask);
+}
+
+/**
+ * Get the contiguous length in buffer from a stream position
+ *
+ * @param pi input
+ * @param pos stream position (retained in buffer)
+ * @param end stream position to stop at
+ * @return contiguous length (up to end)
+ */
+static inline size_t kft_input_contig(const kft_input_t *pi, size_t pos,
+                                      size_t end) {
+  size_t len = pi->bufsize - (pos & pi->bufmask);
+  return end - pos < len ? end - pos : len;
+}
+
+/**
+ * Bring the position up to the committed stream position
+ *
+ * Rows and columns are not tracked per character; they are counted here only
+ * when somebody asks for them (or before committed data is overwritten).
+ *
+ * @param pi input
+ */
+static void kft_input_sync_ipos(kft_input_t *pi) {
+  while (pi->bufpos_ipos < pi->bufpos_committed) {
+    const char *ptr = kft_input_ptr(pi, pi->bufpos_ipos);
+    size_t len = kft_input_contig(pi, pi->bufpos_ipos, pi->bufpos_committed);
+    size_t nlines = kft_scan_count(ptr, len, '\n');
+    if (nlines == 0) {
+      pi->ipos.col += len;
+    } else {
+      const char *eol = memrchr(ptr, '\n', len);
+      pi->ipos.row += nlines;
+      pi->ipos.col = len - (eol - ptr) - 1;
+    }
+    pi->bufpos_ipos += len;
   }
+}
 
-  // FETCH FROM STREAM
-  int ch = fgetc(pi->fp);
-  if (ch == EOF) {
-    return ch;
+/**
+ * Get the oldest stream position to keep in buffer
+ *
+ * @param pi input
+ * @return committed position, or the pinned position before it
+ */
+static inline size_t kft_input_floor(const kft_input_t *pi) {
+  return pi->bufpos_pinned < pi->bufpos_committed ? pi->bufpos_pinned
+                                                  : pi->bufpos_committed;
+}
+
+/**
+ * Reallocate the ring buffer keeping the uncommitted (or pinned) data
+ *
+ * @param pi input
+ * @param bufsize new buffer size (power of 2)
+ */
+static void kft_input_resize(kft_input_t *pi, size_t bufsize) {
+  char *buf = (char *)kft_malloc_atomic(bufsize);
+  size_t bufmask = bufsize - 1;
+  size_t floor = kft_input_floor(pi);
+  for (size_t pos = floor; pos < pi->bufpos_prefetched;) {
+    size_t len = kft_input_contig(pi, pos, pi->bufpos_prefetched);
+    size_t idx = pos & bufmask;
+    size_t len1 = bufsize - idx < len ? bufsize - idx : len;
+    memcpy(buf + idx, kft_input_ptr(pi, pos), len1);
+    memcpy(buf, kft_input_ptr(pi, pos) + len1, len - len1);
+    pos += len;
+  }
+  if (pi->buf != NULL) {
+    kft_free(pi->buf);
+  }
+  pi->buf = buf;
+  pi->bufsize = bufsize;
+  pi->bufmask = bufmask;
+  pi->bufpos_retained = floor;
+}
+
+/**
+ * Get the initial size of the prefetch buffer
+ *
+ * @param pi input
+ * @return KFT_INPUT_BUFSIZE, or less to stay within the limit
+ */
+static size_t kft_input_bufsize_init(const kft_input_t *pi) {
+  size_t bufsize = KFT_INPUT_BUFSIZE;
+  while (bufsize > KFT_INPUT_BUFSIZE_MIN && bufsize > pi->bufsize_max) {
+    bufsize /= 2;
+  }
+  return bufsize;
+}
+
+/**
+ * Read the next chunk from the stream into the prefetch buffer
+ *
+ * @param pi input
+ * @return number of bytes read, 0 on end of stream
+ */
+static size_t kft_input_fill(kft_input_t *pi) {
+  if (pi->eof) {
+    return 0;
   }
 
-  size_t committed_size = pi->bufpos_committed;
-  size_t prefetched_size = pi->bufpos_prefetched - pi->bufpos_committed;
+  // COUNT LINES BEFORE COMMITTED DATA IS OVERWRITTEN
+  kft_input_sync_ipos(pi);
 
-  // WHEN PREFETCH DATA IS EMPTY
-  if (committed_size > 0 && prefetched_size == 0) {
+  size_t floor = kft_input_floor(pi);
+  if (floor < pi->bufpos_committed &&
+      pi->bufpos_prefetched - floor == pi->bufsize &&
+      pi->bufsize * 2 > pi->bufsize_max) {
+    // DROP THE PINNED DATA RATHER THAN EXCEED THE LIMIT
+    pi->bufpos_pinned = SIZE_MAX;
+    floor = pi->bufpos_committed;
+  }
+  size_t window = pi->bufpos_prefetched - floor;
+  if (pi->bufsize == 0) {
+    // ALLOCATE BUFFER
+    kft_input_resize(pi, kft_input_bufsize_init(pi));
+  } else if (window == pi->bufsize) {
+    // EXPAND BUFFER (LOOKAHEAD FILLS THE WHOLE BUFFER)
+    if (pi->bufsize * 2 > pi->bufsize_max) {
+      kft_error("%s: lookahead exceeds the input buffer limit (%zu bytes)\n",
+                pi->filename, pi->bufsize_max);
+    }
+    kft_input_resize(pi, pi->bufsize * 2);
+  } else if (window == 0 && pi->bufsize > kft_input_bufsize_init(pi)) {
+    // SHRINK BUFFER (NOTHING TO KEEP)
+    kft_input_resize(pi, kft_input_bufsize_init(pi));
+  }
 
-    // RESET POSITIONS
-    pi->bufpos_committed = 0;
-    pi->bufpos_fetched = 0;
-    pi->bufpos_prefetched = 0;
+  // READ CHUNK FROM STREAM INTO CONTIGUOUS FREE SPACE
+  char *ptr = kft_input_ptr(pi, pi->bufpos_prefetched);
+  size_t len =
+      kft_input_contig(pi, pi->bufpos_prefetched, floor + pi->bufsize);
+  size_t nread;
+  if (pi->fd >= 0) {
+    ssize_t ret;
+    do {
+      ret = read(pi->fd, ptr, len);
+    } while (ret == -1 && errno == EINTR);
+    nread = ret == -1 ? 0 : (size_t)ret;
+  } else {
+    nread = fread(ptr, 1, len, pi->fp);
+  }
+  if (nread == 0) {
+    pi->eof = true;
+    return 0;
   }
+  pi->bufpos_prefetched += nread;
+  if (pi->bufpos_prefetched - pi->bufpos_retained > pi->bufsize) {
+    pi->bufpos_retained = pi->bufpos_prefetched - pi->bufsize;
+  }
+  return nread;
+}
 
-  // WHEN FETCH POSITION REACHES END OF PREFETCH BUFFER
-  if (pi->bufpos_prefetched == pi->bufsize) {
+/* --------------------------------------------- *
+ * Compiled Template                             *
+ * --------------------------------------------- */
 
-    // WHEN COMMITTED DATA EXISTS
-    if (pi->bufpos_committed > 0) {
+/**
+ * Move to the next operation of the compiled template
+ *
+ * @param pi input (compiled)
+ */
+static inline void kft_input_ops_next(kft_input_t *pi) {
+  pi->op++;
+  pi->opoff = 0;
+}
 
-      // FLUSH COMMITTED DATA
-      memcpy(pi->buf, pi->buf + pi->bufpos_committed, prefetched_size);
-      pi->bufpos_fetched = prefetched_size;
-      pi->bufpos_prefetched = prefetched_size;
-      pi->bufpos_committed = 0;
+/**
+ * Get the next token from the compiled template (as kft_fgetc)
+ *
+ * @param pi input (compiled)
+ * @return character, KFT_CH_* or EOF
+ */
+static int kft_input_ops_fgetc(kft_input_t *pi) {
+  if (pi->op == kft_ops_get_count(pi->pops)) {
+    return EOF;
+  }
+  const kft_op_t *pop = &kft_ops_get_ops(pi->pops)[pi->op];
+  switch (pop->kind) {
+  case KFT_OP_EOL:
+    kft_input_ops_next(pi);
+    return KFT_CH_EOL;
+  case KFT_OP_END:
+    kft_input_ops_next(pi);
+    return KFT_CH_END;
+  case KFT_OP_BEGIN:
+    if (pi->opoff == 0 && pop->directive != 0) {
+      // THE DIRECTIVE IS PENDING
+      pi->opoff = 1;
+      return KFT_CH_BEGIN;
+    }
+    if (pi->opoff == 0) {
+      kft_input_ops_next(pi);
+      return KFT_CH_BEGIN;
+    }
+    // THE DIRECTIVE IS READ AS A CHARACTER
+    kft_input_ops_next(pi);
+    return pop->directive;
+  default: {
+    int ch = (unsigned char)kft_ops_get_text(pi->pops, pop)[pi->opoff++];
+    if (pi->opoff == pop->len) {
+      kft_input_ops_next(pi);
     }
+    return ch;
+  }
+  }
+}
+
+/**
+ * Get a run of plain characters from the compiled template (as kft_fspan)
+ *
+ * @param pi input (compiled)
+ * @param pspan pointer to the run
+ * @return length of the run
+ */
+static size_t kft_input_ops_fspan(kft_input_t *pi, const char **pspan) {
+  if (pi->op == kft_ops_get_count(pi->pops)) {
+    return 0;
+  }
+  const kft_op_t *pop = &kft_ops_get_ops(pi->pops)[pi->op];
+  if (pop->kind == KFT_OP_TEXT) {
+    *pspan = kft_ops_get_text(pi->pops, pop) + pi->opoff;
+    size_t len = pop->len - pi->opoff;
+    kft_input_ops_next(pi);
+    return len;
   }
+  if (pop->kind == KFT_OP_BEGIN && pi->opoff == 1) {
+    *pspan = kft_ops_get_text(pi->pops, pop);
+    kft_input_ops_next(pi);
+    return 1;
+  }
+  return 0;
+}
 
-  // WHEN PREFETCH BUFFER IS FULL
-  if (pi->bufpos_prefetched == pi->bufsize) {
+/**
+ * Get the source offset of the current position of the compiled template
+ *
+ * Exact between operations and in text without escapes.
+ *
+ * @param pi input (compiled)
+ * @return source offset
+ */
+static size_t kft_input_ops_srcoff(const kft_input_t *pi) {
+  size_t nops = kft_ops_get_count(pi->pops);
+  if (pi->op == nops) {
+    return kft_ops_get_srclen(pi->pops);
+  }
+  const kft_op_t *pop = &kft_ops_get_ops(pi->pops)[pi->op];
+  if (pi->opoff == 0) {
+    return pop->srcoff;
+  }
+  if (pop->kind == KFT_OP_BEGIN) {
+    return pop->stroff;
+  }
+  size_t srcoff = pop->srcoff + pi->opoff;
+  size_t srcoff_next = pi->op + 1 < nops ? pop[1].srcoff
+                                         : kft_ops_get_srclen(pi->pops);
+  return srcoff < srcoff_next ? srcoff : srcoff_next - 1;
+}
 
-    // EXPAND BUFFER
-    size_t bufsize = pi->bufsize;
-    if (bufsize == 0) {
-      bufsize = 64;
-    } else {
-      bufsize = bufsize * 3 / 2;
+/**
+ * Get the position of the compiled template
+ *
+ * @param pi input (compiled)
+ * @return position
+ */
+static kft_ipos_t kft_input_ops_ipos(const kft_input_t *pi) {
+  size_t srcoff = kft_input_ops_srcoff(pi);
+  if (kft_ops_get_count(pi->pops) == 0) {
+    return kft_ipos_init(pi, 0, 0);
+  }
+  const kft_op_t *pop =
+      &kft_ops_get_ops(pi->pops)[kft_ops_find(pi->pops, srcoff)];
+  const char *ptr = kft_ops_get_src(pi->pops) + pop->srcoff;
+  size_t len = srcoff - pop->srcoff;
+  size_t nlines = kft_scan_count(ptr, len, '\n');
+  if (nlines == 0) {
+    return kft_ipos_init(pi, pop->row, pop->col + len);
+  }
+  const char *eol = memrchr(ptr, '\n', len);
+  return kft_ipos_init(pi, pop->row + nlines, len - (eol - ptr) - 1);
+}
+
+/**
+ * Seek the compiled template
+ *
+ * @param pi input (compiled)
+ * @param offset source offset (between operations or in text without escapes)
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_input_ops_fseek(kft_input_t *pi, long offset) {
+  size_t srclen = kft_ops_get_srclen(pi->pops);
+  if (offset < 0 || (size_t)offset > srclen) {
+    return KFT_FAILURE;
+  }
+  size_t srcoff = (size_t)offset;
+  if (srcoff == srclen) {
+    pi->op = kft_ops_get_count(pi->pops);
+    pi->opoff = 0;
+    return KFT_SUCCESS;
+  }
+  size_t op = kft_ops_find(pi->pops, srcoff);
+  const kft_op_t *pop = &kft_ops_get_ops(pi->pops)[op];
+  if (pop->srcoff == srcoff) {
+    pi->op = op;
+    pi->opoff = 0;
+    return KFT_SUCCESS;
+  }
+  if (kft_ops_is_verbatim(pi->pops, pop) && srcoff < pop->srcoff + pop->len) {
+    pi->op = op;
+    pi->opoff = srcoff - pop->srcoff;
+    return KFT_SUCCESS;
+  }
+  return KFT_FAILURE;
+}
+
+int kft_input_seek_srcoff(kft_input_t *pi, size_t srcoff) {
+  if (pi->pops == NULL || srcoff > LONG_MAX) {
+    return KFT_FAILURE;
+  }
+  return kft_input_ops_fseek(pi, (long)srcoff);
+}
+
+int kft_input_directive(kft_input_t *pi) {
+  if (pi->pops != NULL) {
+    if (pi->op == kft_ops_get_count(pi->pops)) {
+      return 0;
     }
-    char *buf = (char *)kft_realloc(pi->buf, bufsize);
-    pi->buf = buf;
-    pi->bufsize = bufsize;
+    const kft_op_t *pop = &kft_ops_get_ops(pi->pops)[pi->op];
+    if (pop->kind != KFT_OP_BEGIN || pi->opoff != 1) {
+      return 0;
+    }
+    kft_input_ops_next(pi);
+    return pop->directive;
   }
 
-  // STORE FETCHED DATA
-  pi->buf[pi->bufpos_prefetched++] = ch;
-  pi->bufpos_fetched++;
+  // THE DIRECTIVE IS READ RAW
+  int ch = kft_fetch_raw(pi);
+  if (ch == EOF) {
+    return 0;
+  }
+  if (ch == '\0' || strchr(KFT_OP_DIRECTIVES, ch) == NULL) {
+    kft_input_rollback(pi, 1);
+    return 0;
+  }
+  kft_input_commit(pi, 1);
   return ch;
 }
 
-static void kft_update_pos(int ch, kft_ipos_t *pipos)
-    __attribute__((nonnull(2)));
+/* --------------------------------------------- *
+ * Input Functions                               *
+ * --------------------------------------------- */
 
-static void kft_update_pos(int ch, kft_ipos_t *pipos) {
-  switch (ch) {
-  case EOF:
-    break;
-  case '\n':
-    pipos->row++;
-    pipos->col = 0;
-    break;
-  default:
-    pipos->col++;
+int kft_fetch_raw(kft_input_t *pi) {
+  assert(pi->pops == NULL);
+  if (pi->bufpos_fetched == pi->bufpos_prefetched) {
+    // FETCH FROM STREAM
+    if (kft_input_fill(pi) == 0) {
+      return EOF;
+    }
   }
+
+  // FETCH FROM PREFETCH DATA
+  return (unsigned char)*kft_input_ptr(pi, pi->bufpos_fetched++);
 }
 
 void kft_input_rollback(kft_input_t *pi, size_t count) {
@@ -207,238 +688,369 @@ void kft_input_rollback(kft_input_t *pi, size_t count) {
 
 void kft_input_commit(kft_input_t *pi, size_t count) {
   assert(count <= pi->bufpos_fetched - pi->bufpos_committed);
-  for (size_t i = 0; i < count; i++) {
-    kft_update_pos(pi->buf[pi->bufpos_committed + i], &pi->ipos);
-  }
   pi->bufpos_committed += count;
 }
 
+/**
+ * Test whether the delimiter starts at a fetched character
+ *
+ * Reads ahead as needed, but does not move the fetch position.
+ *
+ * @param pi input
+ * @param pos buffer position of the first character (already fetched)
+ * @param pdelim compiled delimiter
+ * @return true if the whole delimiter matches
+ */
+static bool kft_input_match(kft_input_t *pi, size_t pos,
+                            const kft_delim_t *pdelim) {
+  while (pi->bufpos_prefetched - pos < pdelim->len) {
+    if (kft_input_fill(pi) == 0) {
+      return false;
+    }
+  }
+  size_t len = kft_input_contig(pi, pos, pi->bufpos_prefetched);
+  if (len >= pdelim->len) {
+    return kft_delim_match(pdelim, kft_input_ptr(pi, pos), len);
+  }
+
+  // DELIMITER WRAPS AROUND THE RING BUFFER
+  char tmp[pdelim->len];
+  memcpy(tmp, kft_input_ptr(pi, pos), len);
+  memcpy(tmp + len, kft_input_ptr(pi, pos + len), pdelim->len - len);
+  return kft_delim_match(pdelim, tmp, pdelim->len);
+}
+
 int kft_fgetc(kft_input_t *pi) {
+  if (pi->pops != NULL) {
+    return kft_input_ops_fgetc(pi);
+  }
   int ch_esc = kft_ispec_get_ch_esc(pi->ispec);
-  const char *delim_st = kft_ispec_get_delim_st(pi->ispec);
-  const char *delim_en = kft_ispec_get_delim_en(pi->ispec);
-  while (1) {
-    // FETCH NEXT CHARACTER
-    int ch = kft_fetch_raw(pi);
-    if (ch == EOF) {
-      return EOF;
-    }
+  const kft_delim_t *match_st = kft_ispec_get_match_st(&pi->ispec);
+  const kft_delim_t *match_en = kft_ispec_get_match_en(&pi->ispec);
+  int ch_st = (unsigned char)match_st->str[0];
+  int ch_en = (unsigned char)match_en->str[0];
+
+  // FETCH NEXT CHARACTER
+  int ch = kft_fetch_raw(pi);
+  if (ch == EOF) {
+    return EOF;
+  }
 
-    if (pi->esclen > 0) {
-      pi->esclen--;
+  if (pi->esclen > 0) {
+    pi->esclen--;
+    kft_input_commit(pi, 1);
+    return KFT_CH_NORM(ch);
+  }
+
+  // --------------------------
+  // ESCAPE CHARACTER
+  // --------------------------
+  if (ch == ch_esc) {
+
+    int ch_esc_next = kft_fetch_raw(pi);
+    if (ch_esc_next == EOF) {
+      // ACCEPT ESCAPE
       kft_input_commit(pi, 1);
-      return KFT_CH_NORM(ch);
+      return ch;
     }
 
-    // --------------------------
-    // ESCAPE CHARACTER
-    // --------------------------
-    if (ch == ch_esc) {
+    if (ch_esc_next == '\n' || ch_esc_next == ch_esc) {
+      // DISCARD ESCAPE AND ACCEPT ESCAPED CHARACTER
+      kft_input_commit(pi, 2);
+      return ch_esc_next;
+    }
 
-      int ch_esc_next = kft_fetch_raw(pi);
-      if (ch_esc_next == EOF) {
-        // ACCEPT ESCAPE
-        kft_input_commit(pi, 1);
-        return ch;
-      }
+    const kft_delim_t *match_esc = NULL;
+    if (ch_esc_next == ch_en) {
+      match_esc = match_en;
+    } else if (ch_esc_next == ch_st) {
+      match_esc = match_st;
+    }
 
-      if (ch_esc_next == '\n' || ch_esc_next == ch_esc) {
-        // DISCARD ESCAPE AND ACCEPT ESCAPED CHARACTER
+    if (match_esc != NULL) {
+      if (kft_input_match(pi, pi->bufpos_fetched - 1, match_esc)) {
+        // COMPLETE DELIMITER
+        // ESC DLM0 DLM1 ...
+        // |   |     \__ UNESCAPED
+        // |    \_______ ESCAPED
+        //  \___________ DISCARDED
+        // DISCARD ESCAPE AND ACCEPT DELIM[0]
         kft_input_commit(pi, 2);
         return ch_esc_next;
       }
-
-      if (ch_esc_next == delim_en[0]) {
-
-        // CHECK FOLLOWING DELIMITER
-        size_t i = 1;
-        size_t j = 1;
-        int ch3 = EOF;
-        while (delim_en[i] != '\0') {
-          ch3 = kft_fetch_raw(pi);
-          if (ch3 != EOF) {
-            j++;
-          }
-          if (ch3 != delim_en[i]) {
-            break;
-          }
-          i++;
-        }
-
-        if (delim_en[i] == '\0') {
-          // COMPLETE DELIMITER
-
-          // REWIND PREFETCHED DELIMITER
-          kft_input_rollback(pi, j - 1);
-          // MARK ESCAPE A CHARACTER
-          pi->esclen = 0;
-          // ESC END0 END1 ...
-          // |   |     \__ UNESCAPED
-          // |    \_______ ESCAPED
-          //  \___________ DISCARDED
-          // DISCARD ESCAPE AND ACCEPT DELIM[0]
-          kft_input_commit(pi, 2);
-          return ch_esc_next;
-        } else {
-          // INCOMPLETE DELIMITER
-
-          // REWIND PREFETCHED DELIMITER (AND ESCAPE CHARACTER)
-          kft_input_rollback(pi, j);
-          // MARK ESCAPE TWO CHARACTERS
-          pi->esclen = 1;
-          // ESC END0 END1 ...
-          // |   |     \__ UNESCAPED
-          // |    \_______ ESCAPED
-          //  \___________ ESCAPED
-          // ACCEPT ESCAPE
-          kft_input_commit(pi, 1);
-          return ch;
-        }
-      }
-
-      if (ch_esc_next == delim_st[0]) {
-
-        // CHECK FOLLOWING DELIMITER
-        size_t i = 1;
-        size_t j = 1;
-        int ch3 = EOF;
-        while (delim_st[i] != '\0') {
-          ch3 = kft_fetch_raw(pi);
-          if (ch3 != EOF) {
-            j++;
-          }
-          if (ch3 != delim_st[i]) {
-            break;
-          }
-          i++;
-        }
-
-        if (delim_st[i] == '\0') {
-          // COMPLETE DELIMITER
-
-          // REWIND PREFETCHED DELIMITER
-          kft_input_rollback(pi, j - 1);
-          // MARK ESCAPE A CHARACTER
-          pi->esclen = 0;
-          // ESC STR0 STR1 ...
-          // |   |     \__ UNESCAPED
-          // |    \_______ ESCAPED
-          //  \___________ DISCARDED
-          // DISCARD ESCAPE AND ACCEPT DELIM[0]
-          kft_input_commit(pi, 2);
-          return ch_esc_next;
-        } else {
-          // INCOMPLETE DELIMITER
-
-          // REWIND PREFETCHED DELIMITER (AND ESCAPE CHARACTER)
-          kft_input_rollback(pi, j);
-          // MARK ESCAPE TWO CHARACT
-          pi->esclen = 1;
-          // ESC STR0 STR1 ...
-          // |   |     \__ UNESCAPED
-          // |    \_______ ESCAPED
-          //  \___________ ESCAPED
-          // ACCEPT ESCAPE
-          kft_input_commit(pi, 1);
-          return ch;
-        }
-      }
-
-      // REWIND PREFETCHED CHARACTER
+      // INCOMPLETE DELIMITER
+      // ESC DLM0 DLM1 ...
+      // |   |     \__ UNESCAPED
+      // |    \_______ ESCAPED
+      //  \___________ ESCAPED
+      // REWIND DELIMITER AND MARK IT ESCAPED
       kft_input_rollback(pi, 1);
+      pi->esclen = 1;
       // ACCEPT ESCAPE
       kft_input_commit(pi, 1);
       return ch;
     }
 
-    if (ch == delim_en[0]) {
+    // REWIND PREFETCHED CHARACTER
+    kft_input_rollback(pi, 1);
+    // ACCEPT ESCAPE
+    kft_input_commit(pi, 1);
+    return ch;
+  }
 
-      // CHECK FOLLOWING DELIMITER
-      size_t i = 1;
-      size_t j = 1;
-      int ch2 = EOF;
-      while (delim_en[i] != '\0') {
-        ch2 = kft_fetch_raw(pi);
-        if (ch2 != EOF) {
-          j++;
-        }
-        if (ch2 != delim_en[i]) {
-          break;
-        }
-        i++;
-      }
+  if (ch == ch_en && kft_input_match(pi, pi->bufpos_fetched - 1, match_en)) {
+    // COMPLETE DELIMITER
+    pi->bufpos_fetched += match_en->len - 1;
+    kft_input_commit(pi, match_en->len);
+    return KFT_CH_END;
+  }
 
-      if (delim_en[i] == '\0') {
-        // COMPLETE DELIMITER
-        kft_input_commit(pi, j);
-        return KFT_CH_END;
-      } else {
-        kft_input_rollback(pi, j - 1);
-      }
-    }
+  if (ch == ch_st && kft_input_match(pi, pi->bufpos_fetched - 1, match_st)) {
+    // COMPLETE DELIMITER
+    pi->bufpos_fetched += match_st->len - 1;
+    kft_input_commit(pi, match_st->len);
+    return KFT_CH_BEGIN;
+  }
 
-    if (ch == delim_st[0]) {
+  if (ch == '\n') {
+    kft_input_commit(pi, 1);
+    return KFT_CH_EOL;
+  }
 
-      // CHECK FOLLOWING DELIMITER
-      size_t i = 1;
-      size_t j = 1;
-      int ch2 = EOF;
-      while (delim_st[i] != '\0') {
-        ch2 = kft_fetch_raw(pi);
-        if (ch2 != EOF) {
-          j++;
-        }
-        if (ch2 != delim_st[i]) {
-          break;
-        }
-        i++;
-      }
+  kft_input_commit(pi, 1);
+  return ch;
+}
 
-      if (delim_st[i] == '\0') {
-        // COMPLETE DELIMITER
-        kft_input_commit(pi, j);
-        return KFT_CH_BEGIN;
-      } else {
-        // INCOMPLETE DELIMITER
-        kft_input_rollback(pi, j - 1);
-      }
+size_t kft_fspan(kft_input_t *pi, const char **pspan, bool stop_on_eol) {
+  if (pi->pops != NULL) {
+    // TEXT OPERATIONS NEVER HAVE AN END OF LINE
+    return kft_input_ops_fspan(pi, pspan);
+  }
+  assert(pi->bufpos_fetched == pi->bufpos_committed);
+  if (pi->esclen > 0) {
+    return 0;
+  }
+  if (pi->bufpos_fetched == pi->bufpos_prefetched) {
+    if (kft_input_fill(pi) == 0) {
+      return 0;
     }
+  }
 
-    if (ch == '\n') {
-      kft_input_commit(pi, 1);
-      return KFT_CH_EOL;
-    }
+  const char *span = kft_input_ptr(pi, pi->bufpos_fetched);
+  size_t avail =
+      kft_input_contig(pi, pi->bufpos_fetched, pi->bufpos_prefetched);
+  kft_scanset_t scanset = kft_ispec_get_scanset(pi->ispec, stop_on_eol);
+  size_t len = kft_scan(span, avail, &scanset);
+  pi->bufpos_fetched += len;
+  kft_input_commit(pi, len);
+  *pspan = span;
+  return len;
+}
 
-    kft_input_commit(pi, 1);
-    return ch;
+int kft_input_get_span_fd(const kft_input_t *pi, const char *span,
+                          off_t *poffset) {
+  if (!(pi->mode & KFT_INPUT_MODE_MMAPPED)) {
+    return -1;
   }
+  if (pi->pops != NULL) {
+    // UNESCAPED TEXT IS NOT IN THE SOURCE
+    const char *src = kft_ops_get_src(pi->pops);
+    if (span < src || span > src + kft_ops_get_srclen(pi->pops)) {
+      return -1;
+    }
+    *poffset = (off_t)(span - src);
+    return pi->fd;
+  }
+  assert(pi->buf <= span && span <= pi->buf + pi->bufsize);
+  *poffset = (off_t)(span - pi->buf);
+  return pi->fd;
 }
 
 kft_ioffset_t kft_ftell(kft_input_t *pi) {
-  long offset = ftell(pi->fp);
-  if (offset == -1) {
-    return (kft_ioffset_t){.ipos = pi->ipos, .offset = -1};
+  if (pi->pops != NULL) {
+    return (kft_ioffset_t){
+        .ipos = kft_input_ops_ipos(pi),
+        .offset = (long)kft_input_ops_srcoff(pi),
+    };
   }
+  kft_input_sync_ipos(pi);
   return (kft_ioffset_t){
       .ipos = pi->ipos,
-      .offset = offset - (pi->bufpos_prefetched - pi->bufpos_committed),
+      .offset = pi->bufoff + (long)pi->bufpos_committed,
   };
 }
 
 int kft_fseek(kft_input_t *pi, kft_ioffset_t ioff) {
-  assert(pi->fp == ioff.ipos.fp);
-  int ret = fseek(pi->fp, ioff.offset, SEEK_SET);
-  if (ret != 0) {
+  assert(pi == ioff.ipos.pi);
+  assert(pi->esclen == 0);
+  if (ioff.offset < 0) {
+    return KFT_FAILURE;
+  }
+
+  // A LOOP IN THE MAPPED FILE OR THE MEMORY INPUT RUNS COMPILED
+  if (pi->pops == NULL &&
+      ioff.offset < pi->bufoff + (long)pi->bufpos_committed) {
+    if (pi->mode & KFT_INPUT_MODE_MMAPPED) {
+      pi->pops = kft_ops_open(pi->fd, pi->filename, pi->ispec, true);
+    } else if (pi->mode & KFT_INPUT_MODE_MEMORY) {
+      pi->pops = kft_ops_compile(pi->buf, pi->bufsize, pi->ispec);
+    }
+  }
+  if (pi->pops != NULL) {
+    return kft_input_ops_fseek(pi, ioff.offset);
+  }
+
+  // WHEN THE OFFSET IS STILL IN THE BUFFER
+  if (ioff.offset >= pi->bufoff) {
+    size_t pos = ioff.offset - pi->bufoff;
+    if (pi->bufpos_retained <= pos && pos <= pi->bufpos_prefetched) {
+      pi->ipos = ioff.ipos;
+      pi->bufpos_committed = pos;
+      pi->bufpos_fetched = pos;
+      pi->bufpos_ipos = pos;
+      return KFT_SUCCESS;
+    }
+  }
+
+  // THE MAPPED FILE AND THE MEMORY INPUT ARE ALWAYS IN THE BUFFER
+  if (!pi->seekable ||
+      (pi->mode & (KFT_INPUT_MODE_MMAPPED | KFT_INPUT_MODE_MEMORY))) {
+    return KFT_FAILURE;
+  }
+
+  // SEEK THE STREAM AND DISCARD THE BUFFERED DATA
+  if (pi->fd >= 0) {
+    if (lseek(pi->fd, ioff.offset, SEEK_SET) == (off_t)-1) {
+      return KFT_FAILURE;
+    }
+  } else if (fseek(pi->fp, ioff.offset, SEEK_SET) != 0) {
     return KFT_FAILURE;
   }
   pi->ipos = ioff.ipos;
+  pi->bufpos_ipos = 0;
+  pi->eof = false;
+  pi->bufoff = ioff.offset;
+  pi->bufpos_pinned = SIZE_MAX;
+  pi->bufpos_retained = 0;
   pi->bufpos_committed = 0;
   pi->bufpos_fetched = 0;
   pi->bufpos_prefetched = 0;
-  assert(pi->esclen == 0);
   return KFT_SUCCESS;
 }
 
+/**
+ * Record the tag blocks of the whole input
+ *
+ * Only top level blocks with a plain tag name ({{:NAME}}, no escapes, blocks
+ * or newlines in the name) are recorded; nested blocks are skipped, so the
+ * recorded offsets are the same as the parser reaches them.
+ *
+ * @param pi input (mapped file or memory input)
+ */
+static void kft_input_scan_tags(kft_input_t *pi) {
+  const char *buf = pi->buf;
+  size_t size = pi->bufpos_prefetched;
+  int ch_esc = kft_ispec_get_ch_esc(pi->ispec);
+  const kft_delim_t *match_st = kft_ispec_get_match_st(&pi->ispec);
+  const kft_delim_t *match_en = kft_ispec_get_match_en(&pi->ispec);
+  int ch_st = (unsigned char)match_st->str[0];
+  int ch_en = (unsigned char)match_en->str[0];
+  kft_scanset_t scanset = kft_ispec_get_scanset(pi->ispec, true);
+  size_t pos = 0, row = 0, col = 0, depth = 0;
+  while (1) {
+    size_t len = kft_scan(buf + pos, size - pos, &scanset);
+    pos += len;
+    col += len;
+    if (pos == size) {
+      break;
+    }
+    int ch = (unsigned char)buf[pos];
+    if (ch == ch_esc) {
+      // THE ESCAPED CHARACTER NEVER STARTS OR ENDS A BLOCK
+      int ch_next = pos + 1 < size ? (unsigned char)buf[pos + 1] : EOF;
+      if (ch_next == '\n') {
+        pos += 2;
+        row++;
+        col = 0;
+      } else if (ch_next == ch_esc || ch_next == ch_st || ch_next == ch_en) {
+        pos += 2;
+        col += 2;
+      } else {
+        pos++;
+        col++;
+      }
+    } else if (ch == ch_en &&
+               kft_delim_match(match_en, buf + pos, size - pos)) {
+      if (depth == 0) {
+        // THE TOP LEVEL ENDS HERE
+        break;
+      }
+      depth--;
+      pos += match_en->len;
+      col += match_en->len;
+    } else if (ch == ch_st &&
+               kft_delim_match(match_st, buf + pos, size - pos)) {
+      size_t pos_key = pos + match_st->len + 1;
+      if (depth == 0 && pos_key <= size && buf[pos_key - 1] == ':') {
+        size_t keylen = kft_scan(buf + pos_key, size - pos_key, &scanset);
+        if (pos_key + keylen < size &&
+            (unsigned char)buf[pos_key + keylen] == ch_en &&
+            kft_delim_match(match_en, buf + pos_key + keylen,
+                            size - pos_key - keylen)) {
+          kft_ioffset_t ioff = {
+              .ipos = kft_ipos_init(pi, row, col),
+              .offset = pi->bufoff + (long)pos,
+          };
+          int max_count;
+          keylen = kft_itags_parse_key(buf + pos_key, keylen, &max_count);
+          kft_itags_add_found(pi->ptags, buf + pos_key, keylen, ioff);
+        }
+      }
+      depth++;
+      pos += match_st->len;
+      col += match_st->len;
+    } else if (ch == '\n') {
+      pos++;
+      row++;
+      col = 0;
+    } else {
+      pos++;
+      col++;
+    }
+  }
+}
+
+int kft_input_find_tag(kft_input_t *pi, const char *key, kft_ioffset_t *pioff) {
+  if (!kft_itags_is_scanned(pi->ptags)) {
+    kft_itags_set_scanned(pi->ptags);
+    // ONLY THE WHOLE CONTENT IN THE BUFFER CAN BE SCANNED
+    if (pi->mode & (KFT_INPUT_MODE_MMAPPED | KFT_INPUT_MODE_MEMORY)) {
+      kft_input_scan_tags(pi);
+    }
+  }
+  const kft_ioffset_t *pioff_found = kft_itags_get_found(pi->ptags, key);
+  if (pioff_found == NULL) {
+    return KFT_FAILURE;
+  }
+  *pioff = *pioff_found;
+  return KFT_SUCCESS;
+}
+
+void kft_input_retain_tags(kft_input_t *pi) {
+  // THE MAPPED FILE AND THE MEMORY INPUT ARE ALWAYS IN THE BUFFER
+  if (pi->mode & (KFT_INPUT_MODE_MMAPPED | KFT_INPUT_MODE_MEMORY)) {
+    return;
+  }
+  const kft_ioffset_t *pioff = kft_itags_get_oldest_live(pi->ptags);
+  pi->bufpos_pinned = SIZE_MAX;
+  if (pioff != NULL && pioff->offset >= pi->bufoff) {
+    size_t pos = pioff->offset - pi->bufoff;
+    if (pi->bufpos_retained <= pos && pos <= pi->bufpos_committed) {
+      pi->bufpos_pinned = pos;
+    }
+  }
+}
+
 kft_ispec_t kft_input_get_spec(kft_input_t *pi) { return pi->ispec; }
 
 kft_itags_t *kft_input_get_tags(kft_input_t *pi) { return pi->ptags; }
@@ -447,14 +1059,32 @@ const char *kft_input_get_filename(const kft_input_t *pi) {
   return pi->filename;
 }
 
-size_t kft_input_get_row(const kft_input_t *pi) { return pi->ipos.row; }
+size_t kft_input_get_row(kft_input_t *pi) {
+  if (pi->pops != NULL) {
+    return kft_input_ops_ipos(pi).row;
+  }
+  kft_input_sync_ipos(pi);
+  return pi->ipos.row;
+}
 
-size_t kft_input_get_col(const kft_input_t *pi) { return pi->ipos.col; }
+size_t kft_input_get_col(kft_input_t *pi) {
+  if (pi->pops != NULL) {
+    return kft_input_ops_ipos(pi).col;
+  }
+  kft_input_sync_ipos(pi);
+  return pi->ipos.col;
+}
 
-kft_ipos_t kft_input_get_ipos(const kft_input_t *pi) { return pi->ipos; }
+kft_ipos_t kft_input_get_ipos(kft_input_t *pi) {
+  if (pi->pops != NULL) {
+    return kft_input_ops_ipos(pi);
+  }
+  kft_input_sync_ipos(pi);
+  return pi->ipos;
+}
 
-kft_ipos_t kft_ipos_init(FILE *fp, size_t row, size_t col) {
-  return (kft_ipos_t){.fp = fp, .row = row, .col = col};
+kft_ipos_t kft_ipos_init(const kft_input_t *pi, size_t row, size_t col) {
+  return (kft_ipos_t){.pi = pi, .row = row, .col = col};
 }
 
 // vim: ts=2 sw=2 sts=2 et fdm=marker
\ No newline at end of file
@@ -11,10 +11,12 @@ typedef struct kft_ioffset kft_ioffset_t;
 
 #include "kft_io_ispec.h"
 #include "kft_io_itags.h"
+#include "kft_ops.h"
 #include <stdio.h>
+#include <sys/types.h>
 
 struct kft_ipos {
-  FILE *fp;
+  const kft_input_t *pi;
   size_t row;
   size_t col;
 };
@@ -39,16 +41,44 @@ struct kft_ioffset {
 kft_input_t *kft_input_new(FILE *fp, const char *filename, kft_ispec_t ispec)
     __attribute__((warn_unused_result, malloc, returns_nonnull, nonnull(1)));
 
+/**
+ * Create a new input context reading a memory buffer in place
+ *
+ * @param buf The buffer (must outlive the input context)
+ * @param bufsize The buffer size
+ * @param ispec The input specification
+ */
 kft_input_t *kft_input_new_mem(const char *buf, size_t bufsize,
                                kft_ispec_t ispec)
     __attribute__((warn_unused_result, malloc, returns_nonnull));
 
+/**
+ * Create a new input context running a compiled template
+ *
+ * @param pops The compiled template (its source is the buffer)
+ * @param filename The input filename (used in messages)
+ * @param ispec The input specification (the template is compiled with)
+ */
+kft_input_t *kft_input_new_ops(const kft_ops_t *pops, const char *filename,
+                               kft_ispec_t ispec)
+    __attribute__((warn_unused_result, malloc, returns_nonnull, nonnull(1, 2)));
+
+/**
+ * Create a new input context reading a file descriptor (without a stream)
+ *
+ * @param fd The input file descriptor (closed with the input context)
+ * @param filename The input filename (used in messages)
+ * @param ispec The input specification
+ */
+kft_input_t *kft_input_new_fd(int fd, const char *filename, kft_ispec_t ispec)
+    __attribute__((warn_unused_result, malloc, returns_nonnull, nonnull(2)));
+
 kft_input_t *kft_input_new_open(const char *filename, kft_ispec_t ispec)
     __attribute__((warn_unused_result, malloc, returns_nonnull, nonnull(1)));
 
 void kft_input_delete(kft_input_t *pi) __attribute__((nonnull(1)));
 
-kft_ipos_t kft_ipos_init(FILE *fp, size_t row, size_t col)
+kft_ipos_t kft_ipos_init(const kft_input_t *pi, size_t row, size_t col)
     __attribute__((nonnull(1), pure, warn_unused_result));
 
 /* --------------------------------------------- *
@@ -64,11 +94,11 @@ kft_itags_t *kft_input_get_tags(kft_input_t *pi)
 const char *kft_input_get_filename(const kft_input_t *pi)
     __attribute__((nonnull(1), returns_nonnull, pure, warn_unused_result));
 
-size_t kft_input_get_row(const kft_input_t *pi)
-    __attribute__((nonnull(1), pure, warn_unused_result));
+size_t kft_input_get_row(kft_input_t *pi)
+    __attribute__((nonnull(1), warn_unused_result));
 
-size_t kft_input_get_col(const kft_input_t *pi)
-    __attribute__((nonnull(1), pure, warn_unused_result));
+size_t kft_input_get_col(kft_input_t *pi)
+    __attribute__((nonnull(1), warn_unused_result));
 
 void kft_input_rollback(kft_input_t *pi, size_t count)
     __attribute__((nonnull(1)));
@@ -76,8 +106,8 @@ void kft_input_rollback(kft_input_t *pi, size_t count)
 void kft_input_commit(kft_input_t *pi, size_t count)
     __attribute__((nonnull(1)));
 
-kft_ipos_t kft_input_get_ipos(const kft_input_t *pi)
-    __attribute__((nonnull(1), pure, warn_unused_result));
+kft_ipos_t kft_input_get_ipos(kft_input_t *pi)
+    __attribute__((nonnull(1), warn_unused_result));
 
 /* --------------------------------------------- *
  * Input Functions                               *
@@ -85,11 +115,85 @@ kft_ipos_t kft_input_get_ipos(const kft_input_t *pi)
 
 int kft_fgetc(kft_input_t *pi) __attribute__((nonnull(1), warn_unused_result));
 
+/**
+ * Get a run of plain characters
+ *
+ * The run ends before the next escape character, the first character of a
+ * delimiter or (when stop_on_eol is set) a newline, and is committed. Returns 0
+ * when the next character needs kft_fgetc().
+ *
+ * @param pi input
+ * @param pspan pointer to the run (valid until the next input operation)
+ * @param stop_on_eol end the run at newlines
+ * @return length of the run
+ */
+size_t kft_fspan(kft_input_t *pi, const char **pspan, bool stop_on_eol)
+    __attribute__((nonnull(1, 2), warn_unused_result));
+
+/**
+ * Get the file region behind a run returned by kft_fspan
+ *
+ * Only mapped files have one; the run can then be copied in the kernel.
+ *
+ * @param pi input
+ * @param span run returned by kft_fspan
+ * @param poffset file offset of the run (set when found)
+ * @return file descriptor, or -1 when the run is not backed by a file region
+ */
+int kft_input_get_span_fd(const kft_input_t *pi, const char *span,
+                          off_t *poffset)
+    __attribute__((nonnull(1, 2, 3), warn_unused_result));
+
+/**
+ * Read the directive of a block (just after the start delimiter)
+ *
+ * @param pi input
+ * @return directive character (one of KFT_OP_DIRECTIVES, consumed), or 0 for
+ * a nested template
+ */
+int kft_input_directive(kft_input_t *pi)
+    __attribute__((nonnull(1), warn_unused_result));
+
 kft_ioffset_t kft_ftell(kft_input_t *pi)
     __attribute__((nonnull(1), warn_unused_result));
 
 int kft_fseek(kft_input_t *pi, kft_ioffset_t offset)
     __attribute__((nonnull(1), warn_unused_result));
 
+/**
+ * Seek a compiled input to a source offset
+ *
+ * @param pi input (compiled)
+ * @param srcoff source offset (between tokens)
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+int kft_input_seek_srcoff(kft_input_t *pi, size_t srcoff)
+    __attribute__((nonnull(1), warn_unused_result));
+
+/**
+ * Keep the input from the oldest tag which can still be jumped to
+ *
+ * Called when tags are set or jumped to, so loops read from a stream which can
+ * not be repositioned (or are longer than the buffer) seek in the buffer.
+ *
+ * @param pi input
+ */
+void kft_input_retain_tags(kft_input_t *pi) __attribute__((nonnull(1)));
+
+/**
+ * Find a tag block which is not run yet
+ *
+ * The input is scanned for tag blocks at the first call, so tags ahead of the
+ * current position can be found. Only mapped files and memory inputs can be
+ * scanned.
+ *
+ * @param pi input
+ * @param key tag name
+ * @param pioff offset of the tag block (set when found)
+ * @return KFT_SUCCESS, or KFT_FAILURE if not found
+ */
+int kft_input_find_tag(kft_input_t *pi, const char *key, kft_ioffset_t *pioff)
+    __attribute__((nonnull(1, 2, 3), warn_unused_result));
+
 int kft_fetch_raw(kft_input_t *pi)
     __attribute__((nonnull(1), warn_unused_result));
\ No newline at end of file
@@ -1,4 +1,15 @@
 #include "kft_io_ispec.h"
+#include <string.h>
+
+kft_delim_t kft_delim_init(const char *str) {
+  size_t len = strlen(str);
+  size_t npacked = len < sizeof(uint64_t) ? len : sizeof(uint64_t);
+  uint64_t word = 0;
+  uint64_t mask = 0;
+  memcpy(&word, str, npacked);
+  memset(&mask, 0xff, npacked);
+  return (kft_delim_t){.str = str, .len = len, .word = word, .mask = mask};
+}
 
 kft_ispec_t kft_ispec_init(int ch_esc, const char *delim_st,
                            const char *delim_en) {
@@ -6,11 +17,37 @@ kft_ispec_t kft_ispec_init(int ch_esc, const char *delim_st,
       .ch_esc = ch_esc,
       .delim_st = delim_st,
       .delim_en = delim_en,
+      .match_st = kft_delim_init(delim_st),
+      .match_en = kft_delim_init(delim_en),
+      .scanset = kft_scanset_init(ch_esc, delim_st[0], delim_en[0], false),
+      .scanset_eol = kft_scanset_init(ch_esc, delim_st[0], delim_en[0], true),
+      .bufsize_max = KFT_OPTDEF_BUFFER_MAX,
   };
 }
 
+kft_ispec_t kft_ispec_with_bufsize_max(kft_ispec_t ispec, size_t bufsize_max) {
+  ispec.bufsize_max = bufsize_max;
+  return ispec;
+}
+
 int kft_ispec_get_ch_esc(kft_ispec_t ispec) { return ispec.ch_esc; }
 
 const char *kft_ispec_get_delim_st(kft_ispec_t ispec) { return ispec.delim_st; }
 
-const char *kft_ispec_get_delim_en(kft_ispec_t ispec) { return ispec.delim_en; }
\ No newline at end of file
+const char *kft_ispec_get_delim_en(kft_ispec_t ispec) { return ispec.delim_en; }
+
+size_t kft_ispec_get_bufsize_max(kft_ispec_t ispec) {
+  return ispec.bufsize_max;
+}
+
+kft_scanset_t kft_ispec_get_scanset(kft_ispec_t ispec, bool stop_on_eol) {
+  return stop_on_eol ? ispec.scanset_eol : ispec.scanset;
+}
+
+const kft_delim_t *kft_ispec_get_match_st(const kft_ispec_t *pispec) {
+  return &pispec->match_st;
+}
+
+const kft_delim_t *kft_ispec_get_match_en(const kft_ispec_t *pispec) {
+  return &pispec->match_en;
+}
\ No newline at end of file
@@ -1,12 +1,33 @@
 #pragma once
 
 #include "kft.h"
+#include "kft_io_scan.h"
+#include <stdint.h>
 
 /**
  * The input specification.
  */
 typedef struct kft_ispec kft_ispec_t;
 
+/**
+ * The compiled delimiter.
+ */
+typedef struct kft_delim kft_delim_t;
+
+/**
+ * The compiled delimiter.
+ */
+struct kft_delim {
+  /** delimiter */
+  const char *str;
+  /** length of delimiter */
+  size_t len;
+  /** first (up to) 8 bytes of delimiter packed in a word */
+  uint64_t word;
+  /** mask of the packed bytes */
+  uint64_t mask;
+};
+
 /**
  * The input specification.
  */
@@ -17,15 +38,31 @@ struct kft_ispec {
   const char *delim_st;
   /** end delimiter */
   const char *delim_en;
+  /** compiled start delimiter */
+  kft_delim_t match_st;
+  /** compiled end delimiter */
+  kft_delim_t match_en;
+  /** characters which terminate plain text */
+  kft_scanset_t scanset;
+  /** characters which terminate plain text (including newline) */
+  kft_scanset_t scanset_eol;
+  /** maximum size of the input buffer (lookahead window) */
+  size_t bufsize_max;
 };
 
 /* --------------------------------------------- *
  * Constructors and Destructors                  *
  * --------------------------------------------- */
 
+kft_delim_t kft_delim_init(const char *str)
+    __attribute__((nonnull(1), warn_unused_result, pure));
+
 kft_ispec_t kft_ispec_init(int ch_esc, const char *delim_st,
                            const char *delim_en)
-    __attribute__((nonnull(2, 3), warn_unused_result, const));
+    __attribute__((nonnull(2, 3), warn_unused_result, pure));
+
+kft_ispec_t kft_ispec_with_bufsize_max(kft_ispec_t ispec, size_t bufsize_max)
+    __attribute__((warn_unused_result, const));
 
 /* --------------------------------------------- *
  * Accessors                                     *
@@ -38,4 +75,46 @@ const char *kft_ispec_get_delim_st(kft_ispec_t ispec)
     __attribute__((warn_unused_result, const));
 
 const char *kft_ispec_get_delim_en(kft_ispec_t ispec)
-    __attribute__((warn_unused_result, const));
\ No newline at end of file
+    __attribute__((warn_unused_result, const));
+
+size_t kft_ispec_get_bufsize_max(kft_ispec_t ispec)
+    __attribute__((warn_unused_result, const));
+
+kft_scanset_t kft_ispec_get_scanset(kft_ispec_t ispec, bool stop_on_eol)
+    __attribute__((warn_unused_result, const));
+
+const kft_delim_t *kft_ispec_get_match_st(const kft_ispec_t *pispec)
+    __attribute__((nonnull(1), warn_unused_result, const, returns_nonnull));
+
+const kft_delim_t *kft_ispec_get_match_en(const kft_ispec_t *pispec)
+    __attribute__((nonnull(1), warn_unused_result, const, returns_nonnull));
+
+/* --------------------------------------------- *
+ * Matchers                                      *
+ * --------------------------------------------- */
+
+/**
+ * Test whether a buffer starts with the delimiter
+ *
+ * @param pdelim compiled delimiter
+ * @param ptr buffer
+ * @param len length of buffer
+ * @return true if the whole delimiter matches
+ */
+static inline bool kft_delim_match(const kft_delim_t *pdelim, const char *ptr,
+                                   size_t len) {
+  if (len < pdelim->len) {
+    return false;
+  }
+  if (len >= sizeof(uint64_t)) {
+    uint64_t word;
+    __builtin_memcpy(&word, ptr, sizeof(word));
+    if ((word & pdelim->mask) != pdelim->word) {
+      return false;
+    }
+    if (pdelim->len <= sizeof(uint64_t)) {
+      return true;
+    }
+  }
+  return __builtin_memcmp(ptr, pdelim->str, pdelim->len) == 0;
+}
@@ -1,11 +1,25 @@
 #include "kft_io_itags.h"
+#include "kft_hash.h"
 #include "kft_malloc.h"
-#include <search.h>
+#include <ctype.h>
+#include <stdint.h>
 #include <string.h>
 
+/** initial number of slots (power of 2) */
+#define KFT_ITAGS_NSLOTS 16
+
+/** maximum digits of the count of a tag */
+#define KFT_ITAGS_COUNT_DIGITS 9
+
 struct kft_itags {
-  void *root;
-  FILE *fp;
+  /** slots (open addressing, linear probing; NULL when empty) */
+  kft_input_tagent_t **slots;
+  /** number of slots (power of 2) */
+  size_t nslots;
+  /** number of used slots */
+  size_t nused;
+  /** the input is pre-scanned */
+  bool scanned;
 };
 
 /**
@@ -14,69 +28,213 @@ struct kft_itags {
 struct kft_input_tagent {
   /** key */
   char *key;
+  /** hash of key */
+  uint64_t hash;
+  /** the tag is set by running it */
+  bool set;
   /** offset */
   kft_ioffset_t ioff;
   /** count */
   int count;
   /** max count */
   int max_count;
+  /** the tag block is found by the pre-scan */
+  bool found;
+  /** offset of the tag block found by the pre-scan */
+  kft_ioffset_t ioff_found;
 };
 
-static kft_itags_t kft_itags_init(FILE *fp) {
-  return (kft_itags_t){.root = NULL, .fp = fp};
+static kft_itags_t kft_itags_init(void) {
+  return (kft_itags_t){
+      .slots = NULL, .nslots = 0, .nused = 0, .scanned = false};
 }
 
-kft_itags_t *kft_itags_new(FILE *fp) {
+kft_itags_t *kft_itags_new(void) {
   kft_itags_t *ptags = (kft_itags_t *)kft_malloc(sizeof(kft_itags_t));
-  *ptags = kft_itags_init(fp);
+  *ptags = kft_itags_init();
   return ptags;
 }
 
-static int kft_input_tagentcmp(const kft_input_tagent_t *ptag1,
-                               const kft_input_tagent_t *ptag2) {
-  return strcmp(ptag1->key, ptag2->key);
+/**
+ * Find the slot of a key
+ *
+ * @param ptags tags (with slots)
+ * @param key key
+ * @param len length of key
+ * @param hash hash of key
+ * @return slot (empty if the key is not in the table)
+ */
+static kft_input_tagent_t **kft_itags_find(const kft_itags_t *ptags,
+                                           const char *key, size_t len,
+                                           uint64_t hash) {
+  size_t mask = ptags->nslots - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    kft_input_tagent_t **pptagent = &ptags->slots[i];
+    if (*pptagent == NULL ||
+        ((*pptagent)->hash == hash &&
+         strncmp((*pptagent)->key, key, len) == 0 &&
+         (*pptagent)->key[len] == '\0')) {
+      return pptagent;
+    }
+  }
 }
 
-static void kft_input_tagentfree(kft_input_tagent_t *ptag) {
-  kft_free(ptag->key);
-  kft_free((void *)ptag);
+/**
+ * Get the entry of a key (added when not found)
+ *
+ * @param ptags tags
+ * @param key key
+ * @param len length of key
+ * @return entry
+ */
+static kft_input_tagent_t *kft_itags_entry(kft_itags_t *ptags, const char *key,
+                                           size_t len) {
+  uint64_t hash = kft_hash_key(key, len);
+  if (ptags->nslots != 0) {
+    kft_input_tagent_t **pptagent = kft_itags_find(ptags, key, len, hash);
+    if (*pptagent != NULL) {
+      return *pptagent;
+    }
+  }
+
+  // REBUILD THE TABLE WHEN IT IS HALF FULL
+  if ((ptags->nused + 1) * 2 > ptags->nslots) {
+    kft_input_tagent_t **slots_old = ptags->slots;
+    size_t nslots_old = ptags->nslots;
+    ptags->nslots = nslots_old == 0 ? KFT_ITAGS_NSLOTS : nslots_old * 2;
+    ptags->slots = (kft_input_tagent_t **)kft_malloc(
+        ptags->nslots * sizeof(kft_input_tagent_t *));
+    memset(ptags->slots, 0, ptags->nslots * sizeof(kft_input_tagent_t *));
+    size_t mask = ptags->nslots - 1;
+    for (size_t i = 0; i < nslots_old; i++) {
+      if (slots_old[i] == NULL) {
+        continue;
+      }
+      size_t j = slots_old[i]->hash & mask;
+      while (ptags->slots[j] != NULL) {
+        j = (j + 1) & mask;
+      }
+      ptags->slots[j] = slots_old[i];
+    }
+    if (slots_old != NULL) {
+      kft_free(slots_old);
+    }
+  }
+
+  kft_input_tagent_t *ptagent =
+      (kft_input_tagent_t *)kft_malloc(sizeof(kft_input_tagent_t));
+  char *key_new = (char *)kft_malloc_atomic(len + 1);
+  memcpy(key_new, key, len);
+  key_new[len] = '\0';
+  *ptagent = (kft_input_tagent_t){
+      .key = key_new,
+      .hash = hash,
+      .set = false,
+      .count = 0,
+      .max_count = 0,
+      .found = false,
+  };
+  *kft_itags_find(ptags, key, len, hash) = ptagent;
+  ptags->nused++;
+  return ptagent;
 }
 
 int kft_itags_set(kft_itags_t *ptags, const char *key, kft_input_t *pi,
                   int max_count) {
-  kft_ioffset_t ioff = kft_ftell(pi);
-  kft_input_tagent_t keyent = {
-      .key = (char *)key, .ioff = ioff, .count = 0, .max_count = 0};
-  kft_input_tagent_t **pptagent = (kft_input_tagent_t **)tsearch(
-      (void *)&keyent, &ptags->root,
-      (int (*)(const void *, const void *))kft_input_tagentcmp);
-  if (*pptagent == &keyent) {
-    *pptagent = (kft_input_tagent_t *)kft_malloc(sizeof(kft_input_tagent_t));
-    (*pptagent)->key = kft_strdup(key);
-  }
-  (*pptagent)->ioff = ioff;
-  (*pptagent)->count = 0;
-  (*pptagent)->max_count = max_count;
+  kft_input_tagent_t *ptagent = kft_itags_entry(ptags, key, strlen(key));
+  ptagent->set = true;
+  ptagent->ioff = kft_ftell(pi);
+  ptagent->count = 0;
+  ptagent->max_count = max_count;
   return KFT_SUCCESS;
 }
 
 kft_input_tagent_t *kft_itags_get(const kft_itags_t *ptags, const char *key) {
-  kft_input_tagent_t keyent = {
-      .key = (char *)key,
-      .ioff = (kft_ioffset_t){.ipos = {NULL, 0, 0}, .offset = 0},
-      .count = 0,
-      .max_count = 0};
-  kft_input_tagent_t **pptagent = (kft_input_tagent_t **)tfind(
-      (void *)&keyent, &ptags->root,
-      (int (*)(const void *, const void *))kft_input_tagentcmp);
-  if (pptagent == NULL) {
+  if (ptags->nslots == 0) {
     return NULL;
   }
-  return *pptagent;
+  size_t len = strlen(key);
+  kft_input_tagent_t *ptagent =
+      *kft_itags_find(ptags, key, len, kft_hash_key(key, len));
+  if (ptagent == NULL || !ptagent->set) {
+    return NULL;
+  }
+  return ptagent;
+}
+
+void kft_itags_add_found(kft_itags_t *ptags, const char *key, size_t len,
+                         kft_ioffset_t ioff) {
+  kft_input_tagent_t *ptagent = kft_itags_entry(ptags, key, len);
+  // THE FIRST TAG BLOCK IN THE INPUT WINS
+  if (!ptagent->found) {
+    ptagent->found = true;
+    ptagent->ioff_found = ioff;
+  }
 }
 
+const kft_ioffset_t *kft_itags_get_found(const kft_itags_t *ptags,
+                                         const char *key) {
+  if (ptags->nslots == 0) {
+    return NULL;
+  }
+  size_t len = strlen(key);
+  kft_input_tagent_t *ptagent =
+      *kft_itags_find(ptags, key, len, kft_hash_key(key, len));
+  if (ptagent == NULL || !ptagent->found) {
+    return NULL;
+  }
+  return &ptagent->ioff_found;
+}
+
+const kft_ioffset_t *kft_itags_get_oldest_live(const kft_itags_t *ptags) {
+  const kft_ioffset_t *pioff = NULL;
+  for (size_t i = 0; i < ptags->nslots; i++) {
+    const kft_input_tagent_t *ptagent = ptags->slots[i];
+    if (ptagent != NULL && ptagent->set &&
+        ptagent->count < ptagent->max_count &&
+        (pioff == NULL || ptagent->ioff.offset < pioff->offset)) {
+      pioff = &ptagent->ioff;
+    }
+  }
+  return pioff;
+}
+
+size_t kft_itags_parse_key(const char *key, size_t len, int *pmax_count) {
+  *pmax_count = 1;
+  const char *eq = memrchr(key, '=', len);
+  if (eq == NULL) {
+    return len;
+  }
+  size_t ndigits = len - (eq - key) - 1;
+  if (ndigits == 0 || ndigits > KFT_ITAGS_COUNT_DIGITS) {
+    return len;
+  }
+  // THE KEY IS NOT TERMINATED (A SLICE OF THE INPUT BUFFER)
+  int max_count = 0;
+  for (size_t i = 0; i < ndigits; i++) {
+    if (!isdigit((unsigned char)eq[1 + i])) {
+      return len;
+    }
+    max_count = max_count * 10 + (eq[1 + i] - '0');
+  }
+  *pmax_count = max_count;
+  return eq - key;
+}
+
+bool kft_itags_is_scanned(const kft_itags_t *ptags) { return ptags->scanned; }
+
+void kft_itags_set_scanned(kft_itags_t *ptags) { ptags->scanned = true; }
+
 static void kft_itags_destroy(kft_itags_t tags) {
-  tdestroy(&tags.root, (void (*)(void *))kft_input_tagentfree);
+  for (size_t i = 0; i < tags.nslots; i++) {
+    if (tags.slots[i] != NULL) {
+      kft_free(tags.slots[i]->key);
+      kft_free(tags.slots[i]);
+    }
+  }
+  if (tags.slots != NULL) {
+    kft_free(tags.slots);
+  }
 }
 
 void kft_itags_delete(kft_itags_t *ptags) {
@@ -8,8 +8,8 @@ typedef struct kft_itags kft_itags_t;
 #include "kft_io.h"
 #include "kft_io_input.h"
 
-kft_itags_t *kft_itags_new(FILE *fp)
-    __attribute__((warn_unused_result, malloc, returns_nonnull, nonnull(1)));
+kft_itags_t *kft_itags_new(void)
+    __attribute__((warn_unused_result, malloc, returns_nonnull));
 
 void kft_itags_delete(kft_itags_t *ptags) __attribute__((nonnull(1)));
 
@@ -20,6 +20,53 @@ int kft_itags_set(kft_itags_t *ptags, const char *key, kft_input_t *pi,
 kft_input_tagent_t *kft_itags_get(const kft_itags_t *ptags, const char *key)
     __attribute__((nonnull(1, 2), warn_unused_result, pure));
 
+/**
+ * Add a tag block found by the pre-scan (the first one of a key is kept)
+ *
+ * @param ptags tags
+ * @param key key
+ * @param len length of key
+ * @param ioff offset of the tag block
+ */
+void kft_itags_add_found(kft_itags_t *ptags, const char *key, size_t len,
+                         kft_ioffset_t ioff) __attribute__((nonnull(1, 2)));
+
+/**
+ * Get a tag block found by the pre-scan
+ *
+ * @param ptags tags
+ * @param key key
+ * @return offset of the tag block, or NULL if not found
+ */
+const kft_ioffset_t *kft_itags_get_found(const kft_itags_t *ptags,
+                                         const char *key)
+    __attribute__((nonnull(1, 2), warn_unused_result, pure));
+
+/**
+ * Get the oldest tag which can still be jumped to
+ *
+ * @param ptags tags
+ * @return offset of the tag, or NULL if none
+ */
+const kft_ioffset_t *kft_itags_get_oldest_live(const kft_itags_t *ptags)
+    __attribute__((nonnull(1), warn_unused_result, pure));
+
+/**
+ * Split the count from the text of a tag block ("TAG" or "TAG=COUNT")
+ *
+ * @param key text of the tag block
+ * @param len length of text
+ * @param pmax_count count (1 when not given)
+ * @return length of the tag name
+ */
+size_t kft_itags_parse_key(const char *key, size_t len, int *pmax_count)
+    __attribute__((nonnull(1, 3), warn_unused_result));
+
+bool kft_itags_is_scanned(const kft_itags_t *ptags)
+    __attribute__((nonnull(1), warn_unused_result, pure));
+
+void kft_itags_set_scanned(kft_itags_t *ptags) __attribute__((nonnull(1)));
+
 size_t kft_input_tagent_get_count(const kft_input_tagent_t *ptagent)
     __attribute__((nonnull(1), warn_unused_result, pure));
 
@@ -3,50 +3,382 @@
 #include "kft_io.h"
 #include "kft_malloc.h"
 #include <assert.h>
+#include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #define KFT_OUTPUT_MODE_STREAM_OPENED 1
 #define KFT_OUTPUT_MODE_MALLOC_FILENAME 2
-#define KFT_OUTPUT_MODE_MALLOC_MEMBUF 4
+#define KFT_OUTPUT_MODE_MEMORY 4
+#define KFT_OUTPUT_MODE_CLOSED 8
+#define KFT_OUTPUT_MODE_FD_OPENED 16
+
+/** size of inline storage of memory outputs */
+#define KFT_OUTPUT_INLINE_SIZE 128
+
+/** maximum heap buffer kept by a pooled memory output */
+#define KFT_OUTPUT_POOL_BUFSIZE_MAX 65536
+
+/** maximum number of pooled memory outputs per thread */
+#define KFT_OUTPUT_POOL_MAX 16
+
+/** minimum length of file region copied by the kernel */
+#define KFT_OUTPUT_SENDFILE_MIN 16384
+
+/**
+ * The output slot (part of an output filled later, in order)
+ */
+typedef struct kft_output_slot kft_output_slot_t;
+
+struct kft_output_slot {
+  /** memory output holding the contents */
+  kft_output_t *po;
+  /** contents complete */
+  bool done;
+  /** next slot */
+  kft_output_slot_t *pnext;
+};
 
 struct kft_output {
   int mode;
   FILE *fp;
-  // TODO: use kft_memstream?
-  kft_output_mem_t *pmembuf;
   const char *filename;
+  /** memory buffer (inline storage or malloc'd) */
+  char *mbuf;
+  /** length of data in memory buffer */
+  size_t mlen;
+  /** capacity of memory buffer */
+  size_t mcap;
+  /** file descriptor written directly (-1 when written through fp) */
+  int fd;
+  /** write-combining buffer */
+  char *wbuf;
+  /** size of write-combining buffer (0 for unbuffered) */
+  size_t wbufsize;
+  /** length of pending data in write-combining buffer */
+  size_t wbuflen;
+  /** flush at each newline (terminal) */
+  bool linebuf;
+  /** number of other threads writing to this output */
+  int nshared;
+  /** lock (used only while shared) */
+  pthread_mutex_t lock;
+  /** previous live output with fd */
+  kft_output_t *pprev;
+  /** next live output with fd (or next pooled memory output) */
+  kft_output_t *pnext;
+  /** first pending slot (writes go to slots while any is pending) */
+  kft_output_slot_t *pslot_head;
+  /** last pending slot */
+  kft_output_slot_t *pslot_tail;
+  /** inline storage of memory buffer */
+  char minline[KFT_OUTPUT_INLINE_SIZE];
 };
 
+/** size of write-combining buffer for new outputs */
+static size_t kft_output_bufsize = KFT_OPTDEF_WRITE_BUFFER;
+
+/** live outputs with fd (flushed at exit) */
+static kft_output_t *kft_output_live = NULL;
+
+/** lock of live outputs */
+static pthread_mutex_t kft_output_live_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** register flush at exit only once */
+static pthread_once_t kft_output_atexit_once = PTHREAD_ONCE_INIT;
+
+/** pooled memory outputs of this thread */
+static __thread kft_output_t *kft_output_pool = NULL;
+
+/** number of pooled memory outputs of this thread */
+static __thread size_t kft_output_npool = 0;
+
+/** key to release pooled memory outputs at thread exit */
+static pthread_key_t kft_output_pool_key;
+
+/** create kft_output_pool_key only once */
+static pthread_once_t kft_output_pool_once = PTHREAD_ONCE_INIT;
+
+void kft_output_set_bufsize(size_t bufsize) { kft_output_bufsize = bufsize; }
+
+/**
+ * Write all io vectors to a file descriptor
+ *
+ * @param fd file descriptor
+ * @param iov io vectors (modified)
+ * @param iovcnt number of io vectors
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_writev_all(int fd, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t ret = writev(fd, iov, iovcnt);
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return KFT_FAILURE;
+    }
+    size_t len = (size_t)ret;
+    while (iovcnt > 0 && len >= iov->iov_len) {
+      len -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + len;
+      iov->iov_len -= len;
+    }
+  }
+  return KFT_SUCCESS;
+}
+
+/**
+ * Write the pending data followed by extra data in one system call
+ *
+ * @param po output (fd)
+ * @param ptr extra data
+ * @param len length of extra data
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_output_drain(kft_output_t *po, const void *ptr, size_t len) {
+  if (po->wbuflen == 0 && len == 0) {
+    return KFT_SUCCESS;
+  }
+  struct iovec iov[2] = {
+      {.iov_base = po->wbuf, .iov_len = po->wbuflen},
+      {.iov_base = (void *)ptr, .iov_len = len},
+  };
+  po->wbuflen = 0;
+  return kft_writev_all(po->fd, iov, 2);
+}
+
+static inline void kft_output_lock(kft_output_t *po) {
+  if (po->nshared > 0) {
+    pthread_mutex_lock(&po->lock);
+  }
+}
+
+static inline void kft_output_unlock(kft_output_t *po) {
+  if (po->nshared > 0) {
+    pthread_mutex_unlock(&po->lock);
+  }
+}
+
+static void kft_output_flush_all(void) {
+  pthread_mutex_lock(&kft_output_live_lock);
+  for (kft_output_t *po = kft_output_live; po != NULL; po = po->pnext) {
+    kft_output_lock(po);
+    kft_output_drain(po, NULL, 0);
+    kft_output_unlock(po);
+  }
+  pthread_mutex_unlock(&kft_output_live_lock);
+}
+
+static void kft_output_register_atexit(void) {
+  atexit(kft_output_flush_all);
+}
+
+/**
+ * Initialize an output which writes to a file descriptor
+ *
+ * Falls back to the stream itself when it has no descriptor.
+ *
+ * @param po output (fp is set, unless fd is given)
+ * @param fd file descriptor (-1 for the descriptor of the stream)
+ */
+static void kft_output_init_fd(kft_output_t *po, int fd) {
+  po->fd = -1;
+  po->wbuf = NULL;
+  po->wbufsize = 0;
+  po->wbuflen = 0;
+  po->linebuf = false;
+  po->nshared = 0;
+  pthread_mutex_init(&po->lock, NULL);
+  po->pprev = NULL;
+  po->pnext = NULL;
+
+  if (po->fp != NULL) {
+    fd = fileno(po->fp);
+    if (fd < 0) {
+      return;
+    }
+    // PENDING DATA IN THE STREAM GOES FIRST
+    fflush(po->fp);
+  }
+  po->fd = fd;
+  po->wbufsize = kft_output_bufsize;
+  if (po->wbufsize > 0) {
+    po->wbuf = (char *)kft_malloc_atomic(po->wbufsize);
+  }
+  po->linebuf = isatty(fd);
+
+  pthread_once(&kft_output_atexit_once, kft_output_register_atexit);
+  pthread_mutex_lock(&kft_output_live_lock);
+  po->pnext = kft_output_live;
+  if (kft_output_live != NULL) {
+    kft_output_live->pprev = po;
+  }
+  kft_output_live = po;
+  pthread_mutex_unlock(&kft_output_live_lock);
+}
+
+/**
+ * Unregister an output from live outputs
+ *
+ * @param po output
+ */
+static void kft_output_unlink(kft_output_t *po) {
+  if (po->fd < 0) {
+    return;
+  }
+  pthread_mutex_lock(&kft_output_live_lock);
+  if (po->pprev != NULL) {
+    po->pprev->pnext = po->pnext;
+  } else {
+    kft_output_live = po->pnext;
+  }
+  if (po->pnext != NULL) {
+    po->pnext->pprev = po->pprev;
+  }
+  pthread_mutex_unlock(&kft_output_live_lock);
+  po->pprev = NULL;
+  po->pnext = NULL;
+}
+
+/**
+ * Release a memory output
+ *
+ * @param po memory output
+ */
+static void kft_output_free_mem(kft_output_t *po) {
+  if (po->mbuf != po->minline) {
+    free(po->mbuf);
+  }
+  pthread_mutex_destroy(&po->lock);
+  free(po);
+}
+
+static void kft_output_pool_release(void *data) {
+  (void)data;
+  while (kft_output_pool != NULL) {
+    kft_output_t *po = kft_output_pool;
+    kft_output_pool = po->pnext;
+    kft_output_free_mem(po);
+  }
+  kft_output_npool = 0;
+}
+
+static void kft_output_pool_init(void) {
+  pthread_key_create(&kft_output_pool_key, kft_output_pool_release);
+}
+
 kft_output_t *kft_output_new_mem(void) {
-  // OPEN MEMORY STREAM
-  kft_output_mem_t *pmembuf =
-      (kft_output_mem_t *)kft_malloc(sizeof(kft_output_mem_t));
-  pmembuf->membuf = NULL;
-  pmembuf->membufsize = 0;
-  FILE *fp = open_memstream(&pmembuf->membuf, &pmembuf->membufsize);
-  if (fp == NULL) {
-    kft_error("%s: %m\n", "open_memstream");
+  // REUSE POOLED MEMORY OUTPUT
+  kft_output_t *po = kft_output_pool;
+  if (po != NULL) {
+    kft_output_pool = po->pnext;
+    kft_output_npool--;
+  } else {
+    // NOT IN THE GC HEAP, SO THAT THE THREAD-LOCAL POOL NEED NOT BE SCANNED
+    po = (kft_output_t *)malloc(sizeof(kft_output_t));
+    if (po == NULL) {
+      kft_error("%s: %m\n", "malloc");
+    }
+    po->mbuf = po->minline;
+    po->mcap = sizeof(po->minline);
+    pthread_mutex_init(&po->lock, NULL);
   }
-  int mode = KFT_OUTPUT_MODE_MALLOC_MEMBUF | KFT_OUTPUT_MODE_STREAM_OPENED;
-  kft_output_t *po = (kft_output_t *)kft_malloc(sizeof(kft_output_t));
-  po->mode = mode;
-  po->fp = fp;
-  po->pmembuf = pmembuf;
+  po->mode = KFT_OUTPUT_MODE_MEMORY;
+  po->fp = NULL;
   po->filename = "<inline>";
+  po->mlen = 0;
+  po->fd = -1;
+  po->wbuf = NULL;
+  po->wbufsize = 0;
+  po->wbuflen = 0;
+  po->linebuf = false;
+  po->nshared = 0;
+  po->pprev = NULL;
+  po->pnext = NULL;
+  po->pslot_head = NULL;
+  po->pslot_tail = NULL;
   return po;
 }
 
+/**
+ * Return a memory output to the pool of this thread
+ *
+ * @param po memory output
+ */
+static void kft_output_delete_mem(kft_output_t *po) {
+  if (kft_output_npool >= KFT_OUTPUT_POOL_MAX) {
+    kft_output_free_mem(po);
+    return;
+  }
+  if (po->mcap > KFT_OUTPUT_POOL_BUFSIZE_MAX) {
+    free(po->mbuf);
+    po->mbuf = po->minline;
+    po->mcap = sizeof(po->minline);
+  }
+  pthread_once(&kft_output_pool_once, kft_output_pool_init);
+  if (kft_output_pool == NULL) {
+    pthread_setspecific(kft_output_pool_key, &kft_output_pool);
+  }
+  po->pnext = kft_output_pool;
+  kft_output_pool = po;
+  kft_output_npool++;
+}
+
+/**
+ * Append data to a memory output
+ *
+ * @param po memory output
+ * @param ptr data
+ * @param len length of data
+ */
+static void kft_output_append_mem(kft_output_t *po, const void *ptr,
+                                  size_t len) {
+  if (po->mcap - po->mlen <= len) {
+    // GROW (KEEP ROOM FOR THE TERMINATOR)
+    size_t mcap = po->mcap * 2;
+    while (mcap - po->mlen <= len) {
+      mcap *= 2;
+    }
+    char *mbuf;
+    if (po->mbuf == po->minline) {
+      mbuf = (char *)malloc(mcap);
+      if (mbuf != NULL) {
+        memcpy(mbuf, po->mbuf, po->mlen);
+      }
+    } else {
+      mbuf = (char *)realloc(po->mbuf, mcap);
+    }
+    if (mbuf == NULL) {
+      kft_error("%s: %m\n", "malloc");
+    }
+    po->mbuf = mbuf;
+    po->mcap = mcap;
+  }
+  memcpy(po->mbuf + po->mlen, ptr, len);
+  po->mlen += len;
+}
+
 kft_output_t *kft_output_new_open(const char *filename) {
   FILE *fp = fopen(filename, "w");
   if (fp == NULL) {
     kft_error("%s: %m\n", filename);
   }
   kft_output_t *po = (kft_output_t *)kft_malloc(sizeof(kft_output_t));
-  po->mode = KFT_OUTPUT_MODE_STREAM_OPENED;
-  po->fp = fp;
-  po->pmembuf = NULL;
-  po->filename = filename;
+  *po = (kft_output_t){
+      .mode = KFT_OUTPUT_MODE_STREAM_OPENED,
+      .fp = fp,
+      .filename = filename,
+  };
+  kft_output_init_fd(po, -1);
   return po;
 }
 
@@ -65,50 +397,269 @@ kft_output_t *kft_output_new(FILE *fp, const char *filename) {
   *po = (kft_output_t){
       .mode = mode,
       .fp = fp,
-      .pmembuf = NULL,
       .filename = filename,
   };
+  kft_output_init_fd(po, -1);
   return po;
 }
 
-void kft_output_flush(kft_output_t *po) { fflush(po->fp); }
+kft_output_t *kft_output_new_fd(int fd, const char *filename) {
+  kft_output_t *po = (kft_output_t *)kft_malloc(sizeof(kft_output_t));
+  *po = (kft_output_t){
+      .mode = KFT_OUTPUT_MODE_FD_OPENED,
+      .fp = NULL,
+      .filename = filename,
+  };
+  kft_output_init_fd(po, fd);
+  return po;
+}
 
-void kft_output_rewind(kft_output_t *po) { rewind(po->fp); }
+void kft_output_flush(kft_output_t *po) {
+  kft_output_lock(po);
+  if (po->fd >= 0) {
+    kft_output_drain(po, NULL, 0);
+  } else if (po->fp != NULL) {
+    fflush(po->fp);
+  }
+  kft_output_unlock(po);
+}
+
+void kft_output_rewind(kft_output_t *po) {
+  kft_output_flush(po);
+  if (po->mode & KFT_OUTPUT_MODE_MEMORY) {
+    po->mlen = 0;
+  } else if (po->fp != NULL) {
+    rewind(po->fp);
+  } else {
+    lseek(po->fd, 0, SEEK_SET);
+  }
+}
 
 void kft_output_close(kft_output_t *po) {
+  if (po->mode & KFT_OUTPUT_MODE_CLOSED) {
+    return;
+  }
+  assert(po->pslot_head == NULL);
+  kft_output_flush(po);
+  kft_output_unlink(po);
   if (po->mode & KFT_OUTPUT_MODE_STREAM_OPENED) {
     fclose(po->fp);
   }
-  po->mode &= ~KFT_OUTPUT_MODE_STREAM_OPENED;
+  if (po->mode & KFT_OUTPUT_MODE_FD_OPENED) {
+    close(po->fd);
+  }
+  po->mode &= ~(KFT_OUTPUT_MODE_STREAM_OPENED | KFT_OUTPUT_MODE_FD_OPENED);
+  po->mode |= KFT_OUTPUT_MODE_CLOSED;
 }
 
 void kft_output_delete(kft_output_t *po) {
-  if (po->mode & KFT_OUTPUT_MODE_STREAM_OPENED) {
-    fclose(po->fp);
+  if (po->mode & KFT_OUTPUT_MODE_MEMORY) {
+    kft_output_delete_mem(po);
+    return;
   }
+  kft_output_close(po);
   if (po->mode & KFT_OUTPUT_MODE_MALLOC_FILENAME) {
     kft_free((char *)po->filename);
   }
-  if (po->mode & KFT_OUTPUT_MODE_MALLOC_MEMBUF) {
-    free(po->pmembuf->membuf); // allocate by memstream
-    kft_free(po->pmembuf);
+  if (po->wbuf != NULL) {
+    kft_free(po->wbuf);
   }
+  pthread_mutex_destroy(&po->lock);
 }
 
-int kft_fputc(int ch, kft_output_t *po) {
-  int ret = fputc(ch, po->fp);
+void kft_output_share(kft_output_t *po) { po->nshared++; }
+
+void kft_output_unshare(kft_output_t *po) {
+  assert(po->nshared > 0);
+  po->nshared--;
+}
+
+/**
+ * Write data to the output itself (lock is held when shared)
+ *
+ * @param ptr data
+ * @param len length of data
+ * @param po output
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_write_sink(const void *ptr, size_t len, kft_output_t *po) {
+  if (po->mode & KFT_OUTPUT_MODE_MEMORY) {
+    kft_output_append_mem(po, ptr, len);
+    return KFT_SUCCESS;
+  }
+  if (po->fd < 0) {
+    return fwrite_unlocked(ptr, 1, len, po->fp) == len ? KFT_SUCCESS
+                                                      : KFT_FAILURE;
+  }
+  if (len <= po->wbufsize - po->wbuflen) {
+    // COMBINE INTO BUFFER
+    memcpy(po->wbuf + po->wbuflen, ptr, len);
+    po->wbuflen += len;
+    if (po->linebuf && memchr(ptr, '\n', len) != NULL) {
+      return kft_output_drain(po, NULL, 0);
+    }
+    return KFT_SUCCESS;
+  }
+  // PENDING DATA AND NEW DATA IN ONE SYSTEM CALL
+  return kft_output_drain(po, ptr, len);
+}
+
+/**
+ * Append a slot (lock is held when shared)
+ *
+ * @param po output
+ * @param done contents complete (written directly)
+ * @return slot
+ */
+static kft_output_slot_t *kft_output_slot_append(kft_output_t *po, bool done) {
+  kft_output_slot_t *pslot =
+      (kft_output_slot_t *)kft_malloc(sizeof(kft_output_slot_t));
+  pslot->po = kft_output_new_mem();
+  pslot->done = done;
+  pslot->pnext = NULL;
+  if (po->pslot_tail != NULL) {
+    po->pslot_tail->pnext = pslot;
+  } else {
+    po->pslot_head = pslot;
+  }
+  po->pslot_tail = pslot;
+  return pslot;
+}
+
+/**
+ * Write data (lock is held when shared)
+ *
+ * While slots are pending, data goes to the last slot which is written
+ * directly.
+ *
+ * @param ptr data
+ * @param len length of data
+ * @param po output
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_write_locked(const void *ptr, size_t len, kft_output_t *po) {
+  if (po->pslot_head != NULL) {
+    kft_output_slot_t *pslot = po->pslot_tail;
+    if (!pslot->done) {
+      pslot = kft_output_slot_append(po, true);
+    }
+    kft_output_append_mem(pslot->po, ptr, len);
+    return KFT_SUCCESS;
+  }
+  return kft_write_sink(ptr, len, po);
+}
+
+kft_output_t *kft_output_slot_new(kft_output_t *po) {
+  kft_output_lock(po);
+  kft_output_slot_t *pslot = kft_output_slot_append(po, false);
+  kft_output_unlock(po);
+  return pslot->po;
+}
+
+int kft_output_slot_done(kft_output_t *po, kft_output_t *po_slot) {
+  kft_output_lock(po);
+  for (kft_output_slot_t *pslot = po->pslot_head; pslot != NULL;
+       pslot = pslot->pnext) {
+    if (pslot->po == po_slot) {
+      pslot->done = true;
+      break;
+    }
+  }
+
+  // WRITE COMPLETE SLOTS IN ORDER
+  int ret = KFT_SUCCESS;
+  while (po->pslot_head != NULL && po->pslot_head->done) {
+    kft_output_slot_t *pslot = po->pslot_head;
+    size_t len = kft_output_get_size(pslot->po);
+    if (len > 0 && kft_write_sink(kft_output_get_data(pslot->po), len, po) !=
+                       KFT_SUCCESS) {
+      ret = KFT_FAILURE;
+    }
+    kft_output_delete(pslot->po);
+    po->pslot_head = pslot->pnext;
+    if (po->pslot_head == NULL) {
+      po->pslot_tail = NULL;
+    }
+    kft_free(pslot);
+  }
+  kft_output_unlock(po);
   return ret;
 }
 
+bool kft_output_is_mem(const kft_output_t *po) {
+  return (po->mode & KFT_OUTPUT_MODE_MEMORY) != 0;
+}
+
+int kft_fputc(int ch, kft_output_t *po) {
+  if (po->nshared == 0 && po->pslot_head == NULL) {
+    // FAST PATH (NOT SHARED)
+    if (po->mode & KFT_OUTPUT_MODE_MEMORY) {
+      if (po->mlen + 1 < po->mcap) {
+        po->mbuf[po->mlen++] = (char)ch;
+        return (unsigned char)ch;
+      }
+    } else if (po->fd < 0) {
+      return fputc_unlocked(ch, po->fp);
+    }
+    if (po->wbuflen < po->wbufsize && !(po->linebuf && ch == '\n')) {
+      po->wbuf[po->wbuflen++] = (char)ch;
+      return (unsigned char)ch;
+    }
+  }
+  char c = (char)ch;
+  kft_output_lock(po);
+  int ret = kft_write_locked(&c, 1, po);
+  kft_output_unlock(po);
+  return ret == KFT_SUCCESS ? (unsigned char)ch : EOF;
+}
+
 void *kft_output_get_data(kft_output_t *po) {
-  assert(po->mode & KFT_OUTPUT_MODE_MALLOC_MEMBUF);
-  return po->pmembuf->membuf;
+  assert(po->mode & KFT_OUTPUT_MODE_MEMORY);
+  po->mbuf[po->mlen] = '\0';
+  return po->mbuf;
+}
+
+size_t kft_output_get_size(const kft_output_t *po) {
+  assert(po->mode & KFT_OUTPUT_MODE_MEMORY);
+  return po->mlen;
 }
 
 size_t kft_write(const void *ptr, size_t size, size_t nmemb, kft_output_t *po) {
-  return fwrite(ptr, size, nmemb, po->fp);
+  if (size == 0 || nmemb == 0) {
+    return 0;
+  }
+  kft_output_lock(po);
+  int ret = kft_write_locked(ptr, size * nmemb, po);
+  kft_output_unlock(po);
+  return ret == KFT_SUCCESS ? nmemb : 0;
+}
+
+size_t kft_write_file(const void *ptr, size_t len, int fd_in, off_t offset,
+                      kft_output_t *po) {
+  if (fd_in < 0 || po->fd < 0 || po->pslot_head != NULL ||
+      len < KFT_OUTPUT_SENDFILE_MIN || len <= po->wbufsize - po->wbuflen) {
+    return kft_write(ptr, 1, len, po);
+  }
+  kft_output_lock(po);
+  int ret = kft_output_drain(po, NULL, 0);
+  size_t done = 0;
+  while (ret == KFT_SUCCESS && done < len) {
+    ssize_t n = sendfile(po->fd, fd_in, &offset, len - done);
+    if (n > 0) {
+      done += (size_t)n;
+      continue;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    // NO KERNEL COPY TO THIS OUTPUT (WRITE THE REST AT ONCE)
+    ret = kft_output_drain(po, (const char *)ptr + done, len - done);
+    done = len;
+  }
+  kft_output_unlock(po);
+  return ret == KFT_SUCCESS ? len : 0;
 }
 
 const char *kft_output_get_filename(const kft_output_t *po) {
   return po->filename;
-}
\ No newline at end of file
+}
@@ -2,11 +2,7 @@
 
 #include "kft.h"
 #include <stdio.h>
-
-typedef struct kft_output_mem {
-  char *membuf;
-  size_t membufsize;
-} kft_output_mem_t;
+#include <sys/types.h>
 
 typedef struct kft_output kft_output_t;
 
@@ -14,11 +10,28 @@ kft_output_t *kft_output_new(FILE *fp, const char *filename)
     __attribute__((warn_unused_result, malloc, returns_nonnull, nonnull(1)));
 
 kft_output_t *kft_output_new_mem(void)
-    __attribute__((warn_unused_result, malloc, returns_nonnull));
+    __attribute__((warn_unused_result, returns_nonnull));
 
 kft_output_t *kft_output_new_open(const char *filename)
     __attribute__((warn_unused_result, malloc, returns_nonnull, nonnull(1)));
 
+/**
+ * Create an output writing a file descriptor (without a stream)
+ *
+ * @param fd file descriptor (closed with the output)
+ * @param filename filename (used in messages)
+ * @return output
+ */
+kft_output_t *kft_output_new_fd(int fd, const char *filename)
+    __attribute__((warn_unused_result, malloc, returns_nonnull, nonnull(2)));
+
+/**
+ * Set the size of the write-combining buffer for outputs created later
+ *
+ * @param bufsize buffer size (0 for unbuffered)
+ */
+void kft_output_set_bufsize(size_t bufsize);
+
 void kft_output_flush(kft_output_t *po);
 
 void kft_output_rewind(kft_output_t *po);
@@ -27,6 +40,57 @@ void kft_output_close(kft_output_t *po);
 
 void kft_output_delete(kft_output_t *po);
 
+/**
+ * Mark the output as written by one more thread
+ *
+ * Writes take the output lock until kft_output_unshare is called.
+ * Call before the other thread is started.
+ *
+ * @param po output
+ */
+void kft_output_share(kft_output_t *po) __attribute__((nonnull(1)));
+
+/**
+ * Unmark the output marked by kft_output_share
+ *
+ * Call after the other thread is joined.
+ *
+ * @param po output
+ */
+void kft_output_unshare(kft_output_t *po) __attribute__((nonnull(1)));
+
+/**
+ * Reserve a slot at the current end of the output
+ *
+ * Until the slot is done, later writes to the output are kept after it.
+ *
+ * @param po output
+ * @return memory output to fill the slot
+ */
+kft_output_t *kft_output_slot_new(kft_output_t *po)
+    __attribute__((nonnull(1), warn_unused_result, returns_nonnull));
+
+/**
+ * Complete a slot and write out the slots complete so far in order
+ *
+ * The memory output of the slot is deleted when written out.
+ *
+ * @param po output
+ * @param po_slot memory output returned by kft_output_slot_new
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+int kft_output_slot_done(kft_output_t *po, kft_output_t *po_slot)
+    __attribute__((nonnull(1, 2)));
+
+/**
+ * Test whether the output is a memory output
+ *
+ * @param po output
+ * @return true if a memory output
+ */
+bool kft_output_is_mem(const kft_output_t *po)
+    __attribute__((nonnull(1), pure, warn_unused_result));
+
 int kft_fputc(int ch, kft_output_t *po);
 
 const char *kft_output_get_filename(const kft_output_t *po);
@@ -35,4 +99,38 @@ FILE *kft_output_get_stream(const kft_output_t *po);
 
 size_t kft_write(const void *ptr, size_t size, size_t nmemb, kft_output_t *po);
 
-void *kft_output_get_data(kft_output_t *po);
\ No newline at end of file
+/**
+ * Write data which is also a region of a file
+ *
+ * Large regions are copied by the kernel (sendfile) when the output has a
+ * file descriptor; otherwise the data is written as kft_write does.
+ *
+ * @param ptr data
+ * @param len length of data
+ * @param fd_in file descriptor holding the data (-1 if none)
+ * @param offset offset of the data in fd_in
+ * @param po output
+ * @return len on success, 0 on failure
+ */
+size_t kft_write_file(const void *ptr, size_t len, int fd_in, off_t offset,
+                      kft_output_t *po);
+
+/**
+ * Get the data written to a memory output
+ *
+ * The data is terminated by NUL and valid until the next write, rewind or
+ * delete of the output.
+ *
+ * @param po memory output
+ * @return data
+ */
+void *kft_output_get_data(kft_output_t *po);
+
+/**
+ * Get the length of the data written to a memory output
+ *
+ * @param po memory output
+ * @return length of data
+ */
+size_t kft_output_get_size(const kft_output_t *po)
+    __attribute__((nonnull(1), pure, warn_unused_result));
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include "kft_io_scan.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define KFT_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+kft_scanset_t kft_scanset_init(int ch_esc, int ch_st, int ch_en,
+                               bool stop_on_eol) {
+  return (kft_scanset_t){
+      .stops = {(unsigned char)ch_esc, (unsigned char)ch_st,
+                (unsigned char)ch_en,
+                stop_on_eol ? '\n' : (unsigned char)ch_esc},
+  };
+}
+
+static size_t kft_scan_scalar(const char *ptr, size_t len,
+                              const kft_scanset_t *pset) {
+  const unsigned char *p = (const unsigned char *)ptr;
+  for (size_t i = 0; i < len; i++) {
+    unsigned char ch = p[i];
+    if (ch == pset->stops[0] || ch == pset->stops[1] || ch == pset->stops[2] ||
+        ch == pset->stops[3]) {
+      return i;
+    }
+  }
+  return len;
+}
+
+static size_t kft_scan_count_scalar(const char *ptr, size_t len, int ch) {
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    count += (unsigned char)ptr[i] == (unsigned char)ch;
+  }
+  return count;
+}
+
+#ifdef KFT_SCAN_X86
+
+static size_t kft_scan_sse2(const char *ptr, size_t len,
+                            const kft_scanset_t *pset) {
+  const __m128i v0 = _mm_set1_epi8((char)pset->stops[0]);
+  const __m128i v1 = _mm_set1_epi8((char)pset->stops[1]);
+  const __m128i v2 = _mm_set1_epi8((char)pset->stops[2]);
+  const __m128i v3 = _mm_set1_epi8((char)pset->stops[3]);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(ptr + i));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, v0), _mm_cmpeq_epi8(v, v1)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, v2), _mm_cmpeq_epi8(v, v3)));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + kft_scan_scalar(ptr + i, len - i, pset);
+}
+
+__attribute__((target("avx2"))) static size_t
+kft_scan_avx2(const char *ptr, size_t len, const kft_scanset_t *pset) {
+  const __m256i v0 = _mm256_set1_epi8((char)pset->stops[0]);
+  const __m256i v1 = _mm256_set1_epi8((char)pset->stops[1]);
+  const __m256i v2 = _mm256_set1_epi8((char)pset->stops[2]);
+  const __m256i v3 = _mm256_set1_epi8((char)pset->stops[3]);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, v0), _mm256_cmpeq_epi8(v, v1)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, v2), _mm256_cmpeq_epi8(v, v3)));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + kft_scan_sse2(ptr + i, len - i, pset);
+}
+
+static size_t kft_scan_count_sse2(const char *ptr, size_t len, int ch) {
+  const __m128i vch = _mm_set1_epi8((char)ch);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(ptr + i));
+    unsigned int mask =
+        (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vch));
+    count += __builtin_popcount(mask);
+  }
+  return count + kft_scan_count_scalar(ptr + i, len - i, ch);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t
+kft_scan_count_avx2(const char *ptr, size_t len, int ch) {
+  const __m256i vch = _mm256_set1_epi8((char)ch);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+    unsigned int mask =
+        (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vch));
+    count += __builtin_popcount(mask);
+  }
+  return count + kft_scan_count_sse2(ptr + i, len - i, ch);
+}
+
+#endif
+
+typedef size_t (*kft_scan_func_t)(const char *ptr, size_t len,
+                                  const kft_scanset_t *pset);
+
+static kft_scan_func_t kft_scan_select(void) {
+#ifdef KFT_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return kft_scan_avx2;
+  }
+  return kft_scan_sse2;
+#else
+  return kft_scan_scalar;
+#endif
+}
+
+size_t kft_scan(const char *ptr, size_t len, const kft_scanset_t *pset) {
+  static kft_scan_func_t func = NULL;
+  kft_scan_func_t f = __atomic_load_n(&func, __ATOMIC_RELAXED);
+  if (f == NULL) {
+    f = kft_scan_select();
+    __atomic_store_n(&func, f, __ATOMIC_RELAXED);
+  }
+  return f(ptr, len, pset);
+}
+
+typedef size_t (*kft_scan_count_func_t)(const char *ptr, size_t len, int ch);
+
+static kft_scan_count_func_t kft_scan_count_select(void) {
+#ifdef KFT_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return kft_scan_count_avx2;
+  }
+  return kft_scan_count_sse2;
+#else
+  return kft_scan_count_scalar;
+#endif
+}
+
+size_t kft_scan_count(const char *ptr, size_t len, int ch) {
+  static kft_scan_count_func_t func = NULL;
+  kft_scan_count_func_t f = __atomic_load_n(&func, __ATOMIC_RELAXED);
+  if (f == NULL) {
+    f = kft_scan_count_select();
+    __atomic_store_n(&func, f, __ATOMIC_RELAXED);
+  }
+  return f(ptr, len, ch);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "kft.h"
+
+/**
+ * The set of characters which terminate a run of plain characters.
+ */
+typedef struct kft_scanset kft_scanset_t;
+
+/**
+ * The set of characters which terminate a run of plain characters.
+ */
+struct kft_scanset {
+  /** characters to stop at (duplicated when less than 4 are needed) */
+  unsigned char stops[4];
+};
+
+/* --------------------------------------------- *
+ * Constructors and Destructors                  *
+ * --------------------------------------------- */
+
+/**
+ * Create a scan set
+ *
+ * @param ch_esc escape character
+ * @param ch_st first character of the start delimiter
+ * @param ch_en first character of the end delimiter
+ * @param stop_on_eol stop at newlines too
+ * @return scan set
+ */
+kft_scanset_t kft_scanset_init(int ch_esc, int ch_st, int ch_en,
+                               bool stop_on_eol)
+    __attribute__((warn_unused_result, const));
+
+/* --------------------------------------------- *
+ * Scanners                                      *
+ * --------------------------------------------- */
+
+/**
+ * Find the first character of the scan set
+ *
+ * The implementation (AVX2, SSE2 or scalar) is chosen at the first call
+ * depending on the running CPU.
+ *
+ * @param ptr buffer
+ * @param len length of buffer
+ * @param pset scan set
+ * @return index of the first character in the set, or len if none
+ */
+size_t kft_scan(const char *ptr, size_t len, const kft_scanset_t *pset)
+    __attribute__((nonnull(3), warn_unused_result));
+
+/**
+ * Count occurrences of a character
+ *
+ * The implementation (AVX2, SSE2 or scalar) is chosen at the first call
+ * depending on the running CPU.
+ *
+ * @param ptr buffer
+ * @param len length of buffer
+ * @param ch character to count
+ * @return number of occurrences
+ */
+size_t kft_scan_count(const char *ptr, size_t len, int ch)
+    __attribute__((warn_unused_result));
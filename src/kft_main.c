@@ -0,0 +1,3 @@
+#include "kft_rt.h"
+
+int main(int argc, char *argv[]) { return kft_main(argc, argv, NULL); }
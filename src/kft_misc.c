@@ -1,3 +1,136 @@
 #include "kft_misc.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * A mapping guarded against truncation (read by the SIGBUS handler, so the
+ * entries are never freed and are allocated out of the collected heap).
+ */
+typedef struct kft_map_guard {
+  /** next guard */
+  struct kft_map_guard *pnext;
+  /** mapping (NULL when the entry is free) */
+  const char *ptr;
+  /** size of mapping */
+  size_t size;
+  /** filename */
+  char *filename;
+} kft_map_guard_t;
+
+/** guarded mappings */
+static kft_map_guard_t *kft_map_guards = NULL;
+
+/** mutex of kft_map_guards (the handler reads it without locking) */
+static pthread_mutex_t kft_map_guards_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Report SIGBUS in a guarded mapping and exit
+ *
+ * @param sig signal number
+ * @param psi signal information
+ * @param pctx context
+ */
+static void kft_map_sigbus(int sig, siginfo_t *psi, void *pctx) {
+  (void)pctx;
+  const char *addr = (const char *)psi->si_addr;
+  for (kft_map_guard_t *pg = __atomic_load_n(&kft_map_guards, __ATOMIC_ACQUIRE);
+       pg != NULL; pg = pg->pnext) {
+    const char *ptr = __atomic_load_n(&pg->ptr, __ATOMIC_ACQUIRE);
+    if (ptr != NULL && ptr <= addr && addr < ptr + pg->size) {
+      // ONLY ASYNC-SIGNAL-SAFE CALLS
+      static const char msg[] = ": file changed while reading\n";
+      (void)!write(STDERR_FILENO, pg->filename, strlen(pg->filename));
+      (void)!write(STDERR_FILENO, msg, sizeof(msg) - 1);
+      _exit(EXIT_FAILURE);
+    }
+  }
+  // NOT A GUARDED MAPPING (FAULT AGAIN WITH THE DEFAULT ACTION)
+  signal(sig, SIG_DFL);
+}
 
 int isodigit(int ch) { return '0' <= ch && ch <= '7'; }
+
+int kft_parse_size(const char *str, size_t *psize) {
+  char *end;
+  errno = 0;
+  unsigned long long size = strtoull(str, &end, 10);
+  if (end == str || errno != 0) {
+    return KFT_FAILURE;
+  }
+  unsigned int shift = 0;
+  switch (*end) {
+  case 'k':
+  case 'K':
+    shift = 10;
+    end++;
+    break;
+  case 'm':
+  case 'M':
+    shift = 20;
+    end++;
+    break;
+  case 'g':
+  case 'G':
+    shift = 30;
+    end++;
+    break;
+  }
+  if (*end != '\0' || size > (SIZE_MAX >> shift)) {
+    return KFT_FAILURE;
+  }
+  *psize = (size_t)size << shift;
+  return KFT_SUCCESS;
+}
+
+void kft_map_guard(const void *ptr, size_t size, const char *filename) {
+  pthread_mutex_lock(&kft_map_guards_mutex);
+  if (kft_map_guards == NULL) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = kft_map_sigbus;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, NULL);
+  }
+  kft_map_guard_t *pg = kft_map_guards;
+  while (pg != NULL && pg->ptr != NULL) {
+    pg = pg->pnext;
+  }
+  char *name = strdup(filename);
+  if (pg == NULL) {
+    pg = (kft_map_guard_t *)calloc(1, sizeof(kft_map_guard_t));
+    if (pg == NULL || name == NULL) {
+      // NOT GUARDED
+      free(pg);
+      free(name);
+      pthread_mutex_unlock(&kft_map_guards_mutex);
+      return;
+    }
+    pg->pnext = kft_map_guards;
+    __atomic_store_n(&kft_map_guards, pg, __ATOMIC_RELEASE);
+  } else if (name == NULL) {
+    pthread_mutex_unlock(&kft_map_guards_mutex);
+    return;
+  } else {
+    free(pg->filename);
+  }
+  pg->size = size;
+  pg->filename = name;
+  __atomic_store_n(&pg->ptr, (const char *)ptr, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&kft_map_guards_mutex);
+}
+
+void kft_map_unguard(const void *ptr) {
+  pthread_mutex_lock(&kft_map_guards_mutex);
+  for (kft_map_guard_t *pg = kft_map_guards; pg != NULL; pg = pg->pnext) {
+    if (pg->ptr == ptr) {
+      __atomic_store_n(&pg->ptr, NULL, __ATOMIC_RELEASE);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&kft_map_guards_mutex);
+}
@@ -3,3 +3,32 @@
 #include "kft.h"
 
 int isodigit(int ch);
+
+/**
+ * Parse a size with an optional K, M or G suffix
+ *
+ * @param str string to parse
+ * @param psize parsed size
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+int kft_parse_size(const char *str, size_t *psize);
+
+/**
+ * Guard a read-only mapping of a file against truncation
+ *
+ * Reading a page past the end of a truncated file raises SIGBUS; in a guarded
+ * mapping it is reported as an error of the file and the program exits.
+ *
+ * @param ptr mapping
+ * @param size size of mapping
+ * @param filename filename (copied)
+ */
+void kft_map_guard(const void *ptr, size_t size, const char *filename)
+    __attribute__((nonnull(1, 3)));
+
+/**
+ * Stop guarding a mapping (before unmapping it)
+ *
+ * @param ptr mapping
+ */
+void kft_map_unguard(const void *ptr) __attribute__((nonnull(1)));
@@ -0,0 +1,436 @@
+#include "kft_ops.h"
+#include "kft_cache.h"
+#include "kft_io_scan.h"
+#include "kft_malloc.h"
+#include "kft_misc.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** initial number of operations */
+#define KFT_OPS_NOPS 64
+
+struct kft_ops {
+  /** operations */
+  const kft_op_t *ops;
+  /** number of operations */
+  size_t nops;
+  /** source */
+  const char *src;
+  /** length of source */
+  size_t srclen;
+  /** pool of unescaped text */
+  const char *pool;
+  /** length of pool */
+  size_t poollen;
+};
+
+/**
+ * The compiled template of a file.
+ */
+typedef struct kft_ops_file {
+  /** next entry */
+  struct kft_ops_file *pnext;
+  /** file identity */
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  /** input specification */
+  int ch_esc;
+  const char *delim_st;
+  const char *delim_en;
+  /** compiled template (NULL when not compiled yet) */
+  kft_ops_t *pops;
+  /** the file can not be compiled */
+  bool failed;
+} kft_ops_file_t;
+
+/** compiled templates of files */
+static kft_ops_file_t *kft_ops_files = NULL;
+
+/** lock of kft_ops_files */
+static pthread_mutex_t kft_ops_files_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * The state of the compiler.
+ */
+typedef struct kft_ops_compiler {
+  /** operations */
+  kft_op_t *ops;
+  /** number of operations */
+  size_t nops;
+  /** size of operations */
+  size_t nops_max;
+  /** source */
+  const char *src;
+  /** length of source */
+  size_t srclen;
+  /** text is pending */
+  bool text;
+  /** the pending text is in the pool (not verbatim) */
+  bool pooled;
+  /** start of the pending text */
+  const char *text_str;
+  /** length of the pending text */
+  size_t text_len;
+  /** source offset, row and column of the pending text */
+  size_t text_srcoff;
+  size_t text_row;
+  size_t text_col;
+  /** pool of unescaped text (as long as the source) */
+  char *pool;
+  /** used size of pool */
+  size_t pool_len;
+} kft_ops_compiler_t;
+
+/**
+ * Add an operation
+ *
+ * @param pc compiler
+ * @return new operation
+ */
+static kft_op_t *kft_ops_add(kft_ops_compiler_t *pc) {
+  if (pc->nops == pc->nops_max) {
+    pc->nops_max *= 2;
+    pc->ops =
+        (kft_op_t *)kft_realloc(pc->ops, pc->nops_max * sizeof(kft_op_t));
+  }
+  return &pc->ops[pc->nops++];
+}
+
+/**
+ * Emit the pending text
+ *
+ * @param pc compiler
+ */
+static void kft_ops_flush(kft_ops_compiler_t *pc) {
+  if (!pc->text) {
+    return;
+  }
+  kft_op_t *pop = kft_ops_add(pc);
+  *pop = (kft_op_t){
+      .kind = KFT_OP_TEXT,
+      .directive = 0,
+      .stroff = pc->pooled ? pc->srclen + (pc->text_str - pc->pool)
+                           : (size_t)(pc->text_str - pc->src),
+      .len = pc->text_len,
+      .srcoff = pc->text_srcoff,
+      .row = pc->text_row,
+      .col = pc->text_col,
+  };
+  if (pc->pooled) {
+    pc->pool_len += pc->text_len;
+  }
+  pc->text = false;
+}
+
+/**
+ * Add plain text
+ *
+ * @param pc compiler
+ * @param pos source offset of the text
+ * @param len length of the text
+ * @param srcoff source offset of the token (escape included)
+ * @param row row of the token
+ * @param col column of the token
+ */
+static void kft_ops_text(kft_ops_compiler_t *pc, size_t pos, size_t len,
+                         size_t srcoff, size_t row, size_t col) {
+  const char *str = pc->src + pos;
+  if (!pc->text) {
+    // NEW TEXT (VERBATIM)
+    pc->text = true;
+    pc->pooled = false;
+    pc->text_str = str;
+    pc->text_len = len;
+    pc->text_srcoff = srcoff;
+    pc->text_row = row;
+    pc->text_col = col;
+    return;
+  }
+  if (!pc->pooled && pc->text_str + pc->text_len == str) {
+    // CONTIGUOUS IN SOURCE
+    pc->text_len += len;
+    return;
+  }
+  if (!pc->pooled) {
+    // MOVE THE TEXT TO THE POOL
+    if (pc->pool == NULL) {
+      pc->pool = (char *)kft_malloc_atomic(pc->srclen);
+    }
+    memcpy(pc->pool + pc->pool_len, pc->text_str, pc->text_len);
+    pc->text_str = pc->pool + pc->pool_len;
+    pc->pooled = true;
+  }
+  memcpy(pc->pool + pc->pool_len + pc->text_len, str, len);
+  pc->text_len += len;
+}
+
+/**
+ * Add a token
+ *
+ * @param pc compiler
+ * @param kind kind (KFT_OP_EOL, KFT_OP_BEGIN or KFT_OP_END)
+ * @param srcoff source offset
+ * @param row row
+ * @param col column
+ * @return new operation
+ */
+static kft_op_t *kft_ops_token(kft_ops_compiler_t *pc, int kind, size_t srcoff,
+                               size_t row, size_t col) {
+  kft_ops_flush(pc);
+  kft_op_t *pop = kft_ops_add(pc);
+  *pop = (kft_op_t){
+      .kind = kind,
+      .directive = 0,
+      .stroff = 0,
+      .len = 0,
+      .srcoff = srcoff,
+      .row = row,
+      .col = col,
+  };
+  return pop;
+}
+
+kft_ops_t *kft_ops_compile(const char *src, size_t len, kft_ispec_t ispec) {
+  int ch_esc = kft_ispec_get_ch_esc(ispec);
+  const kft_delim_t *match_st = kft_ispec_get_match_st(&ispec);
+  const kft_delim_t *match_en = kft_ispec_get_match_en(&ispec);
+  int ch_st = (unsigned char)match_st->str[0];
+  int ch_en = (unsigned char)match_en->str[0];
+
+  // A DIRECTIVE CHARACTER WHICH IS ALSO SPECIAL IS READ RAW BY THE PARSER,
+  // BUT AS A TOKEN IN COMMENTS: LEFT TO THE INTERPRETER
+  if (strchr(KFT_OP_DIRECTIVES, ch_esc) != NULL ||
+      strchr(KFT_OP_DIRECTIVES, ch_st) != NULL ||
+      strchr(KFT_OP_DIRECTIVES, ch_en) != NULL) {
+    return NULL;
+  }
+
+  kft_ops_compiler_t c = {
+      .ops = (kft_op_t *)kft_malloc(KFT_OPS_NOPS * sizeof(kft_op_t)),
+      .nops = 0,
+      .nops_max = KFT_OPS_NOPS,
+      .src = src,
+      .srclen = len,
+      .text = false,
+      .pool = NULL,
+      .pool_len = 0,
+  };
+  kft_scanset_t scanset = kft_ispec_get_scanset(ispec, true);
+
+  // SAME TOKENS AS kft_fgetc() RETURNS
+  size_t pos = 0, row = 0, col = 0;
+  while (pos < len) {
+    size_t span = kft_scan(src + pos, len - pos, &scanset);
+    if (span > 0) {
+      kft_ops_text(&c, pos, span, pos, row, col);
+      pos += span;
+      col += span;
+      continue;
+    }
+    int ch = (unsigned char)src[pos];
+    if (ch == ch_esc) {
+      int ch_next = pos + 1 < len ? (unsigned char)src[pos + 1] : EOF;
+      if (ch_next == EOF) {
+        // ACCEPT ESCAPE
+        kft_ops_text(&c, pos, 1, pos, row, col);
+        pos++;
+        col++;
+      } else if (ch_next == '\n') {
+        // ESCAPED NEWLINE IS NOT AN END OF LINE
+        kft_ops_text(&c, pos + 1, 1, pos, row, col);
+        pos += 2;
+        row++;
+        col = 0;
+      } else if (ch_next == ch_esc) {
+        kft_ops_text(&c, pos + 1, 1, pos, row, col);
+        pos += 2;
+        col += 2;
+      } else if (ch_next == ch_en || ch_next == ch_st) {
+        const kft_delim_t *match_esc = ch_next == ch_en ? match_en : match_st;
+        if (kft_delim_match(match_esc, src + pos + 1, len - pos - 1)) {
+          // DISCARD ESCAPE AND ACCEPT DELIM[0]
+          kft_ops_text(&c, pos + 1, 1, pos, row, col);
+        } else {
+          // ACCEPT ESCAPE AND DELIM[0] (INCOMPLETE DELIMITER)
+          kft_ops_text(&c, pos, 2, pos, row, col);
+        }
+        pos += 2;
+        col += 2;
+      } else {
+        kft_ops_text(&c, pos, 1, pos, row, col);
+        pos++;
+        col++;
+      }
+    } else if (ch == ch_en && kft_delim_match(match_en, src + pos, len - pos)) {
+      kft_ops_token(&c, KFT_OP_END, pos, row, col);
+      pos += match_en->len;
+      col += match_en->len;
+    } else if (ch == ch_st && kft_delim_match(match_st, src + pos, len - pos)) {
+      kft_op_t *pop = kft_ops_token(&c, KFT_OP_BEGIN, pos, row, col);
+      pos += match_st->len;
+      col += match_st->len;
+      if (pos < len && src[pos] != '\0' &&
+          strchr(KFT_OP_DIRECTIVES, src[pos]) != NULL) {
+        pop->directive = (unsigned char)src[pos];
+        pop->stroff = pos;
+        pop->len = 1;
+        pos++;
+        col++;
+      }
+    } else if (ch == '\n') {
+      kft_ops_token(&c, KFT_OP_EOL, pos, row, col);
+      pos++;
+      row++;
+      col = 0;
+    } else {
+      // FIRST CHARACTER OF AN INCOMPLETE DELIMITER
+      kft_ops_text(&c, pos, 1, pos, row, col);
+      pos++;
+      col++;
+    }
+  }
+  kft_ops_flush(&c);
+
+  kft_ops_t *pops = (kft_ops_t *)kft_malloc(sizeof(kft_ops_t));
+  *pops = (kft_ops_t){
+      .ops = c.ops,
+      .nops = c.nops,
+      .src = src,
+      .srclen = len,
+      .pool = c.pool,
+      .poollen = c.pool_len,
+  };
+  return pops;
+}
+
+kft_ops_t *kft_ops_new(const kft_op_t *ops, size_t nops, const char *src,
+                       size_t srclen, const char *pool, size_t poollen) {
+  // NEVER READ OUT OF THE SOURCE OR THE POOL
+  size_t srcoff = 0;
+  for (size_t i = 0; i < nops; i++) {
+    const kft_op_t *pop = &ops[i];
+    if (pop->kind < KFT_OP_TEXT || pop->kind > KFT_OP_END ||
+        pop->srcoff < srcoff || pop->srcoff >= srclen ||
+        pop->stroff > srclen + poollen ||
+        pop->len > (pop->stroff < srclen ? srclen : srclen + poollen) -
+                       pop->stroff ||
+        (pop->kind == KFT_OP_TEXT && pop->len == 0) ||
+        (pop->kind == KFT_OP_BEGIN && pop->len != (pop->directive != 0))) {
+      return NULL;
+    }
+    srcoff = pop->srcoff;
+  }
+  kft_ops_t *pops = (kft_ops_t *)kft_malloc(sizeof(kft_ops_t));
+  *pops = (kft_ops_t){
+      .ops = ops,
+      .nops = nops,
+      .src = src,
+      .srclen = srclen,
+      .pool = pool,
+      .poollen = poollen,
+  };
+  return pops;
+}
+
+const kft_ops_t *kft_ops_open(int fd, const char *filename, kft_ispec_t ispec,
+                              bool force) {
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+      (off_t)(size_t)st.st_size != st.st_size) {
+    return NULL;
+  }
+  const char *delim_st = kft_ispec_get_delim_st(ispec);
+  const char *delim_en = kft_ispec_get_delim_en(ispec);
+
+  pthread_mutex_lock(&kft_ops_files_mutex);
+  kft_ops_file_t *pf = kft_ops_files;
+  while (pf != NULL &&
+         !(pf->dev == st.st_dev && pf->ino == st.st_ino &&
+           pf->size == st.st_size && pf->mtime.tv_sec == st.st_mtim.tv_sec &&
+           pf->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+           pf->ch_esc == kft_ispec_get_ch_esc(ispec) &&
+           strcmp(pf->delim_st, delim_st) == 0 &&
+           strcmp(pf->delim_en, delim_en) == 0)) {
+    pf = pf->pnext;
+  }
+  if (pf == NULL) {
+    // FIRST OPEN
+    pf = (kft_ops_file_t *)kft_malloc(sizeof(kft_ops_file_t));
+    *pf = (kft_ops_file_t){
+        .pnext = kft_ops_files,
+        .dev = st.st_dev,
+        .ino = st.st_ino,
+        .size = st.st_size,
+        .mtime = st.st_mtim,
+        .ch_esc = kft_ispec_get_ch_esc(ispec),
+        .delim_st = kft_strdup(delim_st),
+        .delim_en = kft_strdup(delim_en),
+        .pops = NULL,
+        .failed = false,
+    };
+    kft_ops_files = pf;
+    if (!force && !kft_cache_ops_enabled()) {
+      pthread_mutex_unlock(&kft_ops_files_mutex);
+      return NULL;
+    }
+  }
+  if (pf->pops == NULL && !pf->failed) {
+    // THE TEMPLATE KEEPS ITS OWN MAPPING OF THE SOURCE
+    size_t size = (size_t)st.st_size;
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED) {
+      kft_map_guard(ptr, size, filename);
+      pf->pops = kft_cache_ops_enabled()
+                     ? kft_cache_ops_open(&st, ispec, (const char *)ptr)
+                     : kft_ops_compile((const char *)ptr, size, ispec);
+      if (pf->pops == NULL) {
+        kft_map_unguard(ptr);
+        munmap(ptr, size);
+      }
+    }
+    pf->failed = pf->pops == NULL;
+  }
+  const kft_ops_t *pops = pf->pops;
+  pthread_mutex_unlock(&kft_ops_files_mutex);
+  return pops;
+}
+
+const kft_op_t *kft_ops_get_ops(const kft_ops_t *pops) { return pops->ops; }
+
+size_t kft_ops_get_count(const kft_ops_t *pops) { return pops->nops; }
+
+const char *kft_ops_get_src(const kft_ops_t *pops) { return pops->src; }
+
+size_t kft_ops_get_srclen(const kft_ops_t *pops) { return pops->srclen; }
+
+const char *kft_ops_get_pool(const kft_ops_t *pops) { return pops->pool; }
+
+size_t kft_ops_get_poollen(const kft_ops_t *pops) { return pops->poollen; }
+
+const char *kft_ops_get_text(const kft_ops_t *pops, const kft_op_t *pop) {
+  return pop->stroff < pops->srclen ? pops->src + pop->stroff
+                                    : pops->pool + (pop->stroff - pops->srclen);
+}
+
+size_t kft_ops_find(const kft_ops_t *pops, size_t srcoff) {
+  size_t lo = 0, hi = pops->nops;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (pops->ops[mid].srcoff <= srcoff) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+bool kft_ops_is_verbatim(const kft_ops_t *pops, const kft_op_t *pop) {
+  (void)pops;
+  return pop->kind == KFT_OP_TEXT && pop->stroff == pop->srcoff;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "kft.h"
+#include "kft_io_ispec.h"
+#include <stddef.h>
+
+/** plain text (escapes are already processed) */
+#define KFT_OP_TEXT 0
+/** end of line */
+#define KFT_OP_EOL 1
+/** start delimiter (with the directive of the block) */
+#define KFT_OP_BEGIN 2
+/** end delimiter */
+#define KFT_OP_END 3
+
+/** characters which select the kind of a block (read just after BEGIN) */
+#define KFT_OP_DIRECTIVES "$!#:@-><="
+
+/**
+ * The operation of a compiled template.
+ */
+typedef struct kft_op kft_op_t;
+
+/**
+ * The compiled template (flat array of operations).
+ */
+typedef struct kft_ops kft_ops_t;
+
+/**
+ * The operation of a compiled template.
+ */
+struct kft_op {
+  /** kind (KFT_OP_*) */
+  int kind;
+  /** directive of KFT_OP_BEGIN (0 for a nested template) */
+  int directive;
+  /** offset of text of KFT_OP_TEXT (the directive character of KFT_OP_BEGIN)
+   * in the source followed by the pool */
+  size_t stroff;
+  /** length of text */
+  size_t len;
+  /** source offset */
+  size_t srcoff;
+  /** source row */
+  size_t row;
+  /** source column */
+  size_t col;
+};
+
+/* --------------------------------------------- *
+ * Constructors and Destructors                  *
+ * --------------------------------------------- */
+
+/**
+ * Compile a template
+ *
+ * The text of the operations points into the source when it has no escapes,
+ * so the source must outlive the compiled template.
+ *
+ * @param src source
+ * @param len length of source
+ * @param ispec input specification
+ * @return compiled template, or NULL if the escape character or a delimiter
+ * is also a directive character (the template is only interpreted then)
+ */
+kft_ops_t *kft_ops_compile(const char *src, size_t len, kft_ispec_t ispec)
+    __attribute__((nonnull(1), warn_unused_result));
+
+/**
+ * Create a compiled template from its parts (loaded from the cache)
+ *
+ * The text of the operations is an offset into the source followed by the
+ * pool, so the operations are the same wherever they are mapped.
+ *
+ * @param ops operations
+ * @param nops number of operations
+ * @param src source
+ * @param srclen length of source
+ * @param pool pool of unescaped text
+ * @param poollen length of pool
+ * @return compiled template, or NULL if the operations are inconsistent
+ */
+kft_ops_t *kft_ops_new(const kft_op_t *ops, size_t nops, const char *src,
+                       size_t srclen, const char *pool, size_t poollen)
+    __attribute__((warn_unused_result));
+
+/**
+ * Get the compiled template of an opened file
+ *
+ * Templates are kept for the whole run. A file is compiled at its second
+ * open (or at once when forced), so a template rendered only once is just
+ * interpreted. With $KFT_TEMPLATE_CACHE a file is compiled (or loaded from
+ * the cache) at its first open.
+ *
+ * @param fd file descriptor of a regular file
+ * @param filename filename (used in messages)
+ * @param ispec input specification
+ * @param force compile even at the first open
+ * @return compiled template, or NULL if not compiled
+ */
+const kft_ops_t *kft_ops_open(int fd, const char *filename, kft_ispec_t ispec,
+                              bool force)
+    __attribute__((warn_unused_result));
+
+/* --------------------------------------------- *
+ * Accessors                                     *
+ * --------------------------------------------- */
+
+const kft_op_t *kft_ops_get_ops(const kft_ops_t *pops)
+    __attribute__((nonnull(1), warn_unused_result, pure, returns_nonnull));
+
+size_t kft_ops_get_count(const kft_ops_t *pops)
+    __attribute__((nonnull(1), warn_unused_result, pure));
+
+const char *kft_ops_get_src(const kft_ops_t *pops)
+    __attribute__((nonnull(1), warn_unused_result, pure, returns_nonnull));
+
+size_t kft_ops_get_srclen(const kft_ops_t *pops)
+    __attribute__((nonnull(1), warn_unused_result, pure));
+
+const char *kft_ops_get_pool(const kft_ops_t *pops)
+    __attribute__((nonnull(1), warn_unused_result, pure));
+
+size_t kft_ops_get_poollen(const kft_ops_t *pops)
+    __attribute__((nonnull(1), warn_unused_result, pure));
+
+/**
+ * Get the text of an operation
+ *
+ * @param pops compiled template
+ * @param pop operation
+ * @return text (length is pop->len)
+ */
+const char *kft_ops_get_text(const kft_ops_t *pops, const kft_op_t *pop)
+    __attribute__((nonnull(1, 2), warn_unused_result, pure, returns_nonnull));
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Find the operation at a source offset
+ *
+ * @param pops compiled template
+ * @param srcoff source offset
+ * @return index of the last operation starting at or before the offset
+ */
+size_t kft_ops_find(const kft_ops_t *pops, size_t srcoff)
+    __attribute__((nonnull(1), warn_unused_result, pure));
+
+/**
+ * Test whether the text of an operation is the source itself
+ *
+ * @param pops compiled template
+ * @param pop operation
+ * @return true if the text is at the source offset of the operation
+ */
+bool kft_ops_is_verbatim(const kft_ops_t *pops, const kft_op_t *pop)
+    __attribute__((nonnull(1, 2), warn_unused_result, pure));
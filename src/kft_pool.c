@@ -0,0 +1,120 @@
+#include "kft_pool.h"
+#include "kft_error.h"
+#include <pthread.h>
+#include <string.h>
+
+/** maximum number of idle workers kept */
+#define KFT_POOL_IDLE_MAX 16
+
+/**
+ * The worker thread (reused after it is joined).
+ */
+struct kft_worker {
+  /** function to run (NULL when idle) */
+  void *(*start)(void *);
+  /** argument of the function */
+  void *arg;
+  /** return value of the function */
+  void *result;
+  /** function returned */
+  bool done;
+  /** exit instead of waiting for the next function */
+  bool retire;
+  /** signaled when start, done or retire changes */
+  pthread_cond_t cond;
+  /** next idle worker */
+  kft_worker_t *pnext;
+};
+
+/** lock of all workers */
+static pthread_mutex_t kft_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** idle workers */
+static kft_worker_t *kft_pool_idle = NULL;
+
+/** number of idle workers */
+static size_t kft_pool_nidle = 0;
+
+static void *kft_worker_main(void *data) {
+  kft_worker_t *pw = data;
+  pthread_mutex_lock(&kft_pool_lock);
+  while (1) {
+    while (pw->start == NULL && !pw->retire) {
+      pthread_cond_wait(&pw->cond, &kft_pool_lock);
+    }
+    if (pw->start == NULL) {
+      break;
+    }
+    void *(*start)(void *) = pw->start;
+    void *arg = pw->arg;
+    pthread_mutex_unlock(&kft_pool_lock);
+    void *result = start(arg);
+    pthread_mutex_lock(&kft_pool_lock);
+    pw->result = result;
+    pw->start = NULL;
+    pw->done = true;
+    pthread_cond_broadcast(&pw->cond);
+  }
+  pthread_mutex_unlock(&kft_pool_lock);
+  pthread_cond_destroy(&pw->cond);
+  free(pw);
+  return NULL;
+}
+
+kft_worker_t *kft_pool_start(void *(*start)(void *), void *arg) {
+  pthread_mutex_lock(&kft_pool_lock);
+  kft_worker_t *pw = kft_pool_idle;
+  if (pw != NULL) {
+    // REUSE IDLE WORKER
+    kft_pool_idle = pw->pnext;
+    kft_pool_nidle--;
+    pw->start = start;
+    pw->arg = arg;
+    pw->done = false;
+    pthread_cond_broadcast(&pw->cond);
+    pthread_mutex_unlock(&kft_pool_lock);
+    return pw;
+  }
+  pthread_mutex_unlock(&kft_pool_lock);
+
+  // ALL WORKERS ARE BUSY: CREATE ONE (NOT IN THE GC HEAP, LIKE THE THREAD)
+  pw = (kft_worker_t *)malloc(sizeof(kft_worker_t));
+  if (pw == NULL) {
+    kft_error("%s: %m\n", "malloc");
+  }
+  pw->start = start;
+  pw->arg = arg;
+  pw->result = NULL;
+  pw->done = false;
+  pw->retire = false;
+  pthread_cond_init(&pw->cond, NULL);
+  pw->pnext = NULL;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t tid;
+  int ret = pthread_create(&tid, &attr, kft_worker_main, pw);
+  pthread_attr_destroy(&attr);
+  if (ret != 0) {
+    kft_error("%s: %s\n", "pthread_create", strerror(ret));
+  }
+  return pw;
+}
+
+void *kft_pool_join(kft_worker_t *pw) {
+  pthread_mutex_lock(&kft_pool_lock);
+  while (!pw->done) {
+    pthread_cond_wait(&pw->cond, &kft_pool_lock);
+  }
+  void *result = pw->result;
+  if (kft_pool_nidle < KFT_POOL_IDLE_MAX) {
+    pw->pnext = kft_pool_idle;
+    kft_pool_idle = pw;
+    kft_pool_nidle++;
+  } else {
+    pw->retire = true;
+    pthread_cond_broadcast(&pw->cond);
+  }
+  pthread_mutex_unlock(&kft_pool_lock);
+  return result;
+}
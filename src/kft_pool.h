@@ -0,0 +1,32 @@
+#pragma once
+
+#include "kft.h"
+
+/**
+ * The worker thread (reused after it is joined).
+ */
+typedef struct kft_worker kft_worker_t;
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Run a function in a worker thread
+ *
+ * An idle worker is reused; a new one is created only when all are busy.
+ *
+ * @param start function to run
+ * @param arg argument of the function
+ * @return worker (join with kft_pool_join)
+ */
+kft_worker_t *kft_pool_start(void *(*start)(void *), void *arg)
+    __attribute__((nonnull(1), warn_unused_result, returns_nonnull));
+
+/**
+ * Wait for the function run by a worker and give the worker back to the pool
+ *
+ * @param pw worker
+ * @return return value of the function
+ */
+void *kft_pool_join(kft_worker_t *pw) __attribute__((nonnull(1)));
@@ -1,5 +1,6 @@
 #include "kft_prog.h"
 #include "kft_malloc.h"
+#include "kft_prog_match.h"
 #include <string.h>
 
 kft_expr_t *kft_expr_new_nil(void) {
@@ -8,13 +9,13 @@ kft_expr_t *kft_expr_new_nil(void) {
   return expr;
 }
 
-kft_int_t kft_int_new(int value) {
+kft_int_t kft_int_new(long value) {
   kft_int_t int_val;
   int_val.value = value;
   return int_val;
 }
 
-kft_expr_t *kft_expr_new_int(int value) {
+kft_expr_t *kft_expr_new_int(long value) {
   kft_expr_t *expr = (kft_expr_t *)kft_malloc(sizeof(kft_expr_t));
   expr->type = KFT_EXPR_INT;
   expr->val.int_val = kft_int_new(value);
@@ -108,4 +109,37 @@ kft_expr_t *kft_expr_new_symbol(kft_string_t name) {
   expr_val->type = KFT_EXPR_SYMBOL;
   expr_val->val.symbol_val = kft_symbol_new(name);
   return expr_val;
-}
\ No newline at end of file
+}
+
+kft_expr_t *kft_expr_new_tuple(kft_expr_t **fields, size_t nfields) {
+  return kft_expr_new_object(kft_symbol_new(kft_string_new("", 0)), fields,
+                             nfields);
+}
+
+kft_match_t *kft_match_new(kft_expr_t *subject, kft_expr_t **patterns,
+                           kft_expr_t **bodies, size_t narms) {
+  kft_match_t *match_val = (kft_match_t *)kft_malloc(sizeof(kft_match_t));
+  match_val->subject = subject;
+  match_val->patterns = patterns;
+  match_val->bodies = bodies;
+  match_val->narms = narms;
+  match_val->tree = kft_dtree_compile(patterns, narms);
+  return match_val;
+}
+
+kft_expr_t *kft_expr_new_match(kft_expr_t *subject, kft_expr_t **patterns,
+                               kft_expr_t **bodies, size_t narms) {
+  kft_expr_t *expr_val = (kft_expr_t *)kft_malloc(sizeof(kft_expr_t));
+  expr_val->type = KFT_EXPR_MATCH;
+  expr_val->val.match_val = kft_match_new(subject, patterns, bodies, narms);
+  return expr_val;
+}
+
+kft_expr_t *kft_expr_new_bind(kft_expr_t *pattern, kft_expr_t *expr) {
+  kft_expr_t **patterns = (kft_expr_t **)kft_malloc(sizeof(kft_expr_t *));
+  patterns[0] = pattern;
+  kft_expr_t *expr_val = (kft_expr_t *)kft_malloc(sizeof(kft_expr_t));
+  expr_val->type = KFT_EXPR_BIND;
+  expr_val->val.match_val = kft_match_new(expr, patterns, NULL, 1);
+  return expr_val;
+}
@@ -10,9 +10,11 @@ typedef struct kft_var kft_var_t;
 typedef struct kft_call kft_call_t;
 typedef struct kft_object kft_object_t;
 typedef struct kft_symbol kft_symbol_t;
+typedef struct kft_match kft_match_t;
+typedef struct kft_dtree kft_dtree_t;
 
 struct kft_int {
-  int value;
+  long value;
 };
 
 struct kft_float {
@@ -43,6 +45,8 @@ struct kft_expr {
 #define KFT_EXPR_CALL 5
 #define KFT_EXPR_OBJECT 6
 #define KFT_EXPR_SYMBOL 7
+#define KFT_EXPR_MATCH 8
+#define KFT_EXPR_BIND 9
   union {
     kft_int_t int_val;
     kft_float_t float_val;
@@ -51,6 +55,7 @@ struct kft_expr {
     kft_call_t *call_val;
     kft_object_t *object_val;
     kft_symbol_t symbol_val;
+    kft_match_t *match_val;
   } val;
 };
 
@@ -60,17 +65,27 @@ struct kft_call {
   size_t nargs;
 };
 
+/* a tuple is an object of the empty symbol */
 struct kft_object {
   kft_symbol_t symbol;
   kft_expr_t **fields;
   size_t nfields;
 };
 
+/* a bind is a match of one pattern without bodies */
+struct kft_match {
+  kft_expr_t *subject;
+  kft_expr_t **patterns;
+  kft_expr_t **bodies;
+  size_t narms;
+  kft_dtree_t *tree;
+};
+
 kft_expr_t *kft_expr_new_nil(void);
 
-kft_int_t kft_int_new(int value);
+kft_int_t kft_int_new(long value);
 
-kft_expr_t *kft_expr_new_int(int value);
+kft_expr_t *kft_expr_new_int(long value);
 
 kft_float_t kft_float_new(double value);
 
@@ -97,4 +112,14 @@ kft_expr_t *kft_expr_new_object(kft_symbol_t symbol, kft_expr_t **fields,
 
 kft_symbol_t kft_symbol_new(kft_string_t name);
 
-kft_expr_t *kft_expr_new_symbol(kft_string_t name);
\ No newline at end of file
+kft_expr_t *kft_expr_new_symbol(kft_string_t name);
+
+kft_expr_t *kft_expr_new_tuple(kft_expr_t **fields, size_t nfields);
+
+kft_match_t *kft_match_new(kft_expr_t *subject, kft_expr_t **patterns,
+                           kft_expr_t **bodies, size_t narms);
+
+kft_expr_t *kft_expr_new_match(kft_expr_t *subject, kft_expr_t **patterns,
+                               kft_expr_t **bodies, size_t narms);
+
+kft_expr_t *kft_expr_new_bind(kft_expr_t *pattern, kft_expr_t *expr);
@@ -0,0 +1,587 @@
+#include "kft_prog_eval.h"
+#include "kft_malloc.h"
+#include "kft_prog_match.h"
+#include "kft_vars.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** buffer size to format a number */
+#define KFT_EVAL_NUMBUF 32
+
+/**
+ * Test whether the rest of a text is blank
+ *
+ * @param p position in text
+ * @param end end of text
+ * @return true if only spaces follow
+ */
+static bool kft_expr_is_blank(const char *p, const char *end) {
+  while (p < end && isspace((unsigned char)*p)) {
+    p++;
+  }
+  return p == end;
+}
+
+/**
+ * Make a value of text (a number if the whole text is a decimal number, with
+ * spaces around it allowed as in output of a command)
+ *
+ * @param str text (NUL terminated)
+ * @param len length of text
+ * @return value
+ */
+static const kft_expr_t *kft_expr_of_text(const char *str, size_t len) {
+  const char *p = str;
+  while (isspace((unsigned char)*p)) {
+    p++;
+  }
+  p += *p == '-' || *p == '+' ? 1 : 0;
+  if (isdigit((unsigned char)*p) && (p[0] != '0' || tolower(p[1]) != 'x')) {
+    char *end;
+    errno = 0;
+    long l = strtol(str, &end, 10);
+    if (errno == 0 && kft_expr_is_blank(end, str + len)) {
+      return kft_expr_new_int(l);
+    }
+    errno = 0;
+    double d = strtod(str, &end);
+    if (errno == 0 && kft_expr_is_blank(end, str + len)) {
+      return kft_expr_new_float(d);
+    }
+  }
+  return kft_expr_new_string(str, len);
+}
+
+/**
+ * Test whether a value is a number
+ *
+ * @param pval value
+ * @return true if an integer or a floating point number
+ */
+static inline bool kft_expr_is_number(const kft_expr_t *pval) {
+  return pval->type == KFT_EXPR_INT || pval->type == KFT_EXPR_FLOAT;
+}
+
+/**
+ * Get a number as a floating point number
+ *
+ * @param pval value (a number)
+ * @return floating point number
+ */
+static inline double kft_expr_to_double(const kft_expr_t *pval) {
+  return pval->type == KFT_EXPR_INT ? (double)pval->val.int_val.value
+                                    : pval->val.float_val.value;
+}
+
+/**
+ * Test whether a value is true (not zero and not empty)
+ *
+ * @param pval value
+ * @return true or false
+ */
+static bool kft_expr_is_true(const kft_expr_t *pval) {
+  switch (pval->type) {
+  case KFT_EXPR_INT:
+    return pval->val.int_val.value != 0;
+  case KFT_EXPR_FLOAT:
+    return pval->val.float_val.value != 0;
+  case KFT_EXPR_STRING:
+    return pval->val.string_val.len > 0;
+  case KFT_EXPR_OBJECT:
+    return pval->val.object_val->nfields > 0;
+  default:
+    return false;
+  }
+}
+
+kft_string_t kft_expr_to_string(const kft_expr_t *pval) {
+  char buf[KFT_EVAL_NUMBUF];
+  int len = 0;
+  switch (pval->type) {
+  case KFT_EXPR_STRING:
+    return pval->val.string_val;
+  case KFT_EXPR_INT:
+    len = snprintf(buf, sizeof(buf), "%ld", pval->val.int_val.value);
+    break;
+  case KFT_EXPR_FLOAT:
+    len = snprintf(buf, sizeof(buf), "%.15g", pval->val.float_val.value);
+    break;
+  case KFT_EXPR_OBJECT: {
+    // A TUPLE AS (A, B) OR (A,)
+    const kft_object_t *pobj = pval->val.object_val;
+    kft_string_t *fields = (kft_string_t *)kft_malloc(
+        sizeof(kft_string_t) * (pobj->nfields + 1));
+    size_t total = 3;
+    for (size_t i = 0; i < pobj->nfields; i++) {
+      fields[i] = kft_expr_to_string(pobj->fields[i]);
+      total += fields[i].len + 2;
+    }
+    char *str = (char *)kft_malloc(total + 1);
+    size_t n = 0;
+    str[n++] = '(';
+    for (size_t i = 0; i < pobj->nfields; i++) {
+      if (i > 0) {
+        memcpy(str + n, ", ", 2);
+        n += 2;
+      }
+      memcpy(str + n, fields[i].value, fields[i].len);
+      n += fields[i].len;
+    }
+    if (pobj->nfields == 1) {
+      str[n++] = ',';
+    }
+    str[n++] = ')';
+    str[n] = '\0';
+    return (kft_string_t){.value = str, .len = n};
+  }
+  }
+  return kft_string_new(buf, (size_t)len);
+}
+
+/**
+ * Compare values (as numbers if both are numbers, otherwise as strings)
+ *
+ * @param pa value
+ * @param pb value
+ * @return negative, zero or positive
+ */
+static int kft_expr_compare(const kft_expr_t *pa, const kft_expr_t *pb) {
+  if (pa->type == KFT_EXPR_INT && pb->type == KFT_EXPR_INT) {
+    long a = pa->val.int_val.value;
+    long b = pb->val.int_val.value;
+    return (a > b) - (a < b);
+  }
+  if (kft_expr_is_number(pa) && kft_expr_is_number(pb)) {
+    double a = kft_expr_to_double(pa);
+    double b = kft_expr_to_double(pb);
+    return (a > b) - (a < b);
+  }
+  kft_string_t a = kft_expr_to_string(pa);
+  kft_string_t b = kft_expr_to_string(pb);
+  int cmp = memcmp(a.value, b.value, a.len < b.len ? a.len : b.len);
+  return cmp != 0 ? cmp : (a.len > b.len) - (a.len < b.len);
+}
+
+/**
+ * Apply an arithmetic operator to integers
+ *
+ * @param op operator
+ * @param a left operand
+ * @param b right operand
+ * @param ppval value
+ * @param perrmsg error message
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_expr_eval_int(const char *op, long a, long b,
+                             const kft_expr_t **ppval, const char **perrmsg) {
+  long r = 0;
+  bool overflow = false;
+  switch (op[0]) {
+  case '+':
+    overflow = __builtin_add_overflow(a, b, &r);
+    break;
+  case '-':
+    overflow = __builtin_sub_overflow(a, b, &r);
+    break;
+  case '*':
+    overflow = __builtin_mul_overflow(a, b, &r);
+    break;
+  case '/':
+  case '%':
+    if (b == 0) {
+      *perrmsg = "division by zero";
+      return KFT_FAILURE;
+    }
+    overflow = a == LONG_MIN && b == -1;
+    r = overflow ? 0 : op[0] == '/' ? a / b : a % b;
+    break;
+  case '&':
+    r = a & b;
+    break;
+  case '|':
+    r = a | b;
+    break;
+  case '^':
+    r = a ^ b;
+    break;
+  case '<':
+  case '>':
+    if (b < 0 || b >= (long)(sizeof(long) * CHAR_BIT)) {
+      *perrmsg = "invalid shift count";
+      return KFT_FAILURE;
+    }
+    r = op[0] == '<' ? (long)((unsigned long)a << b) : a >> b;
+    break;
+  }
+  if (overflow) {
+    *perrmsg = "integer overflow";
+    return KFT_FAILURE;
+  }
+  *ppval = kft_expr_new_int(r);
+  return KFT_SUCCESS;
+}
+
+/**
+ * Apply a binary operator (except && and ||)
+ *
+ * @param op operator
+ * @param pa left operand
+ * @param pb right operand
+ * @param ppval value
+ * @param perrmsg error message
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_expr_eval_binary(const char *op, const kft_expr_t *pa,
+                                const kft_expr_t *pb, const kft_expr_t **ppval,
+                                const char **perrmsg) {
+  // COMPARISON
+  int cmp = 0;
+  bool is_cmp = true;
+  if (strcmp(op, "==") == 0) {
+    cmp = kft_expr_compare(pa, pb) == 0;
+  } else if (strcmp(op, "!=") == 0) {
+    cmp = kft_expr_compare(pa, pb) != 0;
+  } else if (strcmp(op, "<") == 0) {
+    cmp = kft_expr_compare(pa, pb) < 0;
+  } else if (strcmp(op, "<=") == 0) {
+    cmp = kft_expr_compare(pa, pb) <= 0;
+  } else if (strcmp(op, ">") == 0) {
+    cmp = kft_expr_compare(pa, pb) > 0;
+  } else if (strcmp(op, ">=") == 0) {
+    cmp = kft_expr_compare(pa, pb) >= 0;
+  } else {
+    is_cmp = false;
+  }
+  if (is_cmp) {
+    *ppval = kft_expr_new_int(cmp);
+    return KFT_SUCCESS;
+  }
+
+  // CONCATENATION
+  if (strcmp(op, "+") == 0 &&
+      (pa->type == KFT_EXPR_STRING || pb->type == KFT_EXPR_STRING)) {
+    kft_string_t a = kft_expr_to_string(pa);
+    kft_string_t b = kft_expr_to_string(pb);
+    kft_expr_t *pval = kft_expr_new_string(a.value, a.len + b.len);
+    memcpy(pval->val.string_val.value + a.len, b.value, b.len);
+    pval->val.string_val.value[a.len + b.len] = '\0';
+    *ppval = pval;
+    return KFT_SUCCESS;
+  }
+
+  if (!kft_expr_is_number(pa) || !kft_expr_is_number(pb)) {
+    *perrmsg = "number required";
+    return KFT_FAILURE;
+  }
+  if (pa->type == KFT_EXPR_INT && pb->type == KFT_EXPR_INT) {
+    return kft_expr_eval_int(op, pa->val.int_val.value, pb->val.int_val.value,
+                             ppval, perrmsg);
+  }
+
+  // FLOATING POINT ARITHMETIC
+  double a = kft_expr_to_double(pa);
+  double b = kft_expr_to_double(pb);
+  double r;
+  switch (op[0]) {
+  case '+':
+    r = a + b;
+    break;
+  case '-':
+    r = a - b;
+    break;
+  case '*':
+    r = a * b;
+    break;
+  case '/':
+    if (b == 0) {
+      *perrmsg = "division by zero";
+      return KFT_FAILURE;
+    }
+    r = a / b;
+    break;
+  default:
+    *perrmsg = "integer required";
+    return KFT_FAILURE;
+  }
+  *ppval = kft_expr_new_float(r);
+  return KFT_SUCCESS;
+}
+
+/**
+ * Apply a unary operator
+ *
+ * @param op operator
+ * @param pa operand
+ * @param ppval value
+ * @param perrmsg error message
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_expr_eval_unary(const char *op, const kft_expr_t *pa,
+                               const kft_expr_t **ppval,
+                               const char **perrmsg) {
+  if (op[0] == '!') {
+    *ppval = kft_expr_new_int(!kft_expr_is_true(pa));
+    return KFT_SUCCESS;
+  }
+  if (op[0] == '~') {
+    if (pa->type != KFT_EXPR_INT) {
+      *perrmsg = "integer required";
+      return KFT_FAILURE;
+    }
+    *ppval = kft_expr_new_int(~pa->val.int_val.value);
+    return KFT_SUCCESS;
+  }
+  if (!kft_expr_is_number(pa)) {
+    *perrmsg = "number required";
+    return KFT_FAILURE;
+  }
+  if (op[0] == '+') {
+    *ppval = pa;
+  } else if (pa->type == KFT_EXPR_FLOAT) {
+    *ppval = kft_expr_new_float(-pa->val.float_val.value);
+  } else {
+    return kft_expr_eval_int("-", 0, pa->val.int_val.value, ppval, perrmsg);
+  }
+  return KFT_SUCCESS;
+}
+
+/**
+ * Call a function
+ *
+ * len(S), substr(S, START[, LEN]), upper(S), lower(S), int(X), float(X) and
+ * str(X)
+ *
+ * @param name function name
+ * @param args evaluated arguments
+ * @param nargs number of arguments
+ * @param ppval value
+ * @param perrmsg error message
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_expr_eval_func(const char *name, const kft_expr_t **args,
+                              size_t nargs, const kft_expr_t **ppval,
+                              const char **perrmsg) {
+  bool is_substr = strcmp(name, "substr") == 0;
+  if (is_substr ? nargs < 2 || nargs > 3 : nargs != 1) {
+    *perrmsg = "wrong number of arguments";
+    return KFT_FAILURE;
+  }
+  kft_string_t s = kft_expr_to_string(args[0]);
+
+  if (strcmp(name, "len") == 0) {
+    *ppval = kft_expr_new_int((long)s.len);
+  } else if (strcmp(name, "str") == 0) {
+    *ppval = kft_expr_new_string(s.value, s.len);
+  } else if (strcmp(name, "upper") == 0 || strcmp(name, "lower") == 0) {
+    kft_expr_t *pval = kft_expr_new_string(s.value, s.len);
+    char *p = pval->val.string_val.value;
+    for (size_t i = 0; i < s.len; i++) {
+      p[i] = (char)(name[0] == 'u' ? toupper((unsigned char)p[i])
+                                   : tolower((unsigned char)p[i]));
+    }
+    *ppval = pval;
+  } else if (is_substr) {
+    if (args[1]->type != KFT_EXPR_INT ||
+        (nargs == 3 && args[2]->type != KFT_EXPR_INT)) {
+      *perrmsg = "integer required";
+      return KFT_FAILURE;
+    }
+    // CLAMPED TO THE STRING
+    long start = args[1]->val.int_val.value;
+    size_t off = start < 0 ? 0 : (size_t)start > s.len ? s.len : (size_t)start;
+    size_t len = s.len - off;
+    if (nargs == 3) {
+      long n = args[2]->val.int_val.value;
+      len = n < 0 ? 0 : (size_t)n < len ? (size_t)n : len;
+    }
+    *ppval = kft_expr_new_string(s.value + off, len);
+  } else if (strcmp(name, "int") == 0 || strcmp(name, "float") == 0) {
+    const kft_expr_t *pa = args[0]->type == KFT_EXPR_STRING
+                               ? kft_expr_of_text(s.value, s.len)
+                               : args[0];
+    if (!kft_expr_is_number(pa)) {
+      *perrmsg = "number required";
+      return KFT_FAILURE;
+    }
+    double d = kft_expr_to_double(pa);
+    if (name[0] == 'f') {
+      *ppval = kft_expr_new_float(d);
+    } else if (pa->type == KFT_EXPR_INT) {
+      *ppval = pa;
+    } else if (!(d > (double)LONG_MIN - 1 && d < (double)LONG_MAX)) {
+      *perrmsg = "integer overflow";
+      return KFT_FAILURE;
+    } else {
+      *ppval = kft_expr_new_int((long)d);
+    }
+  } else {
+    *perrmsg = "unknown function";
+    return KFT_FAILURE;
+  }
+  return KFT_SUCCESS;
+}
+
+/**
+ * Evaluate a call (an operation or a function call)
+ *
+ * @param pcall call
+ * @param ppval value
+ * @param perrmsg error message
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_expr_eval_call(const kft_call_t *pcall,
+                              const kft_expr_t **ppval, const char **perrmsg) {
+  if (pcall->callee->type != KFT_EXPR_SYMBOL) {
+    *perrmsg = "not a function";
+    return KFT_FAILURE;
+  }
+  const char *name = pcall->callee->val.symbol_val.name.value;
+  size_t nargs = pcall->nargs;
+
+  // OPERANDS EVALUATED ON DEMAND
+  const kft_expr_t *pa;
+  bool is_and = strcmp(name, "&&") == 0;
+  if (strcmp(name, "?") == 0 || is_and || strcmp(name, "||") == 0) {
+    if (kft_expr_eval(pcall->args[0], &pa, perrmsg) != KFT_SUCCESS) {
+      return KFT_FAILURE;
+    }
+    bool cond = kft_expr_is_true(pa);
+    if (nargs == 3) {
+      return kft_expr_eval(pcall->args[cond ? 1 : 2], ppval, perrmsg);
+    }
+    if (cond != is_and) {
+      *ppval = kft_expr_new_int(cond);
+      return KFT_SUCCESS;
+    }
+    if (kft_expr_eval(pcall->args[1], &pa, perrmsg) != KFT_SUCCESS) {
+      return KFT_FAILURE;
+    }
+    *ppval = kft_expr_new_int(kft_expr_is_true(pa));
+    return KFT_SUCCESS;
+  }
+
+  const kft_expr_t **args =
+      (const kft_expr_t **)kft_malloc(sizeof(kft_expr_t *) * (nargs + 1));
+  for (size_t i = 0; i < nargs; i++) {
+    if (kft_expr_eval(pcall->args[i], &args[i], perrmsg) != KFT_SUCCESS) {
+      return KFT_FAILURE;
+    }
+  }
+  if (isalpha((unsigned char)name[0]) || name[0] == '_') {
+    return kft_expr_eval_func(name, args, nargs, ppval, perrmsg);
+  }
+  if (nargs == 1) {
+    return kft_expr_eval_unary(name, args[0], ppval, perrmsg);
+  }
+  return kft_expr_eval_binary(name, args[0], args[1], ppval, perrmsg);
+}
+
+/**
+ * Evaluate the fields of a tuple
+ *
+ * @param pobj tuple
+ * @param ppval value
+ * @param perrmsg error message
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_expr_eval_tuple(const kft_object_t *pobj,
+                               const kft_expr_t **ppval,
+                               const char **perrmsg) {
+  kft_expr_t **fields =
+      (kft_expr_t **)kft_malloc(sizeof(kft_expr_t *) * (pobj->nfields + 1));
+  for (size_t i = 0; i < pobj->nfields; i++) {
+    const kft_expr_t *pfield;
+    if (kft_expr_eval(pobj->fields[i], &pfield, perrmsg) != KFT_SUCCESS) {
+      return KFT_FAILURE;
+    }
+    fields[i] = (kft_expr_t *)pfield;
+  }
+  *ppval = kft_expr_new_object(pobj->symbol, fields, pobj->nfields);
+  return KFT_SUCCESS;
+}
+
+/**
+ * Evaluate a match (or a bind: 1 if the pattern matches, otherwise 0)
+ *
+ * The variables of the matched pattern are set as template variables.
+ *
+ * @param pexpr match or bind
+ * @param ppval value
+ * @param perrmsg error message
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_expr_eval_match(const kft_expr_t *pexpr,
+                               const kft_expr_t **ppval,
+                               const char **perrmsg) {
+  const kft_match_t *pmatch = pexpr->val.match_val;
+  const kft_expr_t *psubject;
+  if (kft_expr_eval(pmatch->subject, &psubject, perrmsg) != KFT_SUCCESS) {
+    return KFT_FAILURE;
+  }
+
+  size_t arm;
+  kft_binding_t *bindings;
+  size_t nbindings;
+  if (kft_dtree_match(pmatch->tree, psubject, &arm, &bindings, &nbindings) !=
+      KFT_SUCCESS) {
+    if (pexpr->type == KFT_EXPR_BIND) {
+      *ppval = kft_expr_new_int(0);
+      return KFT_SUCCESS;
+    }
+    *perrmsg = "no pattern matched";
+    return KFT_FAILURE;
+  }
+  for (size_t i = 0; i < nbindings; i++) {
+    kft_string_t str = kft_expr_to_string(bindings[i].pval);
+    if (kft_vars_set(bindings[i].name, str.value, str.len) != KFT_SUCCESS) {
+      *perrmsg = "cannot set variable";
+      return KFT_FAILURE;
+    }
+  }
+
+  if (pexpr->type == KFT_EXPR_BIND) {
+    *ppval = kft_expr_new_int(1);
+    return KFT_SUCCESS;
+  }
+  return kft_expr_eval(pmatch->bodies[arm], ppval, perrmsg);
+}
+
+int kft_expr_eval(const kft_expr_t *pexpr, const kft_expr_t **ppval,
+                  const char **perrmsg) {
+  switch (pexpr->type) {
+  case KFT_EXPR_INT:
+  case KFT_EXPR_FLOAT:
+  case KFT_EXPR_STRING:
+    *ppval = pexpr;
+    return KFT_SUCCESS;
+
+  case KFT_EXPR_SYMBOL: {
+    size_t len;
+    const char *value = kft_vars_get(pexpr->val.symbol_val.name.value, &len);
+    if (value == NULL) {
+      *perrmsg = "undefined variable";
+      return KFT_FAILURE;
+    }
+    *ppval = kft_expr_of_text(value, len);
+    return KFT_SUCCESS;
+  }
+
+  case KFT_EXPR_CALL:
+    return kft_expr_eval_call(pexpr->val.call_val, ppval, perrmsg);
+
+  case KFT_EXPR_OBJECT:
+    return kft_expr_eval_tuple(pexpr->val.object_val, ppval, perrmsg);
+
+  case KFT_EXPR_MATCH:
+  case KFT_EXPR_BIND:
+    return kft_expr_eval_match(pexpr, ppval, perrmsg);
+
+  default:
+    *perrmsg = "not a value";
+    return KFT_FAILURE;
+  }
+}
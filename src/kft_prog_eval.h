@@ -0,0 +1,34 @@
+#pragma once
+
+#include "kft.h"
+#include "kft_prog.h"
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Evaluate an expression
+ *
+ * A symbol is a template variable; a variable holding a decimal integer or
+ * floating point number is a number, and any other is a string. A match or a
+ * bind sets the variables of the matched pattern as template variables.
+ *
+ * @param pexpr expression
+ * @param ppval value (an integer, a floating point number, a string or a
+ * tuple)
+ * @param perrmsg error message (set on failure)
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+int kft_expr_eval(const kft_expr_t *pexpr, const kft_expr_t **ppval,
+                  const char **perrmsg)
+    __attribute__((nonnull(1, 2, 3), warn_unused_result));
+
+/**
+ * Format a value
+ *
+ * @param pval value
+ * @return string (a floating point number as %.15g)
+ */
+kft_string_t kft_expr_to_string(const kft_expr_t *pval)
+    __attribute__((nonnull(1), warn_unused_result));
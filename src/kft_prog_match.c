@@ -0,0 +1,445 @@
+#include "kft_prog_match.h"
+#include "kft_hash.h"
+#include "kft_malloc.h"
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+/** no pattern matches */
+#define KFT_DTREE_FAIL 0
+/** a pattern matches */
+#define KFT_DTREE_LEAF 1
+/** test a position */
+#define KFT_DTREE_SWITCH 2
+
+/**
+ * A position in a value (a field of a tuple, recursively).
+ */
+typedef struct kft_occ kft_occ_t;
+
+struct kft_occ {
+  /** tuple of the field (NULL for the value itself) */
+  const kft_occ_t *parent;
+  /** index of the field */
+  size_t index;
+};
+
+/**
+ * The head of a value or a pattern (compared by a switch).
+ */
+typedef struct kft_dtree_key {
+  /** KFT_EXPR_INT, KFT_EXPR_FLOAT, KFT_EXPR_STRING or KFT_EXPR_OBJECT (0 for
+   * others) */
+  int type;
+  /** integer, bits of floating point number or number of fields */
+  uint64_t num;
+  /** string or symbol of object */
+  const char *str;
+  /** length of str */
+  size_t len;
+} kft_dtree_key_t;
+
+/**
+ * A variable bound at a leaf.
+ */
+typedef struct kft_dtree_bind {
+  /** variable name */
+  const char *name;
+  /** position of the value */
+  const kft_occ_t *pocc;
+} kft_dtree_bind_t;
+
+/**
+ * A case of a switch (a slot of the hash table).
+ */
+typedef struct kft_dtree_case {
+  /** head (type 0 when the slot is empty) */
+  kft_dtree_key_t key;
+  /** hash of head */
+  uint64_t hash;
+  /** subtree */
+  kft_dtree_t *child;
+} kft_dtree_case_t;
+
+struct kft_dtree {
+  /** KFT_DTREE_FAIL, KFT_DTREE_LEAF or KFT_DTREE_SWITCH */
+  int kind;
+  /** index of the pattern (leaf) */
+  size_t arm;
+  /** bound variables (leaf) */
+  kft_dtree_bind_t *binds;
+  /** number of bound variables (leaf) */
+  size_t nbinds;
+  /** position tested (switch) */
+  const kft_occ_t *pocc;
+  /** cases (switch; open addressing, linear probing) */
+  kft_dtree_case_t *cases;
+  /** number of slots of cases (power of 2) */
+  size_t nslots;
+  /** subtree when no case matches (switch) */
+  kft_dtree_t *pdefault;
+};
+
+/**
+ * A row of the pattern matrix (the rest of a pattern to be tested).
+ */
+typedef struct kft_dtree_row {
+  /** patterns by column */
+  kft_expr_t **pats;
+  /** index of the pattern */
+  size_t arm;
+  /** variables bound so far */
+  kft_dtree_bind_t *binds;
+  /** number of variables bound so far */
+  size_t nbinds;
+} kft_dtree_row_t;
+
+/**
+ * Get the head of a value or a pattern
+ *
+ * @param pexpr value or pattern
+ * @return head (type 0 for a variable)
+ */
+static kft_dtree_key_t kft_dtree_key_of(const kft_expr_t *pexpr) {
+  kft_dtree_key_t key = {.type = 0, .num = 0, .str = NULL, .len = 0};
+  switch (pexpr->type) {
+  case KFT_EXPR_INT:
+    key.type = KFT_EXPR_INT;
+    key.num = (uint64_t)pexpr->val.int_val.value;
+    break;
+  case KFT_EXPR_FLOAT: {
+    // AN INTEGRAL NUMBER IS THE INTEGER
+    double d = pexpr->val.float_val.value;
+    if (d >= (double)LONG_MIN && d < (double)LONG_MAX && d == (double)(long)d) {
+      key.type = KFT_EXPR_INT;
+      key.num = (uint64_t)(long)d;
+    } else {
+      key.type = KFT_EXPR_FLOAT;
+      memcpy(&key.num, &d, sizeof(key.num));
+    }
+    break;
+  }
+  case KFT_EXPR_STRING:
+    key.type = KFT_EXPR_STRING;
+    key.str = pexpr->val.string_val.value;
+    key.len = pexpr->val.string_val.len;
+    break;
+  case KFT_EXPR_OBJECT:
+    key.type = KFT_EXPR_OBJECT;
+    key.num = pexpr->val.object_val->nfields;
+    key.str = pexpr->val.object_val->symbol.name.value;
+    key.len = pexpr->val.object_val->symbol.name.len;
+    break;
+  }
+  return key;
+}
+
+/**
+ * Hash a head
+ *
+ * @param pkey head
+ * @return hash
+ */
+static uint64_t kft_dtree_key_hash(const kft_dtree_key_t *pkey) {
+  uint64_t h = kft_hash_key(&pkey->num, sizeof(pkey->num));
+  if (pkey->str != NULL) {
+    h ^= kft_hash_key(pkey->str, pkey->len);
+  }
+  return h ^ (uint64_t)pkey->type;
+}
+
+/**
+ * Compare heads
+ *
+ * @param pa head
+ * @param pb head
+ * @return true if equal
+ */
+static bool kft_dtree_key_equal(const kft_dtree_key_t *pa,
+                                const kft_dtree_key_t *pb) {
+  return pa->type == pb->type && pa->num == pb->num && pa->len == pb->len &&
+         (pa->len == 0 || memcmp(pa->str, pb->str, pa->len) == 0);
+}
+
+/**
+ * Find the slot of a head in a switch
+ *
+ * @param ptree switch
+ * @param pkey head
+ * @param hash hash of head
+ * @return slot (empty if not found)
+ */
+static kft_dtree_case_t *kft_dtree_find(const kft_dtree_t *ptree,
+                                        const kft_dtree_key_t *pkey,
+                                        uint64_t hash) {
+  size_t mask = ptree->nslots - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    kft_dtree_case_t *pcase = &ptree->cases[i];
+    if (pcase->key.type == 0 ||
+        (pcase->hash == hash && kft_dtree_key_equal(&pcase->key, pkey))) {
+      return pcase;
+    }
+  }
+}
+
+/**
+ * Test whether a pattern is a variable
+ *
+ * @param ppat pattern
+ * @return true if a variable
+ */
+static inline bool kft_dtree_is_var(const kft_expr_t *ppat) {
+  return ppat->type == KFT_EXPR_SYMBOL;
+}
+
+/**
+ * Add a variable bound by a row
+ *
+ * @param prow row
+ * @param ppat pattern (a variable)
+ * @param pocc position
+ * @param pnbinds number of bound variables
+ * @return bound variables
+ */
+static kft_dtree_bind_t *kft_dtree_bind(const kft_dtree_row_t *prow,
+                                        const kft_expr_t *ppat,
+                                        const kft_occ_t *pocc,
+                                        size_t *pnbinds) {
+  const kft_string_t *pname = &ppat->val.symbol_val.name;
+  *pnbinds = prow->nbinds;
+  if (strcmp(pname->value, "_") == 0) {
+    return prow->binds;
+  }
+  kft_dtree_bind_t *binds = (kft_dtree_bind_t *)kft_malloc(
+      sizeof(kft_dtree_bind_t) * (prow->nbinds + 1));
+  if (prow->nbinds > 0) {
+    memcpy(binds, prow->binds, sizeof(kft_dtree_bind_t) * prow->nbinds);
+  }
+  binds[(*pnbinds)++] = (kft_dtree_bind_t){.name = pname->value, .pocc = pocc};
+  return binds;
+}
+
+/**
+ * Build the decision tree of a pattern matrix
+ *
+ * @param rows rows (in order of priority)
+ * @param nrows number of rows
+ * @param occs positions by column
+ * @param ncols number of columns
+ * @param pwild a variable binding nothing
+ * @return decision tree
+ */
+static kft_dtree_t *kft_dtree_build(const kft_dtree_row_t *rows, size_t nrows,
+                                    const kft_occ_t *const *occs, size_t ncols,
+                                    kft_expr_t *pwild) {
+  kft_dtree_t *ptree = (kft_dtree_t *)kft_malloc(sizeof(kft_dtree_t));
+  memset(ptree, 0, sizeof(kft_dtree_t));
+  if (nrows == 0) {
+    ptree->kind = KFT_DTREE_FAIL;
+    return ptree;
+  }
+
+  // THE FIRST ROW MATCHES IF IT HAS ONLY VARIABLES
+  size_t col = 0;
+  while (col < ncols && kft_dtree_is_var(rows[0].pats[col])) {
+    col++;
+  }
+  if (col == ncols) {
+    kft_dtree_row_t row = rows[0];
+    for (size_t j = 0; j < ncols; j++) {
+      row.binds = kft_dtree_bind(&row, row.pats[j], occs[j], &row.nbinds);
+    }
+    ptree->kind = KFT_DTREE_LEAF;
+    ptree->arm = row.arm;
+    ptree->binds = row.binds;
+    ptree->nbinds = row.nbinds;
+    return ptree;
+  }
+
+  // SWITCH ON THE FIRST COLUMN THE FIRST ROW TESTS
+  ptree->kind = KFT_DTREE_SWITCH;
+  ptree->pocc = occs[col];
+  ptree->nslots = 2;
+  while (ptree->nslots < nrows * 2) {
+    ptree->nslots *= 2;
+  }
+  ptree->cases =
+      (kft_dtree_case_t *)kft_malloc(sizeof(kft_dtree_case_t) * ptree->nslots);
+  memset(ptree->cases, 0, sizeof(kft_dtree_case_t) * ptree->nslots);
+
+  kft_dtree_row_t *subrows =
+      (kft_dtree_row_t *)kft_malloc(sizeof(kft_dtree_row_t) * nrows);
+  for (size_t i = 0; i < nrows; i++) {
+    const kft_expr_t *phead = rows[i].pats[col];
+    if (kft_dtree_is_var(phead)) {
+      continue;
+    }
+    kft_dtree_key_t key = kft_dtree_key_of(phead);
+    uint64_t hash = kft_dtree_key_hash(&key);
+    kft_dtree_case_t *pcase = kft_dtree_find(ptree, &key, hash);
+    if (pcase->key.type != 0) {
+      // THE HEAD IS DONE BY AN EARLIER ROW
+      continue;
+    }
+
+    // THE ROWS OF THE HEAD: FIELDS OF A TUPLE REPLACE THE COLUMN
+    size_t nfields = key.type == KFT_EXPR_OBJECT ? (size_t)key.num : 0;
+    size_t nsubcols = ncols - 1 + nfields;
+    const kft_occ_t **suboccs =
+        (const kft_occ_t **)kft_malloc(sizeof(kft_occ_t *) * (nsubcols + 1));
+    for (size_t k = 0; k < nfields; k++) {
+      kft_occ_t *pocc = (kft_occ_t *)kft_malloc(sizeof(kft_occ_t));
+      *pocc = (kft_occ_t){.parent = occs[col], .index = k};
+      suboccs[k] = pocc;
+    }
+    memcpy(suboccs + nfields, occs, sizeof(kft_occ_t *) * col);
+    memcpy(suboccs + nfields + col, occs + col + 1,
+           sizeof(kft_occ_t *) * (ncols - col - 1));
+    size_t nsubrows = 0;
+    for (size_t r = i; r < nrows; r++) {
+      const kft_expr_t *ppat = rows[r].pats[col];
+      kft_dtree_row_t row = rows[r];
+      if (kft_dtree_is_var(ppat)) {
+        row.binds = kft_dtree_bind(&rows[r], ppat, occs[col], &row.nbinds);
+      } else {
+        kft_dtree_key_t key2 = kft_dtree_key_of(ppat);
+        if (!kft_dtree_key_equal(&key, &key2)) {
+          continue;
+        }
+      }
+      row.pats = (kft_expr_t **)kft_malloc(sizeof(kft_expr_t *) *
+                                           (nsubcols + 1));
+      for (size_t k = 0; k < nfields; k++) {
+        row.pats[k] = kft_dtree_is_var(ppat) ? pwild
+                                             : ppat->val.object_val->fields[k];
+      }
+      memcpy(row.pats + nfields, rows[r].pats, sizeof(kft_expr_t *) * col);
+      memcpy(row.pats + nfields + col, rows[r].pats + col + 1,
+             sizeof(kft_expr_t *) * (ncols - col - 1));
+      subrows[nsubrows++] = row;
+    }
+    // ROWS OF VARIABLES BEFORE THE FIRST ROW OF THE HEAD
+    if (i > 0) {
+      size_t nvars = 0;
+      for (size_t r = 0; r < i; r++) {
+        nvars += kft_dtree_is_var(rows[r].pats[col]) ? 1 : 0;
+      }
+      if (nvars > 0) {
+        kft_dtree_row_t *merged = (kft_dtree_row_t *)kft_malloc(
+            sizeof(kft_dtree_row_t) * (nvars + nsubrows));
+        size_t n = 0;
+        for (size_t r = 0; r < i; r++) {
+          const kft_expr_t *ppat = rows[r].pats[col];
+          if (!kft_dtree_is_var(ppat)) {
+            continue;
+          }
+          kft_dtree_row_t row = rows[r];
+          row.binds = kft_dtree_bind(&rows[r], ppat, occs[col], &row.nbinds);
+          row.pats = (kft_expr_t **)kft_malloc(sizeof(kft_expr_t *) *
+                                               (nsubcols + 1));
+          for (size_t k = 0; k < nfields; k++) {
+            row.pats[k] = pwild;
+          }
+          memcpy(row.pats + nfields, rows[r].pats, sizeof(kft_expr_t *) * col);
+          memcpy(row.pats + nfields + col, rows[r].pats + col + 1,
+                 sizeof(kft_expr_t *) * (ncols - col - 1));
+          merged[n++] = row;
+        }
+        memcpy(merged + n, subrows, sizeof(kft_dtree_row_t) * nsubrows);
+        kft_dtree_t *pchild =
+            kft_dtree_build(merged, n + nsubrows, suboccs, nsubcols, pwild);
+        *pcase = (kft_dtree_case_t){.key = key, .hash = hash, .child = pchild};
+        continue;
+      }
+    }
+    kft_dtree_t *pchild =
+        kft_dtree_build(subrows, nsubrows, suboccs, nsubcols, pwild);
+    *pcase = (kft_dtree_case_t){.key = key, .hash = hash, .child = pchild};
+  }
+
+  // THE ROWS OF ANY OTHER HEAD
+  size_t ndefrows = 0;
+  const kft_occ_t **defoccs =
+      (const kft_occ_t **)kft_malloc(sizeof(kft_occ_t *) * ncols);
+  memcpy(defoccs, occs, sizeof(kft_occ_t *) * col);
+  memcpy(defoccs + col, occs + col + 1,
+         sizeof(kft_occ_t *) * (ncols - col - 1));
+  for (size_t r = 0; r < nrows; r++) {
+    const kft_expr_t *ppat = rows[r].pats[col];
+    if (!kft_dtree_is_var(ppat)) {
+      continue;
+    }
+    kft_dtree_row_t row = rows[r];
+    row.binds = kft_dtree_bind(&rows[r], ppat, occs[col], &row.nbinds);
+    row.pats = (kft_expr_t **)kft_malloc(sizeof(kft_expr_t *) * ncols);
+    memcpy(row.pats, rows[r].pats, sizeof(kft_expr_t *) * col);
+    memcpy(row.pats + col, rows[r].pats + col + 1,
+           sizeof(kft_expr_t *) * (ncols - col - 1));
+    subrows[ndefrows++] = row;
+  }
+  ptree->pdefault = kft_dtree_build(subrows, ndefrows, defoccs, ncols - 1,
+                                    pwild);
+  return ptree;
+}
+
+kft_dtree_t *kft_dtree_compile(kft_expr_t *const *patterns,
+                               size_t npatterns) {
+  kft_occ_t *proot = (kft_occ_t *)kft_malloc(sizeof(kft_occ_t));
+  *proot = (kft_occ_t){.parent = NULL, .index = 0};
+  const kft_occ_t *occs[] = {proot};
+  kft_dtree_row_t *rows =
+      (kft_dtree_row_t *)kft_malloc(sizeof(kft_dtree_row_t) * (npatterns + 1));
+  for (size_t i = 0; i < npatterns; i++) {
+    kft_expr_t **pats = (kft_expr_t **)kft_malloc(sizeof(kft_expr_t *));
+    pats[0] = patterns[i];
+    rows[i] = (kft_dtree_row_t){
+        .pats = pats, .arm = i, .binds = NULL, .nbinds = 0};
+  }
+  kft_expr_t *pwild = kft_expr_new_symbol(kft_string_new("_", 1));
+  return kft_dtree_build(rows, npatterns, occs, 1, pwild);
+}
+
+/**
+ * Get the value at a position
+ *
+ * @param pocc position
+ * @param pval value
+ * @return value at the position
+ */
+static const kft_expr_t *kft_dtree_value(const kft_occ_t *pocc,
+                                         const kft_expr_t *pval) {
+  if (pocc->parent == NULL) {
+    return pval;
+  }
+  // THE TUPLE IS TESTED BEFORE ITS FIELDS
+  const kft_expr_t *ptuple = kft_dtree_value(pocc->parent, pval);
+  return ptuple->val.object_val->fields[pocc->index];
+}
+
+int kft_dtree_match(const kft_dtree_t *ptree, const kft_expr_t *pval,
+                    size_t *parm, kft_binding_t **pbindings,
+                    size_t *pnbindings) {
+  while (ptree->kind == KFT_DTREE_SWITCH) {
+    kft_dtree_key_t key = kft_dtree_key_of(kft_dtree_value(ptree->pocc, pval));
+    const kft_dtree_case_t *pcase = NULL;
+    if (key.type != 0) {
+      pcase = kft_dtree_find(ptree, &key, kft_dtree_key_hash(&key));
+    }
+    ptree = pcase != NULL && pcase->key.type != 0 ? pcase->child
+                                                  : ptree->pdefault;
+  }
+  if (ptree->kind == KFT_DTREE_FAIL) {
+    return KFT_FAILURE;
+  }
+
+  kft_binding_t *bindings =
+      (kft_binding_t *)kft_malloc(sizeof(kft_binding_t) * (ptree->nbinds + 1));
+  for (size_t i = 0; i < ptree->nbinds; i++) {
+    bindings[i].name = ptree->binds[i].name;
+    bindings[i].pval = kft_dtree_value(ptree->binds[i].pocc, pval);
+  }
+  *parm = ptree->arm;
+  *pbindings = bindings;
+  *pnbindings = ptree->nbinds;
+  return KFT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "kft.h"
+#include "kft_prog.h"
+
+/**
+ * A variable bound by a match.
+ */
+typedef struct kft_binding {
+  /** variable name */
+  const char *name;
+  /** value */
+  const kft_expr_t *pval;
+} kft_binding_t;
+
+/* --------------------------------------------- *
+ * Constructors and Destructors                  *
+ * --------------------------------------------- */
+
+/**
+ * Compile patterns into a decision tree
+ *
+ * A pattern is a literal (an integer, a floating point number or a string),
+ * a variable (a symbol; _ binds nothing) or a tuple of patterns. The tree
+ * tests each position of a value once and selects the next test by a hash
+ * table, so a value is not tried against the patterns in turn.
+ *
+ * @param patterns patterns (the first matching one is selected)
+ * @param npatterns number of patterns
+ * @return decision tree
+ */
+kft_dtree_t *kft_dtree_compile(kft_expr_t *const *patterns, size_t npatterns)
+    __attribute__((warn_unused_result, returns_nonnull));
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Match a value by a decision tree
+ *
+ * A literal matches an equal number or an identical string.
+ *
+ * @param ptree decision tree
+ * @param pval value
+ * @param parm index of the matched pattern
+ * @param pbindings variables bound by the pattern
+ * @param pnbindings number of bound variables
+ * @return KFT_SUCCESS, or KFT_FAILURE if no pattern matches
+ */
+int kft_dtree_match(const kft_dtree_t *ptree, const kft_expr_t *pval,
+                    size_t *parm, kft_binding_t **pbindings,
+                    size_t *pnbindings)
+    __attribute__((nonnull(1, 2, 3, 4, 5), warn_unused_result));
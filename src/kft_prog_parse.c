@@ -1,9 +1,53 @@
 #include "kft_prog_parse.h"
+#include "kft_malloc.h"
 #include "kft_prog_parse_float.h"
 #include "kft_prog_parse_int.h"
-#include "kft_prog_parse_object.h"
+#include "kft_hash.h"
+#include "kft_prog_parse_op.h"
+#include "kft_prog_parse_pattern.h"
 #include "kft_prog_parse_string.h"
+#include "kft_prog_parse_symbol.h"
 #include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** maximum number of parsed expressions cached by kft_prog_parse */
+#define KFT_PARSE_CACHE_MAX 1024
+
+/**
+ * A parsed expression cached by its text.
+ */
+typedef struct kft_parse_cache_entry {
+  /** text (NULL when the slot is empty) */
+  char *str;
+  /** length of text */
+  size_t len;
+  /** hash of text */
+  uint64_t hash;
+  /** expression */
+  kft_expr_t *pexpr;
+} kft_parse_cache_entry_t;
+
+/** cached expressions (open addressing, linear probing; 2 *
+ * KFT_PARSE_CACHE_MAX slots) */
+static kft_parse_cache_entry_t *kft_parse_cache = NULL;
+
+/** number of cached expressions */
+static size_t kft_parse_cache_count = 0;
+
+void kft_parse_init(kft_parse_context_t *ppc, kft_input_t *pi) {
+  ppc->pi = pi;
+  ppc->nread = 0;
+  ppc->ch_last = '\0';
+  // NEVER FAILS BEFORE EOF
+  (void)kft_fetch(ppc);
+}
+
+void kft_parse_restore(kft_parse_context_t *ppc,
+                       const kft_parse_context_t *psaved) {
+  kft_input_rollback(ppc->pi, ppc->nread - psaved->nread);
+  *ppc = *psaved;
+}
 
 int kft_fetch(kft_parse_context_t *ppc) {
   if (KFT_GETLASTC(ppc) == EOF) {
@@ -12,8 +56,8 @@ int kft_fetch(kft_parse_context_t *ppc) {
   int ch = kft_fetch_raw(ppc->pi);
   if (ch != EOF) {
     ppc->nread++;
-    ppc->ch_last = ch;
   }
+  ppc->ch_last = ch;
   return KFT_PARSE_OK;
 }
 
@@ -28,44 +72,304 @@ int kft_parse_spaces(kft_parse_context_t *ppc, size_t *pnaccepted) {
   return KFT_PARSE_OK;
 }
 
-int kft_parse_expr(kft_parse_context_t *ppc, size_t *pnaccepted,
-                   kft_expr_t *pexpr) {
+int kft_parse_number(kft_parse_context_t *ppc, size_t *pnaccepted,
+                     kft_expr_t **ppexpr) {
   size_t naccepted = *pnaccepted;
 
-  kft_expr_t expr;
-  int ret;
-
-  ret = kft_parse_object(ppc, &naccepted, &expr.val.object_val);
-  if (ret == KFT_PARSE_OK) {
-    pexpr->type = KFT_EXPR_OBJECT;
+  kft_parse_context_t saved = *ppc;
+  kft_int_t intval;
+  int ret = kft_parse_int_num(ppc, &naccepted, &intval);
+  int ch = KFT_GETLASTC(ppc);
+  if (ret == KFT_PARSE_OK && ch != '.' && ch != 'e' && ch != 'E') {
+    *ppexpr = kft_expr_new_int(intval.value);
 
     *pnaccepted = naccepted;
     return KFT_PARSE_OK;
   }
 
-  ret = kft_parse_float(ppc, &naccepted, &expr.val.float_val);
-  if (ret == KFT_PARSE_OK) {
-    pexpr->type = KFT_EXPR_FLOAT;
+  // TOO LARGE FOR AN INTEGER, OR A FLOATING POINT NUMBER
+  kft_parse_restore(ppc, &saved);
+  naccepted = *pnaccepted;
+  kft_float_t floatval;
+  KFT_PARSE(float, ppc, &naccepted, &floatval);
+  *ppexpr = kft_expr_new_float(floatval.value);
 
-    *pnaccepted = naccepted;
-    return KFT_PARSE_OK;
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+/**
+ * Parse the arguments of a function call
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param pargs arguments
+ * @param pnargs number of arguments
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+static int kft_parse_args(kft_parse_context_t *ppc, size_t *pnaccepted,
+                          kft_expr_t ***pargs, size_t *pnargs) {
+  size_t naccepted = *pnaccepted;
+
+  kft_expr_t **args = NULL;
+  size_t nargs = 0;
+
+  KFT_ACCEPT(ppc, &naccepted); // (
+  KFT_PARSE(spaces, ppc, &naccepted);
+  if (KFT_GETLASTC(ppc) != ')') {
+    while (1) {
+      kft_expr_t *parg;
+      KFT_PARSE(expr, ppc, &naccepted, &parg);
+      args = (kft_expr_t **)kft_realloc(args,
+                                        sizeof(kft_expr_t *) * (nargs + 1));
+      args[nargs++] = parg;
+      KFT_PARSE(spaces, ppc, &naccepted);
+      if (KFT_GETLASTC(ppc) != ',') {
+        break;
+      }
+      KFT_ACCEPT(ppc, &naccepted);
+    }
   }
+  if (KFT_GETLASTC(ppc) != ')') {
+    return KFT_PARSE_ERROR;
+  }
+  KFT_ACCEPT(ppc, &naccepted);
 
-  ret = kft_parse_int(ppc, &naccepted, &expr.val.int_val);
-  if (ret == KFT_PARSE_OK) {
-    pexpr->type = KFT_EXPR_INT;
+  *pargs = args;
+  *pnargs = nargs;
 
-    *pnaccepted = naccepted;
-    return KFT_PARSE_OK;
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+/**
+ * Parse a tuple or an expression in parentheses
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param ppexpr expression
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+static int kft_parse_tuple(kft_parse_context_t *ppc, size_t *pnaccepted,
+                           kft_expr_t **ppexpr) {
+  size_t naccepted = *pnaccepted;
+
+  kft_expr_t **fields = NULL;
+  size_t nfields = 0;
+  bool tuple = false;
+
+  KFT_ACCEPT(ppc, &naccepted); // (
+  KFT_PARSE(spaces, ppc, &naccepted);
+  while (KFT_GETLASTC(ppc) != ')') {
+    kft_expr_t *pfield;
+    KFT_PARSE(expr, ppc, &naccepted, &pfield);
+    fields = (kft_expr_t **)kft_realloc(fields,
+                                        sizeof(kft_expr_t *) * (nfields + 1));
+    fields[nfields++] = pfield;
+    KFT_PARSE(spaces, ppc, &naccepted);
+    if (KFT_GETLASTC(ppc) != ',') {
+      break;
+    }
+    tuple = true;
+    KFT_ACCEPT(ppc, &naccepted);
+    KFT_PARSE(spaces, ppc, &naccepted);
+  }
+  if (KFT_GETLASTC(ppc) != ')') {
+    return KFT_PARSE_ERROR;
+  }
+  KFT_ACCEPT(ppc, &naccepted);
+
+  // (E) IS E, () AND (E,) ARE TUPLES
+  *ppexpr = nfields == 1 && !tuple ? fields[0]
+                                   : kft_expr_new_tuple(fields, nfields);
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+/**
+ * Parse the arms of a match (after the symbol match)
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param ppexpr expression
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+static int kft_parse_match(kft_parse_context_t *ppc, size_t *pnaccepted,
+                           kft_expr_t **ppexpr) {
+  size_t naccepted = *pnaccepted;
+
+  kft_expr_t *psubject;
+  kft_expr_t **patterns = NULL;
+  kft_expr_t **bodies = NULL;
+  size_t narms = 0;
+
+  KFT_ACCEPT(ppc, &naccepted); // (
+  KFT_PARSE(expr, ppc, &naccepted, &psubject);
+  while (1) {
+    KFT_PARSE(spaces, ppc, &naccepted);
+    if (KFT_GETLASTC(ppc) != ',') {
+      break;
+    }
+    KFT_ACCEPT(ppc, &naccepted);
+    KFT_PARSE(spaces, ppc, &naccepted);
+    if (KFT_GETLASTC(ppc) == ')') {
+      break;
+    }
+    kft_expr_t *ppattern, *pbody;
+    KFT_PARSE(pattern, ppc, &naccepted, &ppattern);
+    char op[KFT_PARSE_OP_MAX];
+    KFT_PARSE(op, ppc, &naccepted, op);
+    if (strcmp(op, "=>") != 0) {
+      return KFT_PARSE_ERROR;
+    }
+    KFT_PARSE(expr, ppc, &naccepted, &pbody);
+    patterns = (kft_expr_t **)kft_realloc(patterns,
+                                          sizeof(kft_expr_t *) * (narms + 1));
+    bodies = (kft_expr_t **)kft_realloc(bodies,
+                                        sizeof(kft_expr_t *) * (narms + 1));
+    patterns[narms] = ppattern;
+    bodies[narms] = pbody;
+    narms++;
+  }
+  if (narms == 0 || KFT_GETLASTC(ppc) != ')') {
+    return KFT_PARSE_ERROR;
+  }
+  KFT_ACCEPT(ppc, &naccepted);
+
+  *ppexpr = kft_expr_new_match(psubject, patterns, bodies, narms);
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+int kft_parse_primary(kft_parse_context_t *ppc, size_t *pnaccepted,
+                      kft_expr_t **ppexpr) {
+  size_t naccepted = *pnaccepted;
+
+  kft_expr_t *pexpr;
+
+  KFT_PARSE(spaces, ppc, &naccepted);
+  int ch = KFT_GETLASTC(ppc);
+  if (ch == '(') {
+    KFT_PARSE(tuple, ppc, &naccepted, &pexpr);
+  } else if (ch == '"') {
+    kft_string_t strval;
+    KFT_PARSE(string, ppc, &naccepted, &strval);
+    pexpr = kft_expr_new_string(strval.value, strval.len);
+    free(strval.value);
+  } else if (ch == '\'') {
+    kft_int_t intval;
+    KFT_PARSE(int_char, ppc, &naccepted, &intval);
+    pexpr = kft_expr_new_int(intval.value);
+  } else if (isdigit(ch)) {
+    KFT_PARSE(number, ppc, &naccepted, &pexpr);
+  } else if (isalpha(ch) || ch == '_') {
+    // VARIABLE OR FUNCTION CALL
+    kft_symbol_t symbol;
+    KFT_PARSE(symbol, ppc, &naccepted, &symbol);
+    KFT_PARSE(spaces, ppc, &naccepted);
+    if (KFT_GETLASTC(ppc) == '(' && strcmp(symbol.name.value, "match") == 0) {
+      KFT_PARSE(match, ppc, &naccepted, &pexpr);
+    } else if (KFT_GETLASTC(ppc) == '(') {
+      kft_expr_t **args;
+      size_t nargs;
+      KFT_PARSE(args, ppc, &naccepted, &args, &nargs);
+      pexpr = kft_expr_new_call(kft_expr_new_symbol(symbol.name), args, nargs);
+    } else {
+      pexpr = kft_expr_new_symbol(symbol.name);
+    }
+  } else {
+    return KFT_PARSE_ERROR;
   }
 
-  ret = kft_parse_string(ppc, &naccepted, &expr.val.string_val);
+  *ppexpr = pexpr;
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+int kft_parse_expr(kft_parse_context_t *ppc, size_t *pnaccepted,
+                   kft_expr_t **ppexpr) {
+  size_t naccepted = *pnaccepted;
+
+  // A BIND IF A PATTERN IS FOLLOWED BY =
+  kft_parse_context_t saved = *ppc;
+  kft_expr_t *ppattern;
+  char op[KFT_PARSE_OP_MAX];
+  if (kft_parse_pattern(ppc, &naccepted, &ppattern) != KFT_PARSE_OK ||
+      kft_parse_op(ppc, &naccepted, op) != KFT_PARSE_OK ||
+      strcmp(op, "=") != 0) {
+    kft_parse_restore(ppc, &saved);
+    return kft_parse_ternary(ppc, pnaccepted, ppexpr);
+  }
+
+  kft_expr_t *pexpr;
+  KFT_PARSE(expr, ppc, &naccepted, &pexpr);
+  *ppexpr = kft_expr_new_bind(ppattern, pexpr);
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+int kft_prog_parse(const char *str, size_t len, kft_expr_t **ppexpr) {
+  // AN EXPRESSION IN A LOOP IS PARSED (AND ITS MATCHES COMPILED) ONCE
+  uint64_t hash = kft_hash_key(str, len);
+  size_t mask = KFT_PARSE_CACHE_MAX * 2 - 1;
+  size_t slot = hash & mask;
+  if (kft_parse_cache != NULL) {
+    for (;; slot = (slot + 1) & mask) {
+      kft_parse_cache_entry_t *pent = &kft_parse_cache[slot];
+      if (pent->str == NULL) {
+        break;
+      }
+      if (pent->hash == hash && pent->len == len &&
+          memcmp(pent->str, str, len) == 0) {
+        *ppexpr = pent->pexpr;
+        return KFT_PARSE_OK;
+      }
+    }
+  }
+
+  kft_ispec_t ispec =
+      kft_ispec_init(KFT_OPTDEF_ESCAPE, KFT_OPTDEF_BEGIN, KFT_OPTDEF_END);
+  kft_input_t *pi = kft_input_new_mem(str, len, ispec);
+  kft_parse_context_t pc;
+  kft_parse_init(&pc, pi);
+
+  size_t naccepted = 0;
+  kft_expr_t *pexpr = NULL;
+  int ret = kft_parse_expr(&pc, &naccepted, &pexpr);
   if (ret == KFT_PARSE_OK) {
-    pexpr->type = KFT_EXPR_STRING;
+    ret = kft_parse_spaces(&pc, &naccepted);
+  }
+  // THE WHOLE STRING IS AN EXPRESSION
+  if (ret == KFT_PARSE_OK && KFT_GETLASTC(&pc) != EOF) {
+    ret = KFT_PARSE_ERROR;
+  }
+  kft_input_delete(pi);
+  if (ret != KFT_PARSE_OK) {
+    return KFT_PARSE_ERROR;
+  }
 
-    *pnaccepted = naccepted;
-    return KFT_PARSE_OK;
+  // CACHE (CLEARED WHEN FULL)
+  if (kft_parse_cache == NULL || kft_parse_cache_count == KFT_PARSE_CACHE_MAX) {
+    kft_parse_cache = (kft_parse_cache_entry_t *)kft_malloc(
+        sizeof(kft_parse_cache_entry_t) * KFT_PARSE_CACHE_MAX * 2);
+    memset(kft_parse_cache, 0,
+           sizeof(kft_parse_cache_entry_t) * KFT_PARSE_CACHE_MAX * 2);
+    kft_parse_cache_count = 0;
+    for (slot = hash & mask; kft_parse_cache[slot].str != NULL;
+         slot = (slot + 1) & mask) {
+    }
   }
+  kft_parse_cache_entry_t *pent = &kft_parse_cache[slot];
+  pent->str = kft_string_new(str, len).value;
+  pent->len = len;
+  pent->hash = hash;
+  pent->pexpr = pexpr;
+  kft_parse_cache_count++;
 
-  return KFT_PARSE_ERROR;
-}
\ No newline at end of file
+  *ppexpr = pexpr;
+  return KFT_PARSE_OK;
+}
@@ -54,19 +54,85 @@ typedef struct kft_parse_context {
     _ret;                                                                      \
   })
 
+/**
+ * Run a parser, or another one from the same position if it fails
+ */
 #define KFT_PARSE_CHOICE(name1, name2, ppc, pnaccepted, ...)                   \
   ({                                                                           \
+    kft_parse_context_t _saved = *(ppc);                                       \
     int _ret = kft_parse_##name1((ppc), (pnaccepted), ##__VA_ARGS__);          \
     if (_ret == KFT_PARSE_ERROR) {                                             \
-      kft_input_rollback((ppc)->pi, *(pnaccepted));                            \
+      kft_parse_restore((ppc), &_saved);                                       \
       _ret = kft_parse_##name2((ppc), (pnaccepted), ##__VA_ARGS__);            \
     }                                                                          \
     _ret;                                                                      \
   })
 
+/**
+ * Initialize a parser context (fetch the first char)
+ *
+ * @param ppc parser context
+ * @param pi input stream (read raw)
+ */
+void kft_parse_init(kft_parse_context_t *ppc, kft_input_t *pi)
+    __attribute__((nonnull(1, 2)));
+
+/**
+ * Go back to a saved parser context (of the same input stream)
+ *
+ * @param ppc parser context
+ * @param psaved saved parser context
+ */
+void kft_parse_restore(kft_parse_context_t *ppc,
+                       const kft_parse_context_t *psaved)
+    __attribute__((nonnull(1, 2)));
+
 int kft_fetch(kft_parse_context_t *ppc);
 
 int kft_parse_spaces(kft_parse_context_t *ppc, size_t *pnaccepted);
 
+/**
+ * Parse an integer, or a floating point number if it has a fraction or an
+ * exponent
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param ppexpr expression
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+int kft_parse_number(kft_parse_context_t *ppc, size_t *pnaccepted,
+                     kft_expr_t **ppexpr);
+
+/**
+ * Parse a primary expression (a literal, a variable, a function call, a
+ * match, a tuple or an expression in parentheses)
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param ppexpr expression
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+int kft_parse_primary(kft_parse_context_t *ppc, size_t *pnaccepted,
+                      kft_expr_t **ppexpr);
+
+/**
+ * Parse an expression (a bind PATTERN = EXPR or a conditional operation)
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param ppexpr expression
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
 int kft_parse_expr(kft_parse_context_t *ppc, size_t *pnaccepted,
-                   kft_expr_t *pexpr);
+                   kft_expr_t **ppexpr);
+
+/**
+ * Parse a whole string as an expression (parsed strings are cached)
+ *
+ * @param str string
+ * @param len length of string
+ * @param ppexpr expression
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+int kft_prog_parse(const char *str, size_t len, kft_expr_t **ppexpr)
+    __attribute__((nonnull(1, 3), warn_unused_result));
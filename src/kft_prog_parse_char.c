@@ -3,7 +3,7 @@
 
 int kft_parse_char_escoct(kft_parse_context_t *ppc, size_t *pnaccepted,
                           int *pch) {
-  int naccepted = *pnaccepted;
+  size_t naccepted = *pnaccepted;
 
   int och = 0;
   int ich = KFT_GETLASTC(ppc);
@@ -24,7 +24,7 @@ int kft_parse_char_escoct(kft_parse_context_t *ppc, size_t *pnaccepted,
   och <<= 3;
   och += ich - '0';
   ich = KFT_ACCEPT(ppc, &naccepted); // oo
-  if (!isodigit(ich) || och >= 4) {
+  if (!isodigit(ich) || och >= 040) {
     *pch = och;
 
     *pnaccepted = naccepted;
@@ -42,7 +42,7 @@ int kft_parse_char_escoct(kft_parse_context_t *ppc, size_t *pnaccepted,
 
 int kft_parse_char_eschex(kft_parse_context_t *ppc, size_t *pnaccepted,
                           int *pch) {
-  int naccepted = *pnaccepted;
+  size_t naccepted = *pnaccepted;
 
   int och = 0;
   int ich = KFT_GETLASTC(ppc);
@@ -70,6 +70,7 @@ int kft_parse_char_eschex(kft_parse_context_t *ppc, size_t *pnaccepted,
   } else {
     och += tolower(ich) - 'a' + 10;
   }
+  KFT_ACCEPT(ppc, &naccepted); // xx
 
   *pch = och;
 
@@ -137,7 +138,13 @@ int kft_parse_char_esc(kft_parse_context_t *ppc, size_t *pnaccepted, int *pch) {
     break;
 
   case '0':
-    KFT_ACCEPT(ppc, &naccepted);
+  case '1':
+  case '2':
+  case '3':
+  case '4':
+  case '5':
+  case '6':
+  case '7':
     KFT_PARSE(char_escoct, ppc, &naccepted, &och);
     break;
 
@@ -170,11 +177,10 @@ int kft_parse_char(kft_parse_context_t *ppc, size_t *pnaccepted, int *pch) {
     return KFT_PARSE_ERROR;
   }
 
+  KFT_ACCEPT(ppc, &naccepted);
   if (ch == '\\') {
-    KFT_ACCEPT(ppc, &naccepted);
     KFT_PARSE(char_esc, ppc, &naccepted, &ch);
   }
-  KFT_ACCEPT(ppc, &naccepted);
 
   *pch = ch;
 
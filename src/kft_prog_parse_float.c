@@ -5,7 +5,7 @@
 int kft_parse_float_digits(kft_parse_context_t *ppc, size_t *pnaccepted,
                            kft_float_t *pfloatval, int *pndigit, int sign,
                            int radix) {
-  int naccepted = *pnaccepted;
+  size_t naccepted = *pnaccepted;
 
   int ndigit = 0;
   kft_float_t floatval = {.value = 0};
@@ -45,7 +45,8 @@ int kft_parse_float(kft_parse_context_t *ppc, size_t *pnaccepted,
 
   KFT_PARSE(spaces, ppc, &naccepted);
   KFT_PARSE(sign, ppc, &naccepted, &sign);
-  KFT_PARSE(radix, ppc, &naccepted, &radix);
+  // A LEADING ZERO IS NOT OCTAL (0.5)
+  KFT_PARSE(radix, ppc, &naccepted, &radix, 10);
   KFT_PARSE(float_digits, ppc, &naccepted, &floatval, &ndigit, sign, radix);
 
   // Parse fraction
@@ -69,13 +70,13 @@ int kft_parse_float(kft_parse_context_t *ppc, size_t *pnaccepted,
 
   if (ppc->ch_last == 'e' || ppc->ch_last == 'E') {
     int exp_sign = 1;
-    int exp = 0;
+    long exp = 0;
 
     KFT_ACCEPT(ppc, &naccepted);
     KFT_PARSE(sign, ppc, &naccepted, &exp_sign);
     KFT_PARSE(int_digits, ppc, &naccepted, exp_sign, 10, &exp);
 
-    floatval.value *= pow(radix, exp_sign * exp);
+    floatval.value *= pow(10, (double)exp);
   }
 
   // Check if any digit is read
@@ -13,7 +13,7 @@ int kft_parse_int_num(kft_parse_context_t *ppc, size_t *pnaccepted,
 
   KFT_PARSE(spaces, ppc, &naccepted);
   KFT_PARSE(sign, ppc, &naccepted, &sign);
-  KFT_PARSE(radix, ppc, &naccepted, &radix);
+  KFT_PARSE(radix, ppc, &naccepted, &radix, 8);
   KFT_PARSE(int_digits, ppc, &naccepted, sign, radix, &intval.value);
 
   *pintval = intval;
@@ -37,6 +37,7 @@ int kft_parse_int_char(kft_parse_context_t *ppc, size_t *pnaccepted,
   if (KFT_GETLASTC(ppc) != '\'') {
     return KFT_PARSE_ERROR;
   }
+  KFT_ACCEPT(ppc, &naccepted);
 
   *pintval = (kft_int_t){.value = intval};
 
@@ -54,5 +55,5 @@ int kft_parse_int(kft_parse_context_t *ppc, size_t *pnaccepted,
   }
 
   *pnaccepted = naccepted;
-  return KFT_PARSE_ERROR;
+  return KFT_PARSE_OK;
 }
\ No newline at end of file
@@ -21,28 +21,30 @@ int kft_ch_digit(int ch, int radix) {
 }
 
 int kft_parse_sign(kft_parse_context_t *ppc, size_t *pnaccepted, int *psign) {
-  int naccepted = *pnaccepted;
+  size_t naccepted = *pnaccepted;
+
+  int sign = 1;
 
   switch (KFT_GETLASTC(ppc)) {
   case '-':
-    *psign = -1;
+    sign = -1;
     KFT_ACCEPT(ppc, &naccepted);
     break;
 
   case '+':
-    *psign = 1;
     KFT_ACCEPT(ppc, &naccepted);
     break;
   }
 
-  *psign = 1;
+  *psign = sign;
 
   *pnaccepted = naccepted;
   return KFT_PARSE_OK;
 }
 
-int kft_parse_radix(kft_parse_context_t *ppc, size_t *pnaccepted, int *pradix) {
-  int naccepted = *pnaccepted;
+int kft_parse_radix(kft_parse_context_t *ppc, size_t *pnaccepted, int *pradix,
+                    int radix_zero) {
+  size_t naccepted = *pnaccepted;
 
   int radix = 10;
 
@@ -51,6 +53,7 @@ int kft_parse_radix(kft_parse_context_t *ppc, size_t *pnaccepted, int *pradix) {
     return KFT_PARSE_OK;
   }
 
+  kft_parse_context_t saved = *ppc;
   KFT_ACCEPT(ppc, &naccepted);
 
   switch (KFT_GETLASTC(ppc)) {
@@ -79,7 +82,10 @@ int kft_parse_radix(kft_parse_context_t *ppc, size_t *pnaccepted, int *pradix) {
     break;
 
   default:
-    radix = 8;
+    // THE ZERO IS A DIGIT
+    kft_parse_restore(ppc, &saved);
+    naccepted = *pnaccepted;
+    radix = radix_zero;
   }
 
   *pradix = radix;
@@ -89,11 +95,11 @@ int kft_parse_radix(kft_parse_context_t *ppc, size_t *pnaccepted, int *pradix) {
 }
 
 int kft_parse_int_digits(kft_parse_context_t *ppc, size_t *pnaccepted, int sign,
-                         int radix, int *pintval) {
-  int naccepted = *pnaccepted;
+                         int radix, long *pintval) {
+  size_t naccepted = *pnaccepted;
 
   int ndigit = 0;
-  int intval;
+  long intval = 0;
 
   while (1) {
     int digit = kft_ch_digit(ppc->ch_last, radix);
@@ -101,11 +107,11 @@ int kft_parse_int_digits(kft_parse_context_t *ppc, size_t *pnaccepted, int sign,
       break;
     }
 
-    if (sign > 0 && intval > (INT_MAX - digit) / radix) {
+    if (sign > 0 && intval > (LONG_MAX - digit) / radix) {
       return KFT_PARSE_ERROR;
     }
 
-    if (sign < 0 && intval < (INT_MIN + digit) / radix) {
+    if (sign < 0 && intval < (LONG_MIN + digit) / radix) {
       return KFT_PARSE_ERROR;
     }
 
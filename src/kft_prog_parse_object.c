@@ -14,14 +14,18 @@ int kft_parse_object(kft_parse_context_t *ppc, size_t *pnaccepted,
   KFT_PARSE(symbol, ppc, &naccepted, &symbol);
 
   while (1) {
-    kft_expr_t expr;
-    int ret = KFT_PARSE(expr, ppc, &naccepted, &expr);
+    kft_parse_context_t saved = *ppc;
+    size_t nsaved = naccepted;
+    kft_expr_t *pexpr;
+    int ret = kft_parse_expr(ppc, &naccepted, &pexpr);
     if (ret != KFT_PARSE_OK) {
+      kft_parse_restore(ppc, &saved);
+      naccepted = nsaved;
       break;
     }
     fields = (kft_expr_t **)kft_realloc(fields,
                                         sizeof(kft_expr_t *) * (nfields + 1));
-    fields[nfields] = &expr;
+    fields[nfields++] = pexpr;
   }
 
   *pobject = (kft_object_t *)kft_malloc(sizeof(kft_object_t));
@@ -0,0 +1,161 @@
+#include "kft_prog_parse_op.h"
+#include "kft_malloc.h"
+#include <string.h>
+
+/** characters of operators */
+#define KFT_PARSE_OP_CHARS "|&^=!<>+-*/%~?:"
+
+/** operators of two characters */
+static const char *const kft_parse_ops2[] = {"||", "&&", "==", "!=", "<=",
+                                             ">=", "<<", ">>", "=>"};
+
+/** binary operators by precedence level (lowest first) */
+static const char *const kft_parse_binary_ops[][5] = {
+    {"||"},       {"&&"},
+    {"|"},        {"^"},
+    {"&"},        {"==", "!="},
+    {"<", "<=", ">", ">="},
+    {"<<", ">>"}, {"+", "-"},
+    {"*", "/", "%"},
+};
+
+/** number of precedence levels */
+#define KFT_PARSE_NLEVELS                                                      \
+  (sizeof(kft_parse_binary_ops) / sizeof(kft_parse_binary_ops[0]))
+
+/**
+ * Create an operation (a call of the operator)
+ *
+ * @param op operator
+ * @param args operands
+ * @param nargs number of operands
+ * @return expression
+ */
+static kft_expr_t *kft_parse_new_op(const char *op, kft_expr_t *const *args,
+                                    size_t nargs) {
+  kft_expr_t **v = (kft_expr_t **)kft_malloc(sizeof(kft_expr_t *) * nargs);
+  memcpy(v, args, sizeof(kft_expr_t *) * nargs);
+  kft_expr_t *pcallee = kft_expr_new_symbol(kft_string_new(op, strlen(op)));
+  return kft_expr_new_call(pcallee, v, nargs);
+}
+
+int kft_parse_op(kft_parse_context_t *ppc, size_t *pnaccepted,
+                 char op[KFT_PARSE_OP_MAX]) {
+  size_t naccepted = *pnaccepted;
+
+  KFT_PARSE(spaces, ppc, &naccepted);
+  int ch = KFT_GETLASTC(ppc);
+  if (ch == EOF || ch == '\0' || strchr(KFT_PARSE_OP_CHARS, ch) == NULL) {
+    return KFT_PARSE_ERROR;
+  }
+  op[0] = (char)ch;
+  op[1] = '\0';
+  int ch2 = KFT_ACCEPT(ppc, &naccepted);
+  for (size_t i = 0; i < sizeof(kft_parse_ops2) / sizeof(kft_parse_ops2[0]);
+       i++) {
+    if (kft_parse_ops2[i][0] == ch && kft_parse_ops2[i][1] == ch2) {
+      op[1] = (char)ch2;
+      op[2] = '\0';
+      KFT_ACCEPT(ppc, &naccepted);
+      break;
+    }
+  }
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+int kft_parse_unary(kft_parse_context_t *ppc, size_t *pnaccepted,
+                    kft_expr_t **ppexpr) {
+  size_t naccepted = *pnaccepted;
+
+  kft_parse_context_t saved = *ppc;
+  char op[KFT_PARSE_OP_MAX];
+  int ret = kft_parse_op(ppc, &naccepted, op);
+  if (ret != KFT_PARSE_OK || op[1] != '\0' || strchr("-+!~", op[0]) == NULL) {
+    // NOT A UNARY OPERATOR
+    kft_parse_restore(ppc, &saved);
+    naccepted = *pnaccepted;
+    KFT_PARSE(primary, ppc, &naccepted, ppexpr);
+
+    *pnaccepted = naccepted;
+    return KFT_PARSE_OK;
+  }
+
+  kft_expr_t *parg;
+  KFT_PARSE(unary, ppc, &naccepted, &parg);
+  *ppexpr = kft_parse_new_op(op, &parg, 1);
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+int kft_parse_binary(kft_parse_context_t *ppc, size_t *pnaccepted,
+                     size_t level, kft_expr_t **ppexpr) {
+  if (level == KFT_PARSE_NLEVELS) {
+    return kft_parse_unary(ppc, pnaccepted, ppexpr);
+  }
+
+  size_t naccepted = *pnaccepted;
+
+  kft_expr_t *args[2];
+  KFT_PARSE(binary, ppc, &naccepted, level + 1, &args[0]);
+
+  while (1) {
+    kft_parse_context_t saved = *ppc;
+    size_t nsaved = naccepted;
+    char op[KFT_PARSE_OP_MAX];
+    bool found = false;
+    if (kft_parse_op(ppc, &naccepted, op) == KFT_PARSE_OK) {
+      const char *const *ops = kft_parse_binary_ops[level];
+      for (size_t i = 0; i < 5 && ops[i] != NULL && !found; i++) {
+        found = strcmp(ops[i], op) == 0;
+      }
+    }
+    if (!found) {
+      // AN OPERATOR OF A LOWER LEVEL (OR THE END)
+      kft_parse_restore(ppc, &saved);
+      naccepted = nsaved;
+      break;
+    }
+    KFT_PARSE(binary, ppc, &naccepted, level + 1, &args[1]);
+    args[0] = kft_parse_new_op(op, args, 2);
+  }
+
+  *ppexpr = args[0];
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+int kft_parse_ternary(kft_parse_context_t *ppc, size_t *pnaccepted,
+                      kft_expr_t **ppexpr) {
+  size_t naccepted = *pnaccepted;
+
+  kft_expr_t *args[3];
+  KFT_PARSE(binary, ppc, &naccepted, 0, &args[0]);
+
+  kft_parse_context_t saved = *ppc;
+  size_t nsaved = naccepted;
+  char op[KFT_PARSE_OP_MAX];
+  int ret = kft_parse_op(ppc, &naccepted, op);
+  if (ret != KFT_PARSE_OK || strcmp(op, "?") != 0) {
+    kft_parse_restore(ppc, &saved);
+    *ppexpr = args[0];
+
+    *pnaccepted = nsaved;
+    return KFT_PARSE_OK;
+  }
+
+  KFT_PARSE(expr, ppc, &naccepted, &args[1]);
+  KFT_PARSE(op, ppc, &naccepted, op);
+  if (strcmp(op, ":") != 0) {
+    return KFT_PARSE_ERROR;
+  }
+  // RIGHT ASSOCIATIVE
+  KFT_PARSE(ternary, ppc, &naccepted, &args[2]);
+  *ppexpr = kft_parse_new_op("?", args, 3);
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "kft.h"
+#include "kft_prog_parse.h"
+
+/** maximum length of an operator (with the terminating NUL) */
+#define KFT_PARSE_OP_MAX 3
+
+/**
+ * Parse an operator (the longest one)
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param op operator
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+int kft_parse_op(kft_parse_context_t *ppc, size_t *pnaccepted,
+                 char op[KFT_PARSE_OP_MAX]);
+
+/**
+ * Parse a unary operation (- + ! ~) or a primary expression
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param ppexpr expression
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+int kft_parse_unary(kft_parse_context_t *ppc, size_t *pnaccepted,
+                    kft_expr_t **ppexpr);
+
+/**
+ * Parse binary operations (left associative) of a precedence level and
+ * higher
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param level precedence level (0 is ||, the lowest)
+ * @param ppexpr expression
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+int kft_parse_binary(kft_parse_context_t *ppc, size_t *pnaccepted,
+                     size_t level, kft_expr_t **ppexpr);
+
+/**
+ * Parse a conditional operation (COND ? THEN : ELSE) or a binary operation
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param ppexpr expression
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+int kft_parse_ternary(kft_parse_context_t *ppc, size_t *pnaccepted,
+                      kft_expr_t **ppexpr);
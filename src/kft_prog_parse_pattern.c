@@ -0,0 +1,153 @@
+#include "kft_prog_parse_pattern.h"
+#include "kft_malloc.h"
+#include "kft_prog_parse_int.h"
+#include "kft_prog_parse_string.h"
+#include "kft_prog_parse_symbol.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Test whether a pattern binds a variable twice
+ *
+ * @param pexpr pattern
+ * @param names variables bound so far (at least as many as in pexpr)
+ * @param pnnames number of variables bound so far
+ * @return true if a variable other than _ is bound twice
+ */
+static bool kft_pattern_has_repeat(const kft_expr_t *pexpr,
+                                   const char **names, size_t *pnnames) {
+  if (pexpr->type == KFT_EXPR_OBJECT) {
+    for (size_t i = 0; i < pexpr->val.object_val->nfields; i++) {
+      if (kft_pattern_has_repeat(pexpr->val.object_val->fields[i], names,
+                                 pnnames)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  if (pexpr->type != KFT_EXPR_SYMBOL) {
+    return false;
+  }
+  const char *name = pexpr->val.symbol_val.name.value;
+  if (strcmp(name, "_") == 0) {
+    return false;
+  }
+  for (size_t i = 0; i < *pnnames; i++) {
+    if (strcmp(names[i], name) == 0) {
+      return true;
+    }
+  }
+  names[(*pnnames)++] = name;
+  return false;
+}
+
+/**
+ * Count the variables of a pattern (upper bound of its bound variables)
+ *
+ * @param pexpr pattern
+ * @return number of symbols in the pattern
+ */
+static size_t kft_pattern_count_symbols(const kft_expr_t *pexpr) {
+  if (pexpr->type == KFT_EXPR_SYMBOL) {
+    return 1;
+  }
+  size_t count = 0;
+  if (pexpr->type == KFT_EXPR_OBJECT) {
+    for (size_t i = 0; i < pexpr->val.object_val->nfields; i++) {
+      count += kft_pattern_count_symbols(pexpr->val.object_val->fields[i]);
+    }
+  }
+  return count;
+}
+
+/**
+ * Parse a tuple of patterns or a pattern in parentheses
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param ppexpr pattern
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+static int kft_parse_pattern_tuple(kft_parse_context_t *ppc,
+                                   size_t *pnaccepted, kft_expr_t **ppexpr) {
+  size_t naccepted = *pnaccepted;
+
+  kft_expr_t **fields = NULL;
+  size_t nfields = 0;
+  bool tuple = false;
+
+  KFT_ACCEPT(ppc, &naccepted); // (
+  KFT_PARSE(spaces, ppc, &naccepted);
+  while (KFT_GETLASTC(ppc) != ')') {
+    kft_expr_t *pfield;
+    KFT_PARSE(pattern, ppc, &naccepted, &pfield);
+    fields = (kft_expr_t **)kft_realloc(fields,
+                                        sizeof(kft_expr_t *) * (nfields + 1));
+    fields[nfields++] = pfield;
+    KFT_PARSE(spaces, ppc, &naccepted);
+    if (KFT_GETLASTC(ppc) != ',') {
+      break;
+    }
+    tuple = true;
+    KFT_ACCEPT(ppc, &naccepted);
+    KFT_PARSE(spaces, ppc, &naccepted);
+  }
+  if (KFT_GETLASTC(ppc) != ')') {
+    return KFT_PARSE_ERROR;
+  }
+  KFT_ACCEPT(ppc, &naccepted);
+
+  // (P) IS P, () AND (P,) ARE TUPLES
+  *ppexpr = nfields == 1 && !tuple ? fields[0]
+                                   : kft_expr_new_tuple(fields, nfields);
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
+
+int kft_parse_pattern(kft_parse_context_t *ppc, size_t *pnaccepted,
+                      kft_expr_t **ppexpr) {
+  size_t naccepted = *pnaccepted;
+
+  kft_expr_t *pexpr;
+
+  KFT_PARSE(spaces, ppc, &naccepted);
+  int ch = KFT_GETLASTC(ppc);
+  if (ch == '(') {
+    KFT_PARSE(pattern_tuple, ppc, &naccepted, &pexpr);
+  } else if (ch == '"') {
+    kft_string_t strval;
+    KFT_PARSE(string, ppc, &naccepted, &strval);
+    pexpr = kft_expr_new_string(strval.value, strval.len);
+    free(strval.value);
+  } else if (ch == '\'') {
+    kft_int_t intval;
+    KFT_PARSE(int_char, ppc, &naccepted, &intval);
+    pexpr = kft_expr_new_int(intval.value);
+  } else if (isdigit(ch) || ch == '-' || ch == '+') {
+    KFT_PARSE(number, ppc, &naccepted, &pexpr);
+  } else if (isalpha(ch) || ch == '_') {
+    kft_symbol_t symbol;
+    KFT_PARSE(symbol, ppc, &naccepted, &symbol);
+    pexpr = kft_expr_new_symbol(symbol.name);
+  } else {
+    return KFT_PARSE_ERROR;
+  }
+
+  // A VARIABLE BOUND TWICE (SUCH AS (a, a)) CAN NOT BE MATCHED
+  size_t nsymbols = kft_pattern_count_symbols(pexpr);
+  if (nsymbols > 1) {
+    const char **names =
+        (const char **)kft_malloc(sizeof(const char *) * nsymbols);
+    size_t nnames = 0;
+    if (kft_pattern_has_repeat(pexpr, names, &nnames)) {
+      return KFT_PARSE_ERROR;
+    }
+  }
+
+  *ppexpr = pexpr;
+
+  *pnaccepted = naccepted;
+  return KFT_PARSE_OK;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "kft.h"
+#include "kft_prog_parse.h"
+
+/**
+ * Parse a pattern (a literal, a variable, _ or a tuple of patterns)
+ *
+ * A variable is a symbol expression; a tuple is an object of the empty
+ * symbol.
+ *
+ * @param ppc parser context
+ * @param pnaccepted number of accepted chars
+ * @param ppexpr pattern
+ * @return KFT_PARSE_OK or KFT_PARSE_ERROR
+ */
+int kft_parse_pattern(kft_parse_context_t *ppc, size_t *pnaccepted,
+                      kft_expr_t **ppexpr);
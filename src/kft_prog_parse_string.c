@@ -59,5 +59,7 @@ int kft_parse_string(kft_parse_context_t *ppc, size_t *pnaccepted,
   kft_string_t strval = {.value = retval.buf, .len = retval.len};
 
   *pstrval = strval;
+
+  *pnaccepted = naccepted;
   return KFT_PARSE_OK;
 }
\ No newline at end of file
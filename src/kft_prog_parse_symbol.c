@@ -7,6 +7,10 @@ int kft_parse_symbol_name(kft_parse_context_t *ppc, size_t *pnaccepted,
   size_t naccepted = *pnaccepted;
 
   KFT_PARSE(spaces, ppc, &naccepted);
+  int ch_first = KFT_GETLASTC(ppc);
+  if (!isalpha(ch_first) && ch_first != '_') {
+    return KFT_PARSE_ERROR;
+  }
   kft_memfp_t mfp = KFT_MEMFP_INIT();
   int ret = kft_open_memstream(&mfp);
   if (ret != KFT_SUCCESS) {
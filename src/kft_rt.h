@@ -0,0 +1,126 @@
+#pragma once
+
+#include "kft.h"
+#include "kft_ops.h"
+#include <stddef.h>
+
+/**
+ * The runtime of a template translated to C (kft --emit-c).
+ */
+typedef struct kft_rt kft_rt_t;
+
+/**
+ * The template translated to C.
+ */
+typedef struct kft_rt_template kft_rt_template_t;
+
+/** a block continued at another source offset (see kft_rt_block) */
+#define KFT_RT_JUMP (-2)
+
+/** a part of a renderer ended (the next part continues) */
+#define KFT_RT_NEXT (-3)
+
+/**
+ * Render a part of a template translated to C
+ *
+ * @param prt runtime
+ * @param srcoff source offset to start at
+ * @return KFT_SUCCESS (end of template), KFT_RT_NEXT, KFT_RT_JUMP, KFT_FAILURE
+ * or the status of a block
+ */
+typedef int (*kft_rt_render_t)(kft_rt_t *prt, size_t srcoff);
+
+/**
+ * A part of a renderer (the translation is split to keep each function
+ * small enough for the C compiler).
+ */
+typedef struct kft_rt_part {
+  /** source offset the part starts at */
+  size_t srcoff;
+  /** renderer of the part */
+  kft_rt_render_t render;
+} kft_rt_part_t;
+
+/**
+ * The template translated to C.
+ */
+struct kft_rt_template {
+  /** template filename (used in messages and as $INPUT) */
+  const char *filename;
+  /** escape character */
+  int ch_esc;
+  /** start delimiter */
+  const char *delim_st;
+  /** end delimiter */
+  const char *delim_en;
+  /** source */
+  const char *src;
+  /** length of source */
+  size_t srclen;
+  /** pool of unescaped text */
+  const char *pool;
+  /** length of pool */
+  size_t poollen;
+  /** operations */
+  const kft_op_t *ops;
+  /** number of operations */
+  size_t nops;
+  /** parts of the translated renderer (by ascending source offset) */
+  const kft_rt_part_t *parts;
+  /** number of parts */
+  size_t nparts;
+};
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Write plain text
+ *
+ * @param prt runtime
+ * @param str text
+ * @param len length of text
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+int kft_rt_text(kft_rt_t *prt, const char *str, size_t len)
+    __attribute__((nonnull(1, 2), warn_unused_result));
+
+/**
+ * Run a block
+ *
+ * The block is run by the interpreter, so a tag, a goto or a redirection
+ * (which runs the rest of the template) may move the source offset elsewhere
+ * than the end of the block; the renderer then returns KFT_RT_JUMP and the
+ * runtime continues at the new offset.
+ *
+ * @param prt runtime
+ * @param srcoff source offset of the start delimiter
+ * @param endoff source offset after the end delimiter
+ * @return KFT_SUCCESS, KFT_RT_JUMP, KFT_FAILURE or the status of the block
+ */
+int kft_rt_block(kft_rt_t *prt, size_t srcoff, size_t endoff)
+    __attribute__((nonnull(1), warn_unused_result));
+
+/**
+ * Run the rest of the template by the interpreter (from a source offset
+ * which is not translated)
+ *
+ * @param prt runtime
+ * @param srcoff source offset
+ * @return KFT_SUCCESS, KFT_FAILURE or the status of a block
+ */
+int kft_rt_rest(kft_rt_t *prt, size_t srcoff)
+    __attribute__((nonnull(1), warn_unused_result));
+
+/**
+ * Run kft with command line arguments
+ *
+ * @param argc number of arguments
+ * @param argv arguments
+ * @param ptmpl template translated to C, rendered instead of the input files
+ * (NULL for kft itself)
+ * @return exit status
+ */
+int kft_main(int argc, char *argv[], const kft_rt_template_t *ptmpl)
+    __attribute__((nonnull(2)));
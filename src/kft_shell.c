@@ -0,0 +1,401 @@
+#include "kft_shell.h"
+#include "kft_io_output.h"
+#include "kft_malloc.h"
+#include "kft_vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** file descriptor of the standard input of kft in the shell */
+#define KFT_SHELL_FD_STDIN 3
+
+/** lowest file descriptor used for pipes to the shell in kft */
+#define KFT_SHELL_FD_MIN 10
+
+/** initial size of the read buffer */
+#define KFT_SHELL_RBUFSIZE 4096
+
+struct kft_shell {
+  /** shell command (NULL when not running) */
+  char *shell;
+  /** process id of the shell (-1 when not running) */
+  pid_t pid;
+  /** write end of the script pipe */
+  int fd_script;
+  /** read end of the output pipe */
+  int fd_output;
+  /** marker written after the output of each script */
+  char marker[64];
+  /** length of marker */
+  size_t markerlen;
+  /** environment known by the shell (sorted "NAME=VALUE") */
+  char **envs;
+  /** number of envs */
+  size_t nenvs;
+  /** generation of the variables when envs was taken */
+  unsigned long envgen;
+  /** read buffer */
+  char *rbuf;
+  /** size of read buffer */
+  size_t rbufsize;
+};
+
+kft_shell_t *kft_shell_new(void) {
+  kft_shell_t *psh = (kft_shell_t *)kft_malloc(sizeof(kft_shell_t));
+  *psh = (kft_shell_t){
+      .shell = NULL,
+      .pid = -1,
+      .fd_script = -1,
+      .fd_output = -1,
+      .markerlen = 0,
+      .envs = NULL,
+      .nenvs = 0,
+      .envgen = 0,
+      .rbuf = (char *)kft_malloc_atomic(KFT_SHELL_RBUFSIZE),
+      .rbufsize = KFT_SHELL_RBUFSIZE,
+  };
+  return psh;
+}
+
+/**
+ * Stop the shell
+ *
+ * @param psh persistent shell
+ * @return exit status of the shell (as kft_exec reports), or -1
+ */
+static int kft_shell_stop(kft_shell_t *psh) {
+  if (psh->pid == -1) {
+    return -1;
+  }
+  // THE SHELL EXITS AT THE END OF SCRIPTS
+  close(psh->fd_script);
+  close(psh->fd_output);
+  int retcode = -1;
+  int status;
+  pid_t pid;
+  do {
+    pid = waitpid(psh->pid, &status, 0);
+  } while (pid == -1 && errno == EINTR);
+  if (pid == psh->pid) {
+    if (WIFEXITED(status)) {
+      retcode = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+      retcode = 128 + WTERMSIG(status);
+    }
+  }
+  psh->pid = -1;
+  psh->fd_script = -1;
+  psh->fd_output = -1;
+  return retcode;
+}
+
+void kft_shell_delete(kft_shell_t *psh) {
+  kft_shell_stop(psh);
+  kft_free(psh);
+}
+
+static int kft_shell_envcmp(const void *p1, const void *p2) {
+  return strcmp(*(char *const *)p1, *(char *const *)p2);
+}
+
+/**
+ * Take a sorted snapshot of the environment
+ *
+ * @param pnenvs number of entries
+ * @return entries (sorted)
+ */
+static char **kft_shell_env_snapshot(size_t *pnenvs) {
+  char *const *envp = kft_vars_envp();
+  size_t nenvs = 0;
+  while (envp[nenvs] != NULL) {
+    nenvs++;
+  }
+  char **envs = (char **)kft_malloc((nenvs + 1) * sizeof(char *));
+  for (size_t i = 0; i < nenvs; i++) {
+    envs[i] = kft_strdup(envp[i]);
+  }
+  envs[nenvs] = NULL;
+  qsort(envs, nenvs, sizeof(char *), kft_shell_envcmp);
+  *pnenvs = nenvs;
+  return envs;
+}
+
+/**
+ * Test whether an environment entry has a shell variable name
+ *
+ * @param env environment entry ("NAME=VALUE")
+ * @return length of name, or 0 if not a shell variable name
+ */
+static size_t kft_shell_env_namelen(const char *env) {
+  size_t i = 0;
+  if (!(env[0] == '_' || ('A' <= env[0] && env[0] <= 'Z') ||
+        ('a' <= env[0] && env[0] <= 'z'))) {
+    return 0;
+  }
+  for (i = 1; env[i] != '=' && env[i] != '\0'; i++) {
+    int ch = env[i];
+    if (!(ch == '_' || ('A' <= ch && ch <= 'Z') || ('a' <= ch && ch <= 'z') ||
+          ('0' <= ch && ch <= '9'))) {
+      return 0;
+    }
+  }
+  return env[i] == '=' ? i : 0;
+}
+
+static void kft_shell_puts(const char *str, kft_output_t *po) {
+  kft_write(str, 1, strlen(str), po);
+}
+
+/**
+ * Write a string quoted for the shell
+ *
+ * @param str string
+ * @param len length of string
+ * @param po output
+ */
+static void kft_shell_quote(const char *str, size_t len, kft_output_t *po) {
+  kft_fputc('\'', po);
+  for (const char *p = str, *end = str + len; p < end;) {
+    const char *q = memchr(p, '\'', end - p);
+    if (q == NULL) {
+      kft_write(p, 1, end - p, po);
+      break;
+    }
+    kft_write(p, 1, q - p, po);
+    kft_shell_puts("'\\''", po);
+    p = q + 1;
+  }
+  kft_fputc('\'', po);
+}
+
+/**
+ * Write the commands to bring the environment of the shell up to date
+ *
+ * @param psh persistent shell
+ * @param po output
+ */
+static void kft_shell_env_sync(kft_shell_t *psh, kft_output_t *po) {
+  // NOTHING IS SET OR UNSET SINCE THE PREVIOUS SCRIPT
+  if (psh->envgen == kft_vars_generation()) {
+    return;
+  }
+  size_t nenvs;
+  char **envs = kft_shell_env_snapshot(&nenvs);
+  size_t i = 0, j = 0;
+  while (i < nenvs || j < psh->nenvs) {
+    int cmp = i == nenvs        ? 1
+              : j == psh->nenvs ? -1
+                                : strcmp(envs[i], psh->envs[j]);
+    if (cmp == 0) {
+      i++;
+      j++;
+    } else if (cmp < 0) {
+      // NEW OR CHANGED
+      size_t namelen = kft_shell_env_namelen(envs[i]);
+      if (namelen > 0) {
+        const char *value = envs[i] + namelen + 1;
+        kft_shell_puts("export ", po);
+        kft_write(envs[i], 1, namelen + 1, po);
+        kft_shell_quote(value, strlen(value), po);
+        kft_fputc('\n', po);
+      }
+      i++;
+    } else {
+      // REMOVED (OR CHANGED AND ALREADY EXPORTED)
+      size_t namelen = kft_shell_env_namelen(psh->envs[j]);
+      if (namelen > 0) {
+        char name[namelen + 1];
+        memcpy(name, psh->envs[j], namelen);
+        name[namelen] = '\0';
+        if (kft_vars_get(name, NULL) == NULL) {
+          kft_shell_puts("unset ", po);
+          kft_write(name, 1, namelen, po);
+          kft_fputc('\n', po);
+        }
+      }
+      j++;
+    }
+  }
+  psh->envs = envs;
+  psh->nenvs = nenvs;
+  psh->envgen = kft_vars_generation();
+}
+
+/**
+ * Duplicate a file descriptor out of the way of the standard ones
+ *
+ * @param fd file descriptor (closed)
+ * @return new file descriptor (close on exec), or -1
+ */
+static int kft_shell_fd_move(int fd) {
+  int fd_new = fcntl(fd, F_DUPFD_CLOEXEC, KFT_SHELL_FD_MIN);
+  close(fd);
+  return fd_new;
+}
+
+/**
+ * Start the shell
+ *
+ * @param psh persistent shell (not running)
+ * @param shell shell command
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_shell_start(kft_shell_t *psh, const char *shell) {
+  int fds_script[2];
+  int fds_output[2];
+  if (pipe2(fds_script, O_CLOEXEC) == -1) {
+    return KFT_FAILURE;
+  }
+  if (pipe2(fds_output, O_CLOEXEC) == -1) {
+    close(fds_script[0]);
+    close(fds_script[1]);
+    return KFT_FAILURE;
+  }
+  for (int i = 0; i < 2; i++) {
+    fds_script[i] = kft_shell_fd_move(fds_script[i]);
+    fds_output[i] = kft_shell_fd_move(fds_output[i]);
+  }
+
+  // fds_script[0] -> STDIN_FILENO, fds_output[1] -> STDOUT_FILENO
+  // STDIN_FILENO (of kft) -> KFT_SHELL_FD_STDIN
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, STDIN_FILENO, KFT_SHELL_FD_STDIN);
+  posix_spawn_file_actions_adddup2(&fa, fds_script[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&fa, fds_output[1], STDOUT_FILENO);
+  char *argv[] = {(char *)shell, NULL};
+  pid_t pid;
+  int err = posix_spawnp(&pid, shell, &fa, NULL, argv, kft_vars_envp());
+  posix_spawn_file_actions_destroy(&fa);
+  close(fds_script[0]);
+  close(fds_output[1]);
+  if (err != 0) {
+    fprintf(stderr, "%s: %s\n", shell, strerror(err));
+    close(fds_script[1]);
+    close(fds_output[0]);
+    return KFT_FAILURE;
+  }
+
+  uint64_t nonce = 0;
+  if (getrandom(&nonce, sizeof(nonce), 0) != sizeof(nonce)) {
+    nonce = (uint64_t)(uintptr_t)psh ^ (uint64_t)pid;
+  }
+  psh->markerlen =
+      snprintf(psh->marker, sizeof(psh->marker), "\036KFT-%d-%016llx:", pid,
+               (unsigned long long)nonce);
+  psh->shell = kft_strdup(shell);
+  psh->pid = pid;
+  psh->fd_script = fds_script[1];
+  psh->fd_output = fds_output[0];
+  psh->envs = kft_shell_env_snapshot(&psh->nenvs);
+  psh->envgen = kft_vars_generation();
+  return KFT_SUCCESS;
+}
+
+/**
+ * Write all data to a file descriptor
+ *
+ * @param fd file descriptor
+ * @param ptr data
+ * @param len length of data
+ * @return KFT_SUCCESS or KFT_FAILURE
+ */
+static int kft_shell_write_all(int fd, const char *ptr, size_t len) {
+  while (len > 0) {
+    ssize_t ret = write(fd, ptr, len);
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return KFT_FAILURE;
+    }
+    ptr += ret;
+    len -= ret;
+  }
+  return KFT_SUCCESS;
+}
+
+int kft_shell_run(kft_shell_t *psh, const char *shell, const char *script,
+                  size_t len, const char **pout, size_t *poutlen) {
+  *pout = psh->rbuf;
+  *poutlen = 0;
+
+  // (RE)START SHELL
+  if (psh->pid != -1 && strcmp(psh->shell, shell) != 0) {
+    kft_shell_stop(psh);
+  }
+  if (psh->pid == -1 && kft_shell_start(psh, shell) != KFT_SUCCESS) {
+    return KFT_FAILURE;
+  }
+
+  // SEND SCRIPT WITH FRAMING
+  kft_output_t *po_frame = kft_output_new_mem();
+  kft_shell_env_sync(psh, po_frame);
+  kft_shell_puts("eval ", po_frame);
+  kft_shell_quote(script, len, po_frame);
+  kft_shell_puts(" <&3\nprintf '%s%d\\n' ", po_frame);
+  kft_shell_quote(psh->marker, psh->markerlen, po_frame);
+  kft_shell_puts(" \"$?\"\n", po_frame);
+  const char *frame = kft_output_get_data(po_frame);
+  size_t framelen = kft_output_get_size(po_frame);
+  // A DEAD SHELL IS FOUND BY READING (NOT BY SIGPIPE)
+  sigset_t sigpipe, sigsaved;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &sigsaved);
+  int ret = kft_shell_write_all(psh->fd_script, frame, framelen);
+  if (ret != KFT_SUCCESS && errno == EPIPE) {
+    struct timespec ts = {0, 0};
+    sigtimedwait(&sigpipe, NULL, &ts);
+  }
+  pthread_sigmask(SIG_SETMASK, &sigsaved, NULL);
+  kft_output_delete(po_frame);
+
+  // READ OUTPUT UNTIL MARKER AND STATUS
+  size_t rlen = 0;
+  const char *pmarker = NULL;
+  while (1) {
+    if (pmarker != NULL &&
+        memchr(pmarker + psh->markerlen, '\n',
+               psh->rbuf + rlen - pmarker - psh->markerlen) != NULL) {
+      break;
+    }
+    if (rlen == psh->rbufsize) {
+      psh->rbufsize *= 2;
+      psh->rbuf = (char *)kft_realloc(psh->rbuf, psh->rbufsize);
+      if (pmarker != NULL) {
+        pmarker = memmem(psh->rbuf, rlen, psh->marker, psh->markerlen);
+      }
+    }
+    ssize_t nread =
+        read(psh->fd_output, psh->rbuf + rlen, psh->rbufsize - rlen);
+    if (nread == -1 && errno == EINTR) {
+      continue;
+    }
+    if (nread <= 0) {
+      // THE SHELL HAS EXITED (OR FAILED)
+      int retcode = kft_shell_stop(psh);
+      *pout = psh->rbuf;
+      *poutlen = rlen;
+      return retcode == -1 ? 127 : retcode;
+    }
+    size_t from = rlen < psh->markerlen ? 0 : rlen - psh->markerlen + 1;
+    rlen += nread;
+    if (pmarker == NULL) {
+      pmarker = memmem(psh->rbuf + from, rlen - from, psh->marker,
+                       psh->markerlen);
+    }
+  }
+
+  *pout = psh->rbuf;
+  *poutlen = pmarker - psh->rbuf;
+  return atoi(pmarker + psh->markerlen);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "kft.h"
+#include <stddef.h>
+
+/**
+ * The persistent shell coprocess.
+ */
+typedef struct kft_shell kft_shell_t;
+
+/* --------------------------------------------- *
+ * Constructors and Destructors                  *
+ * --------------------------------------------- */
+
+/**
+ * Create a persistent shell (started at the first script)
+ *
+ * @return persistent shell
+ */
+kft_shell_t *kft_shell_new(void)
+    __attribute__((warn_unused_result, malloc, returns_nonnull));
+
+/**
+ * Stop the shell and delete the persistent shell
+ *
+ * @param psh persistent shell
+ */
+void kft_shell_delete(kft_shell_t *psh) __attribute__((nonnull(1)));
+
+/* --------------------------------------------- *
+ * Operations                                    *
+ * --------------------------------------------- */
+
+/**
+ * Run a script in the persistent shell
+ *
+ * The shell is (re)started when it is not running or the shell command has
+ * changed. Environment changes since the previous script are exported first.
+ * The script reads the standard input of kft.
+ *
+ * @param psh persistent shell
+ * @param shell shell command (a POSIX shell)
+ * @param script script
+ * @param len length of script
+ * @param pout standard output of the script (valid until the next call)
+ * @param poutlen length of standard output
+ * @return exit status of the script, or KFT_FAILURE
+ */
+int kft_shell_run(kft_shell_t *psh, const char *shell, const char *script,
+                  size_t len, const char **pout, size_t *poutlen)
+    __attribute__((nonnull(1, 2, 3, 5, 6), warn_unused_result));
@@ -0,0 +1,250 @@
+#include "kft_vars.h"
+#include "kft_error.h"
+#include "kft_hash.h"
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/** initial number of slots (power of 2) */
+#define KFT_VARS_NSLOTS 256
+
+/**
+ * The value of a variable (length-prefixed).
+ */
+typedef struct kft_vars_value {
+  /** length of data */
+  size_t len;
+  /** data (NUL terminated) */
+  char data[];
+} kft_vars_value_t;
+
+/**
+ * The slot of the variable table.
+ */
+typedef struct kft_vars_slot {
+  /** name (interned; NULL when the slot is empty) */
+  char *name;
+  /** hash of name */
+  uint64_t hash;
+  /** value (NULL when unset) */
+  kft_vars_value_t *pvalue;
+} kft_vars_slot_t;
+
+/** slots (open addressing, linear probing) */
+static kft_vars_slot_t *kft_vars_slots = NULL;
+
+/** number of slots (power of 2) */
+static size_t kft_vars_nslots = 0;
+
+/** number of used slots (names, set or unset) */
+static size_t kft_vars_nused = 0;
+
+/** number of set variables */
+static size_t kft_vars_nset = 0;
+
+/** generation (changed by each mutation) */
+static unsigned long kft_vars_gen = 0;
+
+/** cached environment */
+static char **kft_vars_env = NULL;
+
+/** generation of cached environment */
+static unsigned long kft_vars_env_gen = (unsigned long)-1;
+
+static void *kft_vars_alloc(size_t size) {
+  void *ptr = malloc(size);
+  if (ptr == NULL) {
+    kft_error("%s: %m\n", "malloc");
+  }
+  return ptr;
+}
+
+/**
+ * Find the slot of a name
+ *
+ * @param name name
+ * @param len length of name
+ * @param hash hash of name
+ * @return slot (empty if the name is not in the table)
+ */
+static kft_vars_slot_t *kft_vars_find(const char *name, size_t len,
+                                      uint64_t hash) {
+  size_t mask = kft_vars_nslots - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    kft_vars_slot_t *ps = &kft_vars_slots[i];
+    if (ps->name == NULL ||
+        (ps->hash == hash && strncmp(ps->name, name, len) == 0 &&
+         ps->name[len] == '\0')) {
+      return ps;
+    }
+  }
+}
+
+/**
+ * Rebuild the table when it is half full
+ */
+static void kft_vars_reserve(void) {
+  if (kft_vars_nslots != 0 && (kft_vars_nused + 1) * 2 <= kft_vars_nslots) {
+    return;
+  }
+  kft_vars_slot_t *slots_old = kft_vars_slots;
+  size_t nslots_old = kft_vars_nslots;
+  // AT MOST A QUARTER FULL AFTER UNSET NAMES ARE DROPPED
+  kft_vars_nslots = KFT_VARS_NSLOTS;
+  while (kft_vars_nslots < (kft_vars_nset + 1) * 4) {
+    kft_vars_nslots *= 2;
+  }
+  kft_vars_slots =
+      (kft_vars_slot_t *)kft_vars_alloc(kft_vars_nslots * sizeof(*slots_old));
+  memset(kft_vars_slots, 0, kft_vars_nslots * sizeof(*slots_old));
+  kft_vars_nused = 0;
+  for (size_t i = 0; i < nslots_old; i++) {
+    kft_vars_slot_t *ps_old = &slots_old[i];
+    // UNSET NAMES ARE DROPPED
+    if (ps_old->name == NULL) {
+      continue;
+    }
+    if (ps_old->pvalue == NULL) {
+      free(ps_old->name);
+      continue;
+    }
+    size_t mask = kft_vars_nslots - 1;
+    size_t j = ps_old->hash & mask;
+    while (kft_vars_slots[j].name != NULL) {
+      j = (j + 1) & mask;
+    }
+    kft_vars_slots[j] = *ps_old;
+    kft_vars_nused++;
+  }
+  free(slots_old);
+}
+
+/**
+ * Set a variable by a name of given length
+ *
+ * @param name name
+ * @param namelen length of name
+ * @param value value
+ * @param len length of value
+ */
+static void kft_vars_set_n(const char *name, size_t namelen, const char *value,
+                           size_t len) {
+  kft_vars_reserve();
+  uint64_t hash = kft_hash_key(name, namelen);
+  kft_vars_slot_t *ps = kft_vars_find(name, namelen, hash);
+  if (ps->name == NULL) {
+    ps->name = (char *)kft_vars_alloc(namelen + 1);
+    memcpy(ps->name, name, namelen);
+    ps->name[namelen] = '\0';
+    ps->hash = hash;
+    kft_vars_nused++;
+  }
+  if (ps->pvalue == NULL) {
+    kft_vars_nset++;
+  } else {
+    free(ps->pvalue);
+  }
+  kft_vars_value_t *pvalue =
+      (kft_vars_value_t *)kft_vars_alloc(sizeof(kft_vars_value_t) + len + 1);
+  pvalue->len = len;
+  memcpy(pvalue->data, value, len);
+  pvalue->data[len] = '\0';
+  ps->pvalue = pvalue;
+  kft_vars_gen++;
+}
+
+void kft_vars_import(char *const envp[]) {
+  for (size_t i = 0; envp[i] != NULL; i++) {
+    const char *eq = strchr(envp[i], '=');
+    if (eq == NULL || eq == envp[i]) {
+      continue;
+    }
+    kft_vars_set_n(envp[i], eq - envp[i], eq + 1, strlen(eq + 1));
+  }
+}
+
+const char *kft_vars_get(const char *name, size_t *plen) {
+  if (kft_vars_nslots == 0) {
+    return NULL;
+  }
+  size_t namelen = strlen(name);
+  kft_vars_slot_t *ps = kft_vars_find(name, namelen,
+                                      kft_hash_key(name, namelen));
+  if (ps->pvalue == NULL) {
+    return NULL;
+  }
+  if (plen != NULL) {
+    *plen = ps->pvalue->len;
+  }
+  return ps->pvalue->data;
+}
+
+int kft_vars_set(const char *name, const char *value, size_t len) {
+  if (name[0] == '\0' || strchr(name, '=') != NULL) {
+    return KFT_FAILURE;
+  }
+  kft_vars_set_n(name, strlen(name), value, len);
+  return KFT_SUCCESS;
+}
+
+void kft_vars_unset(const char *name) {
+  if (kft_vars_nslots == 0) {
+    return;
+  }
+  size_t namelen = strlen(name);
+  kft_vars_slot_t *ps = kft_vars_find(name, namelen,
+                                      kft_hash_key(name, namelen));
+  if (ps->pvalue == NULL) {
+    return;
+  }
+  // THE NAME STAYS (SET AGAIN WITHOUT A NEW SLOT)
+  free(ps->pvalue);
+  ps->pvalue = NULL;
+  kft_vars_nset--;
+  kft_vars_gen++;
+}
+
+unsigned long kft_vars_generation(void) { return kft_vars_gen; }
+
+char **kft_vars_envp(void) {
+  if (kft_vars_env != NULL && kft_vars_env_gen == kft_vars_gen) {
+    return kft_vars_env;
+  }
+  // ONE BLOCK FOR THE VECTOR AND THE STRINGS
+  size_t size = (kft_vars_nset + 1) * sizeof(char *);
+  for (size_t i = 0; i < kft_vars_nslots; i++) {
+    kft_vars_slot_t *ps = &kft_vars_slots[i];
+    if (ps->pvalue != NULL) {
+      size += strlen(ps->name) + 1 + strlen(ps->pvalue->data) + 1;
+    }
+  }
+  char **env = (char **)kft_vars_alloc(size);
+  char *p = (char *)(env + kft_vars_nset + 1);
+  size_t n = 0;
+  for (size_t i = 0; i < kft_vars_nslots; i++) {
+    kft_vars_slot_t *ps = &kft_vars_slots[i];
+    if (ps->pvalue == NULL) {
+      continue;
+    }
+    env[n++] = p;
+    size_t namelen = strlen(ps->name);
+    memcpy(p, ps->name, namelen);
+    p += namelen;
+    *p++ = '=';
+    size_t len = strlen(ps->pvalue->data);
+    memcpy(p, ps->pvalue->data, len + 1);
+    p += len + 1;
+  }
+  env[n] = NULL;
+
+  // environ MAY STILL POINT TO THE OLD ONE
+  if (environ == kft_vars_env) {
+    environ = env;
+  }
+  free(kft_vars_env);
+  kft_vars_env = env;
+  kft_vars_env_gen = kft_vars_gen;
+  return env;
+}
+
+void kft_vars_sync(void) { environ = kft_vars_envp(); }
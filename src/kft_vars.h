@@ -0,0 +1,78 @@
+#pragma once
+
+#include "kft.h"
+#include <stddef.h>
+
+/* --------------------------------------------- *
+ * Constructors and Destructors                  *
+ * --------------------------------------------- */
+
+/**
+ * Import variables from an environment
+ *
+ * @param envp environment ("NAME=VALUE", NULL terminated)
+ */
+void kft_vars_import(char *const envp[]) __attribute__((nonnull(1)));
+
+/* --------------------------------------------- *
+ * Accessors                                     *
+ * --------------------------------------------- */
+
+/**
+ * Get a variable
+ *
+ * The value is valid until the variable is set or unset.
+ *
+ * @param name name of variable
+ * @param plen length of value (may be NULL)
+ * @return value (NUL terminated), or NULL if not set
+ */
+const char *kft_vars_get(const char *name, size_t *plen)
+    __attribute__((nonnull(1), warn_unused_result));
+
+/**
+ * Set a variable
+ *
+ * @param name name of variable (not empty, without '=')
+ * @param value value (may contain NUL)
+ * @param len length of value
+ * @return KFT_SUCCESS, or KFT_FAILURE for an invalid name
+ */
+int kft_vars_set(const char *name, const char *value, size_t len)
+    __attribute__((nonnull(1, 2)));
+
+/**
+ * Unset a variable
+ *
+ * @param name name of variable
+ */
+void kft_vars_unset(const char *name) __attribute__((nonnull(1)));
+
+/**
+ * Get the generation of the variables (changed by each mutation)
+ *
+ * @return generation
+ */
+unsigned long kft_vars_generation(void) __attribute__((warn_unused_result));
+
+/* --------------------------------------------- *
+ * Environment                                   *
+ * --------------------------------------------- */
+
+/**
+ * Get the variables as an environment
+ *
+ * The vector is cached until the next mutation. A value is cut at its first
+ * NUL character.
+ *
+ * @return environment ("NAME=VALUE", NULL terminated)
+ */
+char **kft_vars_envp(void) __attribute__((warn_unused_result, returns_nonnull));
+
+/**
+ * Make the process environment (environ) match the variables
+ *
+ * Call before anything which reads environ (spawn with PATH search,
+ * kwordexp, tzset, ...).
+ */
+void kft_vars_sync(void);
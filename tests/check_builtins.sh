@@ -0,0 +1,21 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+# SAME OUTPUT AS THE COMMANDS
+run_expect "a b" kft -e "{{#echo a b}}"
+run_expect "a-1 b-2" kft -e "{{#printf '%s-%d' a 1}} {{#printf '%s-%d' b 2}}"
+run_expect "c" kft -e "{{#basename /a/b/c.txt .txt}}"
+run_expect "1
+2
+3" kft -e "{{#seq 3}}"
+run_expect "body" kft -e "{{#cat
+body}}"
+
+# SAME OUTPUT WITHOUT BUILTINS
+run_expect "a b" kft -N -e "{{#echo a b}}"
+run_expect "a-1 b-2" kft --no-builtins -e "{{#printf '%s-%d' a 1}} {{#printf '%s-%d' b 2}}"
+
+# UNSUPPORTED ARGUMENTS RUN THE COMMAND
+run_expect "1.5" kft -e "{{#printf '%.1f' 1.5}}"
+
+exit 0
@@ -0,0 +1,30 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+KFT_CACHE_DIR="$(mktemp -d)"
+export KFT_CACHE_DIR
+COUNTER="$KFT_CACHE_DIR/counter"
+
+# A HIT REPLAYS THE OUTPUT WITHOUT RUNNING THE COMMAND
+run_expect "1" kft -e "{{!echo x >> $COUNTER; wc -l < $COUNTER}}"
+run_expect "1" kft -e "{{!echo x >> $COUNTER; wc -l < $COUNTER}}"
+
+# THE EXIT STATUS IS REPLAYED TOO
+run_expect "a" kft -e "{{!echo x >> $COUNTER; printf a; exit 3}}b" || true
+run_expect "a" kft -e "{{!echo x >> $COUNTER; printf a; exit 3}}b" || true
+run_expect "2" kft -e "{{!wc -l < $COUNTER}}"
+
+# VARIABLES IN THE KEY
+KFT_CACHE_ENV=V
+export KFT_CACHE_ENV
+run_expect "1" kft V=1 -e "{{!echo \$V}}"
+run_expect "2" kft V=2 -e "{{!echo \$V}}"
+
+# BODY OF COMMAND IN THE KEY
+run_expect "AB" kft -e "{{#tr a-z A-Z
+ab}}"
+run_expect "CD" kft -e "{{#tr a-z A-Z
+cd}}"
+
+rm -rf "$KFT_CACHE_DIR"
+exit 0
@@ -0,0 +1,14 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+DIR="$(mktemp -d)"
+printf 'a\\{{b\\\\c{{$X}}\\}}d' > "$DIR/inc.kft"
+
+# A FILE INCLUDED AGAIN RUNS COMPILED
+run_expect "a{{b\\c1}}d a{{b\\c2}}d" kft -e "{{\$X=1}}{{<$DIR/inc.kft}} {{\$X=2}}{{<$DIR/inc.kft}}"
+
+# A LOOP RUNS COMPILED
+run_expect "[{{x}}\\][{{x}}\\]" kft -e "{{:L}}[\\{{x\\}}{{-c}}\\\\]{{@L}}"
+
+rm -rf "$DIR"
+exit 0
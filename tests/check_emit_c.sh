@@ -0,0 +1,19 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+DIR="$(mktemp -d)"
+
+# THE TRANSLATED TEMPLATE RENDERS AS kft DOES (TAGS, GOTOS AND REDIRECTION)
+run_expect "a{{b 1
+[1][1][1]
+hi
+
+sh
+
+end" ./check_emit_c_render X=1 OUT="$DIR/out"
+run_expect "tail" cat "$DIR/out"
+run_expect "$(kft X=2 OUT="$DIR/out" "$(dirname "$0")/check_emit_c.kft")" \
+  ./check_emit_c_render X=2 OUT="$DIR/out"
+
+rm -rf "$DIR"
+exit 0
@@ -17,4 +17,24 @@ RESULT="$(timeout 1 kft ENV= -e '{{$ENV}}')"
 if [ "$RESULT" != "" ]; then
     echo "Expected '', got '$RESULT'"
     exit 1
-fi
\ No newline at end of file
+fi
+# EACH LINE OF A MULTI-LINE BLOCK IS A SET OR A GET
+run_expect "[abc]" kft -e '{{$V=abc
+}}[{{$V}}]'
+run_expect "[ab]" kft -e '{{$V=a
+W=b}}[{{$V}}{{$W}}]'
+run_expect "a|" kft -e '{{$V=a
+V}}|'
+
+# OVERWRITE, UNSET AND EXPORT TO CHILDREN
+run_expect "[b]" kft -e '{{$V=a}}{{$V=b}}[{{$V}}]'
+run_expect "[]<>" kft -e '{{$V=a}}{{$V=}}[{{$V}}]{{!echo "<$V>"}}'
+run_expect "[env]<t>" env V=env kft -e '[{{$V}}]{{$V=t}}{{!echo "<$V>"}}'
+run_expect "[]<>" env V=env kft V= -e '[{{$V}}]{{!echo "<$V>"}}'
+run_expect "1" kft -N -e '{{$V=1}}{{#printenv V}}'
+run_expect "<p>
+<>" kft -P -e '{{$V=p}}{{!echo "<$V>"}}{{$V=}}{{!echo "<$V>"}}'
+
+# MANY VARIABLES
+VARS="$(for i in $(seq 500); do printf '{{$V%d=%d}}' "$i" "$i"; done; for i in $(seq 500); do printf '{{$V%d}}\n' "$i"; done)"
+run_expect "$(seq 500)" kft -e "$VARS"
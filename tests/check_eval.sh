@@ -0,0 +1,41 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+# ARITHMETIC
+run_expect "7" kft -e "{{=1+2*3}}"
+run_expect "9" kft -e "{{=(1+2)*3}}"
+run_expect "3 3.5 1" kft -e "{{=7/2}} {{=7/2.0}} {{=7%3}}"
+run_expect "31 5 8 0" kft -e "{{=0x1F}} {{=0b101}} {{=010}} {{=0}}"
+run_expect "0.25 1000" kft -e "{{=2.5e-1}} {{=1e3}}"
+run_expect "16 -1" kft -e "{{=1<<4}} {{=~0}}"
+
+# VARIABLES (NUMBERS BY VALUE)
+run_expect "7.5" kft a=3 b=4.5 -e "{{=a+b}}"
+run_expect "8" kft -e "{{\$n={{!echo 7}}}}{{=n+1}}"
+run_expect "6" kft -e "{{\$n=5}}{{=1+{{\$n}}}}"
+
+# COMPARISONS AND LOGIC
+run_expect "1 0 1" kft a=3 -e "{{=a==3}} {{=a<2}} {{=\"abc\"<\"abd\"}}"
+run_expect "big" kft a=3 -e "{{=a>1?\"big\":\"small\"}}"
+run_expect "1 0" kft -e "{{=1||undefined}} {{=0&&undefined}}"
+
+# STRINGS
+run_expect "n=3" kft a=3 -e "{{=\"n=\"+a}}"
+run_expect "cde ABC 5" kft -e "{{=substr(\"abcdef\",2,3)}} {{=upper(\"aBc\")}} {{=len(\"hello\")}}"
+run_expect "43 123" kft -e "{{=int(\"42\")+1}} {{=str(12)+3}}"
+
+# A LOOP COUNTER
+run_expect "123" kft -e "{{\$i=0}}{{:L=2}}{{\$i={{=i+1}}}}{{=i}}{{@L}}"
+
+# ERRORS
+TESTMSG="kft -e '{{=1/0}}'"
+if kft -e '{{=1/0}}' 2>/dev/null; then
+    echo "Expected a failure"
+    exit 1
+fi
+
+TESTMSG="kft -e '{{=1+}}'"
+if kft -e '{{=1+}}' 2>/dev/null; then
+    echo "Expected a failure"
+    exit 1
+fi
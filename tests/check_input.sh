@@ -0,0 +1,73 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+TMPDIR_INPUT="$(mktemp -d)"
+LONG="$(head -c 20000 /dev/zero | tr '\0' x)"
+
+# A MAPPED INPUT TRUNCATED BY A BLOCK IS AN ERROR (NOT SIGBUS)
+INPUT="$TMPDIR_INPUT/truncated.kft"
+printf '{{!: > %s}}%s\n' "$INPUT" "$LONG" > "$INPUT"
+run_expect_error "file changed while reading" kft "$INPUT"
+
+# A LOOP WITHIN THE BUFFER LIMIT (-B) READ FROM A PIPE
+run_expect "abab|" sh -c "printf '{{:L}}ab{{@L}}|' | kft -B 1K"
+run_expect "1001" sh -c "printf '{{:L}}%s{{@L}}|' '$(printf %.500s "$LONG")' | kft -B 1K | wc -c"
+
+# A LOOP LONGER THAN THE LIMIT CAN NOT GO BACK
+run_expect_error "L: seek failed" sh -c "printf '{{:L}}%s{{@L}}|' '$(printf %.5000s "$LONG")' | kft -B 1K"
+
+# LOOKAHEAD (A DELIMITER) LONGER THAN THE LIMIT
+DST="<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<"
+DEN=">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>"
+run_expect "a1" sh -c "printf 'a%s\$X%s' '$DST' '$DEN' | kft -B 64 -S '$DST' -R '$DEN' X=1"
+run_expect_error "lookahead exceeds the input buffer limit (16 bytes)" sh -c "printf 'a%s\$X%s' '$DST' '$DEN' | kft -B 16 -S '$DST' -R '$DEN' X=1"
+
+# A BLOCK OR AN ESCAPE STRADDLING A READ CHUNK (STDIN AND FILE ALIKE)
+INPUT="$TMPDIR_INPUT/chunk.kft"
+for N in 65533 65534 65535 65536; do
+    PAD="$(printf %.${N}s "$LONG$LONG$LONG$LONG")"
+    printf '%s{{$X}}|' "$PAD" > "$INPUT"
+    run_expect "${PAD}1|" kft X=1 "$INPUT"
+    run_expect "${PAD}1|" sh -c "cat '$INPUT' | kft X=1"
+    printf '%s\\{{y\\}}|' "$PAD" > "$INPUT"
+    run_expect "${PAD}{{y}}|" kft "$INPUT"
+    run_expect "${PAD}{{y}}|" sh -c "cat '$INPUT' | kft"
+done
+for N in 60 61 62 63 64 65; do
+    PAD="$(printf %.${N}s "$LONG")"
+    run_expect "${PAD}1${PAD}{{y}}|" sh -c "printf '%s{{\$X}}%s\\\\{{y\\\\}}|' '$PAD' '$PAD' | kft -B 64 X=1"
+done
+
+# STOP BYTES (ESCAPE, DELIMITERS, NEWLINE) AT EVERY OFFSET OF A VECTOR
+HIGH="$(printf '\377')"
+for N in $(seq 0 70); do
+    PAD="$(printf %.${N}s "$LONG")"
+    TEXT="${PAD}{a}b\\c${HIGH}
+{{\$X}}\\{{y\\}}${PAD}"
+    run_expect "${PAD}{a}b\\c${HIGH}
+1{{y}}${PAD}" kft X=1 -e "$TEXT"
+    run_expect "${PAD}1${PAD}" sh -c "printf '%s{{\$X}}%s' '$PAD' '$PAD' | kft X=1"
+done
+
+# DELIMITERS LONGER THAN 8 BYTES (NEAR MISSES AND RING WRAPS)
+DST="<<<<<<<<<["
+DEN="]>>>>>>>>>"
+INPUT="$TMPDIR_INPUT/delim.kft"
+printf 'a%s$X%sb<<<<<<<<<x<<<x<<<<<[%s$X]>>>>>>>>x%s|' "$DST" "$DEN" "$DST" "$DEN" > "$INPUT"
+run_expect "a1b<<<<<<<<<x<<<x<<<<<[|" kft -S "$DST" -R "$DEN" X=1 "$INPUT"
+run_expect "a1b<<<<<<<<<x<<<x<<<<<[|" sh -c "kft -B 16 -S '$DST' -R '$DEN' X=1 < '$INPUT'"
+printf '\\%sy\\%s|a<<<<<<<<<' "$DST" "$DEN" > "$INPUT"
+run_expect "${DST}y$DEN|a<<<<<<<<<" kft -S "$DST" -R "$DEN" "$INPUT"
+printf 'a%s:T%sb%s@T%sc' "$DST" "$DEN" "$DST" "$DEN" > "$INPUT"
+run_expect "abbc" kft -S "$DST" -R "$DEN" "$INPUT"
+run_expect "abbc" sh -c "kft -B 64 -S '$DST' -R '$DEN' < '$INPUT'"
+printf 'a%s@F%sb%s:F%sc' "$DST" "$DEN" "$DST" "$DEN" > "$INPUT"
+run_expect "ac" kft -S "$DST" -R "$DEN" "$INPUT"
+for N in $(seq 0 20); do
+    PAD="$(printf %.${N}s "$LONG")"
+    run_expect "${PAD}1$PAD" sh -c "printf '%s%s\$X%s%s' '$PAD' '$DST' '$DEN' '$PAD' | kft -B 16 -S '$DST' -R '$DEN' X=1"
+done
+run_expect "a{{b}}c" kft -E % -e 'a%{{b%}}c'
+
+rm -rf "$TMPDIR_INPUT"
+exit 0
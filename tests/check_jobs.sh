@@ -0,0 +1,38 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+# OUTPUTS ARE KEPT IN DOCUMENT ORDER
+run_expect "1 2 3" kft -j 3 -e "{{!sleep 0.3; printf 1}} {{!sleep 0.1; printf 2}} {{!printf 3}}"
+
+# VARIABLE ASSIGNMENTS WAIT FOR RUNNING BLOCKS
+run_expect "a b" kft -j 2 -e "{{!sleep 0.1; printf a}}{{\$V= b}}{{\$V}}"
+
+# A JOB DOES NOT INHERIT THE PIPES OF ANOTHER RUNNING JOB
+NFDS="$(kft -e "{{!ls /proc/self/fd | wc -l}}")"
+run_expect "$NFDS" kft -j 2 -e "{{!sleep 0.2}}{{!ls /proc/self/fd | wc -l}}"
+run_expect "$NFDS" kft -j 2 -e "{{#!sh
+sleep 0.2}}{{!ls /proc/self/fd | wc -l}}"
+
+# A BODY PASSED AS AN ARGUMENT (/dev/fd/N) IS STILL READABLE
+run_expect "a|b" kft -j 2 -e "{{#!cat
+a}}|{{#cat
+b}}"
+
+# NO BLOCK IS STARTED AFTER A FAILED ONE (THE NESTED SLEEP LETS IT EXIT)
+MARK="$(mktemp -u)"
+TESTMSG="kft -j 4 (a failed job)"
+ret=0
+RESULT="$(kft -j 4 -e "a{{!exit 3}}b{{#cat
+{{!sleep 0.3}}c}}d{{!echo x > $MARK}}e")" || ret=$?
+if [ "$ret" -eq 0 ] || [ -e "$MARK" ]; then
+    echo "Expected a failure before the last block, got status $ret"
+    rm -f "$MARK"
+    exit 1
+fi
+case "$RESULT" in
+ab*e) echo "Expected no output after the last block, got '$RESULT'"; exit 1 ;;
+ab*) ;;
+*) echo "Expected the output before the failed block, got '$RESULT'"; exit 1 ;;
+esac
+
+exit 0
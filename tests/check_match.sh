@@ -0,0 +1,44 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+# LITERALS (THE FIRST MATCHING ARM)
+run_expect "three" kft -e "{{=match(3, 1 => \"one\", 3 => \"three\", _ => \"other\")}}"
+run_expect "2 int" kft -e "{{=match(\"b\", \"a\" => 1, \"b\" => 2)}} {{=match(2.0, 2 => \"int\")}}"
+run_expect "neg 5" kft -e "{{=match(-1, -1 => \"neg\", _ => \"no\")}} {{=match(5, x => x, 5 => 0)}}"
+run_expect "hi" kft s=hello -e "{{=match(s, \"hello\" => \"hi\", _ => \"?\",)}}"
+
+# TUPLES
+run_expect "(1, 2) (1,) ()" kft -e "{{=(1, 2)}} {{=(1,)}} {{=()}}"
+run_expect "20 5" kft -e "{{=match((1, 2), (1, x) => x * 10, _ => 0)}} {{=match((1, (2, 3)), (1, (y, z)) => y + z)}}"
+run_expect "b c" kft -e "{{=match((2, 2), (1, _) => \"a\", (x, 2) => \"b\", (2, _) => \"c\")}} {{=match((2, 5), (1, _) => \"a\", (x, 2) => \"b\", (2, _) => \"c\")}}"
+
+# BINDS SET TEMPLATE VARIABLES
+run_expect "1 4x" kft -e "{{=(a, b) = (4, \"x\")}} {{\$a}}{{\$b}}"
+run_expect "0" kft -e "{{=(1, a) = (2, 3)}}"
+
+# ERRORS
+TESTMSG="kft -e '{{=match(9, 1 => 1)}}'"
+if kft -e '{{=match(9, 1 => 1)}}' 2>/dev/null; then
+    echo "Expected a failure"
+    exit 1
+fi
+
+TESTMSG="kft -e '{{=match(9)}}'"
+if kft -e '{{=match(9)}}' 2>/dev/null; then
+    echo "Expected a failure"
+    exit 1
+fi
+
+# A NAME BOUND TWICE IN ONE PATTERN
+TESTMSG="kft -e '{{=match((1, 2), (a, a) => a, _ => 0)}}'"
+if kft -e '{{=match((1, 2), (a, a) => a, _ => 0)}}' 2>/dev/null; then
+    echo "Expected a failure"
+    exit 1
+fi
+
+TESTMSG="kft -e '{{=(a, a) = (1, 2)}}'"
+if kft -e '{{=(a, a) = (1, 2)}}' 2>/dev/null; then
+    echo "Expected a failure"
+    exit 1
+fi
+run_expect "1 12" kft -e "{{=(_, _) = (1, 2)}} {{=match((1, 2), (a, b) => a * 10 + b)}}"
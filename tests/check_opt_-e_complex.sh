@@ -5,4 +5,19 @@ TEXT="hello world"
 
 run_expect "$TEXT$TEXT" kft -e "$TEXT" -e "$TEXT"
 
+# TEMPLATES READ IN PLACE (BLOCKS, ESCAPES AND GOTOS WITHIN ONE -e)
+run_expect "ab1" kft -e "a" -e "b{{\$X}}" X=1
+run_expect "2" kft -e "{{\$X=2}}" -e "{{\$X}}"
+run_expect "a\\" kft -e "a\\"
+run_expect "a" kft -e "a{{"
+run_expect "x
+x
+x
+|" kft -e "{{:L=2}}x
+{{@L}}|"
+run_expect_error "<inline>:2:8: M: tag not found" kft -e "a
+b{{@M}}"
+LONG="$(head -c 50000 /dev/zero | tr '\0' x)"
+run_expect "100001" sh -c "kft -e '$LONG{{\$X}}$LONG' X=1 | wc -c"
+
 exit 0
\ No newline at end of file
@@ -0,0 +1,61 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+TMPDIR_OUTPUT="$(mktemp -d)"
+INPUT="$TMPDIR_OUTPUT/input.kft"
+awk 'BEGIN { for (i = 0; i < 300; i++) printf "line %d %0400d{{!printf \"[%d]\"}}\n", i, i, i % 7 }' > "$INPUT"
+SUM="$(kft "$INPUT" | cksum)"
+
+# WRITE-THROUGH (-W 0) AND A TINY BUFFER GIVE THE SAME BYTES
+run_expect "$SUM" sh -c "kft -W 0 '$INPUT' | cksum"
+run_expect "$SUM" sh -c "kft -W 1 '$INPUT' | cksum"
+run_expect "$SUM" sh -c "KFT_WRITE_BUFFER=3 kft '$INPUT' | cksum"
+run_expect "$SUM" sh -c "kft -W 1 -j 4 '$INPUT' | cksum"
+
+# AN OUTPUT FILE IS FLUSHED AT EXIT
+kft -W 1 -o "$TMPDIR_OUTPUT/w1.out" "$INPUT"
+run_expect "$SUM" sh -c "cksum < '$TMPDIR_OUTPUT/w1.out'"
+kft -W 0 -o "$TMPDIR_OUTPUT/w0.out" "$INPUT"
+run_expect "$SUM" sh -c "cksum < '$TMPDIR_OUTPUT/w0.out'"
+
+# TEXT RUNS AROUND, INSIDE AND AFTER BLOCKS
+run_expect "aline one
+  line two 1 endb" kft X=1 -e 'a{{#cat
+line one
+  line two {{$X}} end}}b'
+run_expect "word1 word21 tail
+|" kft X=1 -e '{{#echo word1   word2{{$X}} tail
+}}|'
+run_expect "[pre 1 post]" kft X=1 -e '{{$V=pre {{$X}} post}}[{{$V}}]'
+run_expect "[1]" kft X=1 -e '{{-long comment {{$X=2}} text
+ more}}[{{$X}}]'
+
+# A RUN LONGER THAN THE WRITE BUFFER AND THE PIPE TO A CHILD
+LONG="$(head -c 100000 /dev/zero | tr '\0' x)"
+run_expect "100001" sh -c "kft -e '{{#cat
+$LONG}}|' | wc -c"
+run_expect "|" kft -e "{{-$LONG}}|"
+run_expect "100002" sh -c "kft -W 1 -e '$LONG{{\$X}}|' X=1 | wc -c"
+
+# DIRECTIVE-FREE RUNS OF MAPPED FILES (PIPE, FILE, APPEND, MEMORY, JOBS)
+PLAIN="$TMPDIR_OUTPUT/plain.txt"
+awk 'BEGIN { for (i = 0; i < 3000; i++) printf "plain %d %060d\n", i, i }' > "$PLAIN"
+MIXED="$TMPDIR_OUTPUT/mixed.kft"
+{ printf '{{$X}}'; cat "$PLAIN"; printf '{{<%s}}{{$X}}' "$PLAIN"; } > "$MIXED"
+SUM="$({ printf 1; cat "$PLAIN" "$PLAIN"; printf 1; } | cksum)"
+run_expect "$(cksum < "$PLAIN")" sh -c "kft '$PLAIN' | cksum"
+run_expect "$SUM" sh -c "kft X=1 '$MIXED' | cksum"
+run_expect "$SUM" sh -c "kft X=1 < '$MIXED' | cksum"
+run_expect "$SUM" sh -c "kft X=1 -j 2 '$MIXED' | cksum"
+kft X=1 "$MIXED" > "$TMPDIR_OUTPUT/plain.out"
+run_expect "$SUM" sh -c "cksum < '$TMPDIR_OUTPUT/plain.out'"
+kft X=1 -o "$TMPDIR_OUTPUT/plain.out" "$MIXED"
+run_expect "$SUM" sh -c "cksum < '$TMPDIR_OUTPUT/plain.out'"
+printf head > "$TMPDIR_OUTPUT/plain.out"
+kft X=1 "$MIXED" >> "$TMPDIR_OUTPUT/plain.out"
+run_expect "$({ printf head1; cat "$PLAIN" "$PLAIN"; printf 1; } | cksum)" sh -c "cksum < '$TMPDIR_OUTPUT/plain.out'"
+run_expect "$SUM" sh -c "kft X=1 -e '{{#cat
+{{<$MIXED}}}}' | cksum"
+
+rm -rf "$TMPDIR_OUTPUT"
+exit 0
@@ -5,4 +5,32 @@ TEXT="hello world"
 
 run_expect "$TEXT" kft -e "{{!echo '$TEXT'}}"
 
+# ARGUMENTS AND A BODY PASSED TO A SPAWNED COMMAND
+run_expect "x-y|" kft -N -e '{{#printf %s-%s x y}}|'
+run_expect "body|" kft -N -e '{{#!cat
+body}}|'
+
+# A COMMAND THAT CAN NOT BE SPAWNED FAILS ONCE (NO OUTPUT FROM THE CHILD)
+run_expect_error "no_such_command_kft: No such file or directory" kft -e 'a{{#no_such_command_kft}}b'
+run_expect "a|1" sh -c "kft -e 'a{{#no_such_command_kft}}b' 2>/dev/null; echo \"|\$?\""
+run_expect "a|1" sh -c "kft -e 'a{{#!no_such_command_kft
+x}}b' 2>/dev/null; echo \"|\$?\""
+run_expect "a|1" sh -c "KFT_SHELL=/no/such/shell kft -e 'a{{!echo x}}b' 2>/dev/null; echo \"|\$?\""
+
+# OUTPUTS LARGER THAN A PIPE AND MANY SMALL OUTPUTS
+BLOCKS="$(for i in $(seq 20); do printf '{{!head -c 100000 /dev/zero}}'; done)"
+run_expect "2000000" sh -c "kft -e '$BLOCKS' | wc -c"
+run_expect "2000000" sh -c "kft -j 4 -e '$BLOCKS' | wc -c"
+run_expect "2000000" sh -c "kft -P -e '$BLOCKS' | wc -c"
+BLOCKS="$(for i in $(seq 100); do printf '{{!echo %d}}' "$i"; done)"
+run_expect "$(seq 100 | cksum)" sh -c "kft -e '$BLOCKS' | cksum"
+run_expect "$(seq 100 | cksum)" sh -c "kft -j 4 -e '$BLOCKS' | cksum"
+
+# A BODY AND AN OUTPUT BOTH LARGER THAN A PIPE
+LONG="$(head -c 100000 /dev/zero | tr '\0' x)"
+run_expect "100001" sh -c "kft -N -e '{{#cat
+$LONG}}|' | wc -c"
+run_expect "100001" sh -c "kft -N -e '{{#!cat
+$LONG}}|' | wc -c"
+
 exit 0
\ No newline at end of file
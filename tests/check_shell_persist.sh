@@ -0,0 +1,13 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+# SHELL STATE IS KEPT BETWEEN BLOCKS
+run_expect "hello world" kft -P -e "{{!X=hello}}{{!echo \"\$X world\"}}"
+
+# EXIT STATUS IS REPORTED AND THE SHELL IS RESTARTED
+run_expect "ab" kft -P -e "{{!printf a}}{{!false; true}}{{!printf b}}"
+
+# VARIABLES SET BY THE TEMPLATE ARE EXPORTED
+run_expect "it's" kft -P -e "{{!true}}{{\$V=it's}}{{!echo \"\$V\"}}"
+
+exit 0
@@ -0,0 +1,44 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+# BACKWARD GOTO (ONCE PER TAG)
+run_expect "abab" kft -e "{{:L}}ab{{@L}}"
+
+# EXPLICIT COUNT
+run_expect "abababab|" kft -e "{{:L=3}}ab{{@L}}|"
+run_expect "x" kft -e "{{:L=0}}x{{@L}}"
+
+# A COUNT FOLLOWED BY OTHER CHARS IS PART OF THE NAME
+run_expect "abab|" kft -e "{{:L=1x}}ab{{@L=1x}}|"
+
+# A NAME ENDING IN =DIGITS IS A COUNT, OTHER NAMES MAY CONTAIN =
+run_expect "ababab|" kft -e "{{:v=2}}ab{{@v}}|"
+run_expect "x|" kft -e "{{:v=0}}x{{@v}}|"
+run_expect "abab|" kft -e "{{:v=a}}ab{{@v=a}}|"
+run_expect "abab|" kft -e "{{:v=}}ab{{@v=}}|"
+
+# LOOP READ FROM A PIPE
+run_expect "ababab" sh -c "printf '{{:L=2}}ab{{@L}}' | kft"
+
+# FORWARD GOTO
+run_expect "ad" kft -e "a{{@SKIP}}b{{:SKIP}}d"
+run_expect "[end[end" kft -e "{{:TOP}}[{{@E}}]mid{{:E}}end{{@TOP}}"
+
+# TAGS IN NESTED BLOCKS ARE NOT JUMPED TO
+run_expect "W" kft -e "{{@B}}X{{-{{:B}}}}Y{{:B}}W"
+
+# ROW:COL OF AN ERROR AFTER A GOTO (FILE AND PIPE)
+TMPDIR_TAGS="$(mktemp -d)"
+INPUT="$TMPDIR_TAGS/pos.kft"
+printf '{{:L}}a\nb{{@L}}\nxy{{@M}}' > "$INPUT"
+run_expect_error "$INPUT:3:9: M: tag not found" kft "$INPUT"
+run_expect_error ":3:9: M: tag not found" sh -c "kft < '$INPUT'"
+printf 'a\n{{:L=2}}x\ny{{@L}}\n  {{@M}}' > "$INPUT"
+run_expect_error "$INPUT:4:9: M: tag not found" kft "$INPUT"
+run_expect_error ":4:9: M: tag not found" sh -c "kft < '$INPUT'"
+printf 'xxxxxxxx{{:L}}ab\n\n{{@L}}yy{{@M}}' > "$INPUT"
+run_expect_error "$INPUT:3:15: M: tag not found" kft "$INPUT"
+run_expect_error ":3:15: M: tag not found" sh -c "cat '$INPUT' | kft -B 16"
+printf 'a{{@F}}b\n{{:F}}c\nd{{@M}}' > "$INPUT"
+run_expect_error "$INPUT:3:8: M: tag not found" kft "$INPUT"
+rm -rf "$TMPDIR_TAGS"
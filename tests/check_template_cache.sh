@@ -0,0 +1,25 @@
+#!/bin/sh
+. "$(dirname "$0")/helpers.sh"
+
+DIR="$(mktemp -d)"
+KFT_TEMPLATE_CACHE="$DIR/cache"
+export KFT_TEMPLATE_CACHE
+printf 'a\\{{b {{$X}}\\}}' > "$DIR/t.kft"
+
+# THE FIRST RUN STORES THE COMPILED TEMPLATE, THE NEXT ONE LOADS IT
+run_expect "a{{b 1}}" kft X=1 "$DIR/t.kft"
+run_expect "a{{b 2}}" kft X=2 "$DIR/t.kft"
+
+# A CHANGED FILE IS COMPILED AGAIN
+printf '{{$X}}\\{{c' > "$DIR/t.kft"
+run_expect "3{{c" kft X=3 "$DIR/t.kft"
+
+# A BROKEN ENTRY IS IGNORED
+for f in "$KFT_TEMPLATE_CACHE"/ops/*; do
+  printf 'broken' > "$f"
+done
+run_expect "4{{c" kft X=4 "$DIR/t.kft"
+run_expect "5{{c" kft X=5 "$DIR/t.kft"
+
+rm -rf "$DIR"
+exit 0
@@ -22,4 +22,20 @@ run_expect() {
         echo "Expected '$EXPECT', got '$RESULT'"
         exit 1
     fi
-}
\ No newline at end of file
+}
+run_expect_error() {
+    EXPECT="$1"
+    shift
+    TESTMSG="$*"
+    if ERROR="$(timeout 1 "$@" 2>&1 >/dev/null)"; then
+        echo "Expected a failure"
+        exit 1
+    fi
+    case "$ERROR" in
+    *"$EXPECT"*) ;;
+    *)
+        echo "Expected error '$EXPECT', got '$ERROR'"
+        exit 1
+        ;;
+    esac
+}